@@ -4,8 +4,9 @@
 #include "ctre.hpp"
 #include "nlohmann/json.hpp"
 
-char errorBuffer[CURL_ERROR_SIZE];
-std::string curl_buffer;
+#include <algorithm>
+#include <chrono>
+
 std::string youtube_key;
 
 int writer(char *data, size_t size, size_t nmemb, std::string *writerData)
@@ -18,16 +19,23 @@ int writer(char *data, size_t size, size_t nmemb, std::string *writerData)
     return size * nmemb;
 }
 
-CurlEngine::CurlEngine(boost::asio::io_context& io_context)
-    : running(false)
+// Aborts transfers once the engine is stopped. curl calls it at least once
+// a second, even while waiting for a connection or data.
+int abort_when_stopped(void* engine, curl_off_t, curl_off_t, curl_off_t, curl_off_t)
+{
+    return static_cast<const CurlEngine*>(engine)->stopped() ? 1 : 0;
+}
+
+CurlEngine::CurlEngine(boost::asio::io_context& io_context, queue_limits limits)
+    : running(true)
     , io_context_(io_context)
+    , guard_(limits)
 {}
 
-CURL* CurlEngine::init_request(std::string_view url)
+CURL* CurlEngine::init_request(std::string_view url, std::string& body, char* errorBuffer)
 {
     CURLcode code;
 
-    curl_buffer.clear();
     CURL* conn = curl_easy_init();
 
     if(conn == NULL) {
@@ -53,13 +61,45 @@ CURL* CurlEngine::init_request(std::string_view url)
         return nullptr;
     }
 
+    // an error status, like a 500 from the API, is a failed request
+    code = curl_easy_setopt(conn, CURLOPT_FAILONERROR, 1L);
+    if(code != CURLE_OK) {
+        fprintf(stderr, "Failed to set fail on error option [%s]\n", errorBuffer);
+        return nullptr;
+    }
+
+    // signals don't mix with several threads making requests
+    code = curl_easy_setopt(conn, CURLOPT_NOSIGNAL, 1L);
+    if(code != CURLE_OK) {
+        fprintf(stderr, "Failed to set no signal option [%s]\n", errorBuffer);
+        return nullptr;
+    }
+
+    code = curl_easy_setopt(conn, CURLOPT_XFERINFOFUNCTION, abort_when_stopped);
+    if(code != CURLE_OK) {
+        fprintf(stderr, "Failed to set progress function [%s]\n", errorBuffer);
+        return nullptr;
+    }
+
+    code = curl_easy_setopt(conn, CURLOPT_XFERINFODATA, this);
+    if(code != CURLE_OK) {
+        fprintf(stderr, "Failed to set progress data [%s]\n", errorBuffer);
+        return nullptr;
+    }
+
+    code = curl_easy_setopt(conn, CURLOPT_NOPROGRESS, 0L);
+    if(code != CURLE_OK) {
+        fprintf(stderr, "Failed to enable progress function [%s]\n", errorBuffer);
+        return nullptr;
+    }
+
     code = curl_easy_setopt(conn, CURLOPT_WRITEFUNCTION, writer);
     if(code != CURLE_OK) {
         fprintf(stderr, "Failed to set writer [%s]\n", errorBuffer);
         return nullptr;
     }
 
-    code = curl_easy_setopt(conn, CURLOPT_WRITEDATA, &curl_buffer);
+    code = curl_easy_setopt(conn, CURLOPT_WRITEDATA, &body);
     if(code != CURLE_OK) {
         fprintf(stderr, "Failed to set write data [%s]\n", errorBuffer);
         return nullptr;
@@ -83,41 +123,171 @@ CURL* CurlEngine::init_request(std::string_view url)
 void CurlEngine::execute(request_data&& request)
 {
     std::unique_lock lg{mutex};
-    requests.emplace_back(std::move(request));
-    cv.notify_one();
+
+    // closed, the callback is never called
+    if (!accepting_)
+        return;
+
+    const auto queued = std::find_if(requests.begin(), requests.end(), [&] (const request_data& r) {
+        return r.url == request.url;
+    });
+    if (queued != requests.end()) {
+        queued->callback = [first = std::move(queued->callback), second = std::move(request.callback)] (std::string result) {
+            first(result);
+            second(std::move(result));
+        };
+        guard_.count(queue_guard::admission::coalesce);
+        return;
+    }
+
+    auto outcome = guard_.admit(requests.size(), [] { return false; });
+    switch (outcome) {
+    case queue_guard::admission::drop_oldest:
+        if (tracer_)
+            tracer_->release(requests.front().trace);
+        requests.pop_front();
+        [[fallthrough]];
+    case queue_guard::admission::push:
+        if (tracer_) {
+            request.trace = current_trace();
+            tracer_->add_ref(request.trace);
+            tracer_->stamp(request.trace, trace_stage::http_queued);
+        }
+        requests.emplace_back(std::move(request));
+        cv.notify_one();
+        break;
+    case queue_guard::admission::reject:
+        if (on_rejected_)
+            boost::asio::post(io_context_, std::bind(on_rejected_, std::move(request.url)));
+        break;
+    case queue_guard::admission::drop_newest:
+    case queue_guard::admission::coalesce:
+        break;
+    }
+    guard_.count(outcome);
+    queue_changed();
+}
+
+void CurlEngine::on_overload(std::function<void (bool)> callback)
+{
+    std::unique_lock lg{mutex};
+    on_overload_ = std::move(callback);
+}
+
+void CurlEngine::on_rejected(std::function<void (std::string)> callback)
+{
+    std::unique_lock lg{mutex};
+    on_rejected_ = std::move(callback);
+}
+
+queue_counters CurlEngine::stats() const
+{
+    std::unique_lock lg{mutex};
+    return guard_.counters();
+}
+
+// Call with the mutex held
+void CurlEngine::queue_changed()
+{
+    if (metrics_.queue_depth)
+        metrics_.queue_depth->set(requests.size());
+    if (!guard_.update(requests.size()))
+        return;
+    overloaded_ = guard_.overloaded();
+    if (on_overload_)
+        boost::asio::post(io_context_, std::bind(on_overload_, guard_.overloaded()));
+}
+
+void CurlEngine::close(std::function<void ()> drained)
+{
+    std::unique_lock lg{mutex};
+    accepting_ = false;
+    on_drained_ = std::move(drained);
+    drained_changed();
+}
+
+// Call with the mutex held
+void CurlEngine::drained_changed()
+{
+    if (accepting_ || !requests.empty() || active_ > 0 || !on_drained_)
+        return;
+    boost::asio::post(io_context_, std::move(on_drained_));
+    on_drained_ = nullptr;
 }
 
 void CurlEngine::stop()
 {
-    running = false;
+    {
+        std::unique_lock lg{mutex};
+        running = false;
+        accepting_ = false;
+        for (const auto& request : requests) {
+            if (tracer_)
+                tracer_->release(request.trace);
+        }
+        requests.clear();
+        queue_changed();
+    }
+    cv.notify_all();
 }
 
 void CurlEngine::run()
 {
-    running = true;
     while (running) {
-        std::unique_lock lg{mutex};
-
-        if (requests.empty()) {
-            cv.wait(lg);
+        request_data request;
+        {
+            std::unique_lock lg{mutex};
+
+            cv.wait(lg, [this] { return !requests.empty() || !running; });
+            if (!running)
+                break;
+
+            request = std::move(requests.front());
+            requests.pop_front();
+            ++active_;
+            queue_changed();
         }
 
-        perform_request(std::move(requests.front()));
-        requests.pop_front();
+        // without the lock, so that requests can be queued meanwhile and
+        // other threads running the engine make theirs
+        if (!perform_request(std::move(request))) {
+            request_done();
+        }
     }
 }
 
-void CurlEngine::perform_request(request_data&& request)
+void CurlEngine::request_done()
+{
+    std::unique_lock lg{mutex};
+    --active_;
+    drained_changed();
+}
+
+bool CurlEngine::perform_request(request_data&& request)
 {
+    alloc_scope tag(alloc_tag::http);
     fmt::print("Request: {}\n", request.url);
-    CURL* conn = init_request(request.url);
+    std::string curl_buffer;
+    char errorBuffer[CURL_ERROR_SIZE] = "";
+    CURL* conn = init_request(request.url, curl_buffer, errorBuffer);
 
+    if (tracer_)
+        tracer_->stamp(request.trace, trace_stage::http_started);
+    const auto start = std::chrono::steady_clock::now();
     const CURLcode code = curl_easy_perform(conn);
     curl_easy_cleanup(conn);
+    if (metrics_.latency)
+        metrics_.latency->observe(std::chrono::steady_clock::now() - start);
+    if (tracer_)
+        tracer_->stamp(request.trace, trace_stage::http_done);
 
     if(code != CURLE_OK) {
+        if (metrics_.failures)
+            metrics_.failures->add();
         fmt::print("Failed to get '{}' [{}]\n", request.url.data(), errorBuffer);
-        return;
+        if (tracer_)
+            tracer_->release(request.trace);
+        return false;
     }
 
 
@@ -161,9 +331,29 @@ void CurlEngine::perform_request(request_data&& request)
     if (str) {
         boost::asio::post(
             io_context_,
-            [str = *str, callback = request.callback] {
-                callback(str);
+            [this, str = *str, callback = request.callback, trace = request.trace] {
+                {
+                    alloc_scope tag(alloc_tag::bot);
+                    if (!tracer_) {
+                        callback(str);
+                    } else {
+                        tracer_->stamp(trace, trace_stage::callback);
+                        {
+                            trace_scope scope(trace);
+                            callback(str);
+                        }
+                        tracer_->release(trace);
+                    }
+                }
+                // only now, so that whatever the callback posted is queued
+                // before drained
+                request_done();
             }
         );
+        return true;
     }
+
+    if (tracer_)
+        tracer_->release(request.trace);
+    return false;
 }
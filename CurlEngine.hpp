@@ -1,8 +1,15 @@
 #ifndef CURL_ENGINE_HPP_INCLUDED
 #define CURL_ENGINE_HPP_INCLUDED
 
+#include "alloc_accounting.hpp"
+#include "backpressure.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
 #include <curl/curl.h>
 
+#include <utility> // before asio, its awaitable.hpp uses std::exchange
+
 #include <boost/asio.hpp>
 
 #include <atomic>
@@ -18,29 +25,87 @@ extern std::string youtube_key;
 struct request_data {
     std::string url;
     std::function<void(std::string)> callback;
+    // set by execute() to the trace it was made from
+    trace_id trace = 0;
+};
+
+// Where a CurlEngine reports to a metrics_registry, unset ones are skipped
+struct http_metrics
+{
+    gauge* queue_depth = nullptr;
+    // time of the HTTP request itself, not the time it was queued
+    histogram* latency = nullptr;
+    counter* failures = nullptr;
 };
 
 int writer(char *data, size_t size, size_t nmemb, std::string *writerData);
+int abort_when_stopped(void* engine, curl_off_t, curl_off_t, curl_off_t, curl_off_t);
 
 class CurlEngine
 {
 public:
-    CurlEngine(boost::asio::io_context& io_context);
+    using request_type = request_data;
+
+    // Requests for a URL that is already queued are coalesced with the
+    // queued one, whatever the policy; the callbacks of both get the result.
+    CurlEngine(boost::asio::io_context& io_context, queue_limits limits = {});
 
     void execute(request_data&& request);
+    // Stops taking requests, later ones are dropped without calling their
+    // callbacks. Queued requests are still made, and drained is posted to
+    // the io_context once the callback of the last one has returned, after
+    // anything the callbacks posted themselves.
+    void close(std::function<void ()> drained);
+    // Makes the threads running the engine return: queued requests are
+    // dropped and the ones being made are aborted
     void stop();
+    bool stopped() const { return !running; }
+    // Makes requests until stopped. Several threads may run the engine to
+    // make requests concurrently.
     void run();
 
+    // Called on the io_context when the request queue fills up, and again
+    // once it has drained to half its capacity
+    void on_overload(std::function<void (bool overloaded)> callback);
+    // Called on the io_context with the URL of requests refused by a full
+    // queue with the reject policy
+    void on_rejected(std::function<void (std::string url)> callback);
+
+    bool overloaded() const { return overloaded_; }
+    queue_counters stats() const;
+
+    // Call before run()
+    void set_metrics(http_metrics metrics) { metrics_ = metrics; }
+    // Requests join the trace that is current when they are executed, and
+    // their callbacks run with it. Call before run().
+    void set_tracer(tracer* tracer) { tracer_ = tracer; }
+
 
 private:
-    CURL* init_request(std::string_view url);
-    void perform_request(request_data&& request);
+    // body and errorBuffer receive the response and curl's error message
+    CURL* init_request(std::string_view url, std::string& body, char* errorBuffer);
+    // Returns whether the callback was posted, the request is done when
+    // it returns
+    bool perform_request(request_data&& request);
+    void request_done();
+    void queue_changed();
+    void drained_changed();
 
-    std::mutex mutex;
+    mutable std::mutex mutex;
     std::condition_variable cv;
     std::list<request_data> requests;
     std::atomic<bool> running;
+    bool accepting_ = true;
+    // requests being made or with their callback still to run
+    std::size_t active_ = 0;
+    std::function<void ()> on_drained_;
     boost::asio::io_context& io_context_;
+    queue_guard guard_;
+    std::atomic<bool> overloaded_{ false };
+    std::function<void (bool)> on_overload_;
+    std::function<void (std::string)> on_rejected_;
+    http_metrics metrics_;
+    tracer* tracer_ = nullptr;
 };
 
 #endif
@@ -0,0 +1,137 @@
+#ifndef ALLOC_ACCOUNTING_HPP
+#define ALLOC_ACCOUNTING_HPP
+
+#include "metrics.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+// Counts heap allocations by the part of the bot that makes them. Nothing
+// is counted unless alloc_accounting.cpp, which replaces the global
+// operator new and delete, is linked in: the tests always link it, main
+// only with the alloc_accounting build option. Code marks what it does with
+// an alloc_scope; allocations outside of any scope are untagged.
+enum class alloc_tag : std::uint8_t
+{
+    untagged,
+    // net_stream reading, writing and queueing
+    irc,
+    // the bot handling a line
+    bot,
+    // CurlEngine requests
+    http,
+    count
+};
+
+inline constexpr std::array<std::string_view, std::size_t(alloc_tag::count)> alloc_tag_names = {
+    "untagged", "irc", "bot", "http"
+};
+
+struct alloc_counts
+{
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+};
+
+namespace alloc_detail {
+
+inline constexpr std::size_t tags = std::size_t(alloc_tag::count);
+
+inline thread_local alloc_tag current = alloc_tag::untagged;
+inline thread_local std::array<alloc_counts, tags> thread_counts{};
+
+inline std::atomic<bool> installed{ false };
+// set while an alloc_metrics lives, the counts of all threads
+inline std::array<std::atomic<counter*>, tags> allocations{};
+inline std::array<std::atomic<counter*>, tags> bytes{};
+
+// Called by the replaced operator new, must not allocate
+inline void note(std::size_t size)
+{
+    const auto tag = std::size_t(current);
+    ++thread_counts[tag].allocations;
+    thread_counts[tag].bytes += size;
+    counter* c = allocations[tag].load(std::memory_order_acquire);
+    counter* b = bytes[tag].load(std::memory_order_acquire);
+    if (c && b) {
+        c->add();
+        b->add(size);
+    }
+}
+
+}
+
+// Whether allocations are being counted
+inline bool alloc_accounting_enabled()
+{
+    return alloc_detail::installed.load(std::memory_order_relaxed);
+}
+
+// Tags the allocations of this thread for the rest of the scope
+class alloc_scope
+{
+public:
+    explicit alloc_scope(alloc_tag tag)
+        : previous_(alloc_detail::current)
+    {
+        alloc_detail::current = tag;
+    }
+
+    ~alloc_scope() { alloc_detail::current = previous_; }
+
+    alloc_scope(const alloc_scope&) = delete;
+    alloc_scope& operator=(const alloc_scope&) = delete;
+
+private:
+    alloc_tag previous_;
+};
+
+// Allocations made by this thread so far
+inline alloc_counts thread_alloc_counts(alloc_tag tag)
+{
+    return alloc_detail::thread_counts[std::size_t(tag)];
+}
+
+inline alloc_counts thread_alloc_counts()
+{
+    alloc_counts total;
+    for (const auto& counts : alloc_detail::thread_counts) {
+        total.allocations += counts.allocations;
+        total.bytes += counts.bytes;
+    }
+    return total;
+}
+
+// Counts the allocations of all threads in allocations_total and
+// allocated_bytes_total, by tag, for as long as it lives. Dividing by
+// irc_lines_read_total gives the allocations per line. Only one may live at
+// a time, and it must not outlive the registry.
+class alloc_metrics
+{
+public:
+    explicit alloc_metrics(metrics_registry& registry)
+    {
+        for (std::size_t i = 0; i < alloc_detail::tags; ++i) {
+            const auto labels = fmt::format("tag=\"{}\"", alloc_tag_names[i]);
+            counter& bytes = registry.add_counter("allocated_bytes_total", "Bytes allocated from the heap", labels);
+            counter& allocations = registry.add_counter("allocations_total", "Heap allocations", labels);
+            alloc_detail::bytes[i].store(&bytes, std::memory_order_release);
+            alloc_detail::allocations[i].store(&allocations, std::memory_order_release);
+        }
+    }
+
+    ~alloc_metrics()
+    {
+        for (std::size_t i = 0; i < alloc_detail::tags; ++i) {
+            alloc_detail::allocations[i].store(nullptr, std::memory_order_release);
+            alloc_detail::bytes[i].store(nullptr, std::memory_order_release);
+        }
+    }
+
+    alloc_metrics(const alloc_metrics&) = delete;
+    alloc_metrics& operator=(const alloc_metrics&) = delete;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef BACKPRESSURE_HPP
+#define BACKPRESSURE_HPP
+
+#include <algorithm>
+#include <cstddef>
+
+// What a full queue does with a new item
+enum class overflow_policy
+{
+    // make room by dropping the oldest queued item
+    drop_oldest,
+    // drop the new item
+    drop_newest,
+    // drop the new item and tell the producer through a callback
+    reject,
+    // merge the new item into an equal queued one, even when not full;
+    // otherwise drop the new item when full
+    coalesce,
+};
+
+struct queue_limits
+{
+    // 0 is unbounded
+    std::size_t capacity = 0;
+    overflow_policy policy = overflow_policy::drop_oldest;
+};
+
+struct queue_counters
+{
+    std::size_t dropped_oldest = 0;
+    std::size_t dropped_newest = 0;
+    std::size_t rejected = 0;
+    std::size_t coalesced = 0;
+    // times the queue filled up
+    std::size_t overloads = 0;
+    // deepest the queue has been
+    std::size_t peak = 0;
+};
+
+// Applies queue_limits to a queue that it doesn't own: decides what to do
+// with each new item, counts the outcomes and tracks whether the queue is
+// overloaded. A queue is overloaded from when it fills up until it has
+// drained to half its capacity.
+class queue_guard
+{
+public:
+    enum class admission { push, drop_oldest, drop_newest, reject, coalesce };
+
+    explicit queue_guard(queue_limits limits = {})
+        : limits_(limits)
+    {}
+
+    // is_duplicate() tells whether an equal item is queued, and is only
+    // called with the coalesce policy
+    template <typename IsDuplicate>
+    admission admit(std::size_t depth, IsDuplicate&& is_duplicate) const
+    {
+        if (limits_.policy == overflow_policy::coalesce && is_duplicate())
+            return admission::coalesce;
+        if (limits_.capacity == 0 || depth < limits_.capacity)
+            return admission::push;
+
+        switch (limits_.policy) {
+        case overflow_policy::drop_oldest:
+            return admission::drop_oldest;
+        case overflow_policy::reject:
+            return admission::reject;
+        case overflow_policy::drop_newest:
+        case overflow_policy::coalesce:
+            break;
+        }
+        return admission::drop_newest;
+    }
+
+    // Records what the queue ended up doing with an item
+    void count(admission outcome)
+    {
+        switch (outcome) {
+        case admission::push: break;
+        case admission::drop_oldest: ++counters_.dropped_oldest; break;
+        case admission::drop_newest: ++counters_.dropped_newest; break;
+        case admission::reject: ++counters_.rejected; break;
+        case admission::coalesce: ++counters_.coalesced; break;
+        }
+    }
+
+    // Call with the queue's depth after it changed. Returns true when the
+    // queue became overloaded or stopped being overloaded.
+    bool update(std::size_t depth)
+    {
+        counters_.peak = std::max(counters_.peak, depth);
+        if (limits_.capacity == 0)
+            return false;
+
+        if (!overloaded_ && depth >= limits_.capacity) {
+            overloaded_ = true;
+            ++counters_.overloads;
+            return true;
+        }
+        if (overloaded_ && depth <= limits_.capacity / 2) {
+            overloaded_ = false;
+            return true;
+        }
+        return false;
+    }
+
+    bool overloaded() const { return overloaded_; }
+    const queue_limits& limits() const { return limits_; }
+    const queue_counters& counters() const { return counters_; }
+
+private:
+    queue_limits limits_;
+    queue_counters counters_;
+    bool overloaded_ = false;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef CASEMAP_HPP
+#define CASEMAP_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// RFC 1459 casemapping: A-Z and []\^ are the upper case forms of a-z and {}|~
+constexpr char irc_tolower(char c)
+{
+    if (c >= 'A' && c <= '^')
+        return static_cast<char>(c + ('a' - 'A'));
+    return c;
+}
+
+constexpr bool irc_equals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        if (irc_tolower(a[i]) != irc_tolower(b[i]))
+            return false;
+    }
+    return true;
+}
+
+// FNV-1a over the case folded name
+constexpr std::uint32_t irc_hash(std::string_view str)
+{
+    std::uint32_t h = 2166136261u;
+    for (const char c : str) {
+        h ^= static_cast<unsigned char>(irc_tolower(c));
+        h *= 16777619u;
+    }
+    return h;
+}
+
+inline std::string irc_fold(std::string_view str)
+{
+    std::string folded(str);
+    for (auto& c : folded)
+        c = irc_tolower(c);
+    return folded;
+}
+
+constexpr bool is_channel_name(std::string_view target)
+{
+    return !target.empty() && std::string_view("#&+!").find(target.front()) != std::string_view::npos;
+}
+
+#endif
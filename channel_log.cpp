@@ -0,0 +1,440 @@
+#include "channel_log.hpp"
+
+#include <fmt/format.h>
+
+#include <cerrno>
+#include <filesystem>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+[[noreturn]] void throw_errno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+int open_file(const std::string& path, int flags)
+{
+    const int fd = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw_errno(path);
+    return fd;
+}
+
+void close_file(int& fd)
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+std::vector<char> read_file(const std::string& path)
+{
+    std::vector<char> contents;
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT)
+            return contents;
+        throw_errno(path);
+    }
+    char buffer[65536];
+    for (;;) {
+        const ssize_t n = ::read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            ::close(fd);
+            throw_errno(path);
+        }
+        if (n == 0)
+            break;
+        contents.insert(contents.end(), buffer, buffer + n);
+    }
+    ::close(fd);
+    return contents;
+}
+
+// Calls f(id, name) for the entries of a names file, in order. Returns the
+// size of the entries that were whole.
+template <typename F>
+std::size_t parse_names(const std::vector<char>& contents, F&& f)
+{
+    std::size_t offset = 0;
+    while (offset + sizeof(log_format::name_header) <= contents.size()) {
+        log_format::name_header header;
+        std::memcpy(&header, contents.data() + offset, sizeof(header));
+        const std::size_t end = offset + sizeof(header) + header.length;
+        if (end > contents.size() || !f(header.id, std::string_view(contents.data() + offset + sizeof(header), header.length)))
+            break;
+        offset = end;
+    }
+    return offset;
+}
+
+}
+
+namespace log_format {
+
+std::string segment_path(std::string_view directory, std::uint32_t segment)
+{
+    return fmt::format("{}/{:08}.log", directory, segment);
+}
+
+std::string index_path(std::string_view directory, std::uint32_t segment)
+{
+    return fmt::format("{}/{:08}.idx", directory, segment);
+}
+
+std::vector<std::uint32_t> list_segments(const std::string& directory)
+{
+    std::vector<std::uint32_t> segments;
+    for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+        const std::string name = entry.path().filename().string();
+        if (name.size() != 12 || !name.ends_with(".log"))
+            continue;
+        try {
+            segments.push_back(static_cast<std::uint32_t>(std::stoul(name.substr(0, 8))));
+        } catch (const std::exception&) {
+        }
+    }
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+}
+
+channel_log::channel_log(channel_log_options options)
+    : options_(std::move(options))
+{
+    std::error_code ec;
+    std::filesystem::create_directories(options_.directory, ec);
+    if (ec)
+        throw std::system_error(ec, options_.directory);
+
+    load_names();
+    const auto segments = log_format::list_segments(options_.directory);
+    open_segment(segments.empty() ? 1 : segments.back() + 1);
+    if (options_.search)
+        search_.emplace();
+
+    writer_ = std::thread([this] { write_loop(); });
+}
+
+channel_log::~channel_log()
+{
+    {
+        std::lock_guard lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    writer_.join();
+
+    close_file(names_fd_);
+    close_file(segment_fd_);
+    close_file(index_fd_);
+}
+
+// Interns the names of earlier runs in their order, so that they get their
+// ids back. An entry cut short by a crash is cut off the file.
+void channel_log::load_names()
+{
+    const std::string path = log_format::names_path(options_.directory);
+    const auto contents = read_file(path);
+    const std::size_t whole = parse_names(contents, [this] (std::uint32_t id, std::string_view name) {
+        return id == names_.size() && names_.intern(name) == id;
+    });
+
+    names_fd_ = open_file(path, O_WRONLY | O_CREAT | O_APPEND);
+    if (whole != contents.size()) {
+        fmt::print("Cutting {} bytes off {}\n", contents.size() - whole, path);
+        if (::ftruncate(names_fd_, static_cast<off_t>(whole)) != 0)
+            throw_errno(path);
+    }
+}
+
+// Indexes the segments that were there when the log was opened. Runs on
+// the writer before it writes anything, so that messages are indexed in
+// order; what is appended meanwhile waits in the batch.
+void channel_log::index_earlier_runs()
+{
+    try {
+        const channel_log_reader reader(options_.directory);
+        std::vector<search_index::entry> entries;
+        reader.scan({}, [&] (const channel_log_reader::record& r) {
+            if (indexed(r.kind, r.channel_id, r.text))
+                entries.push_back(search_index::entry{ { r.segment, r.offset }, r.channel_id, r.text });
+            if (entries.size() == 4096) {
+                search_->add(entries);
+                entries.clear();
+            }
+            return true;
+        });
+        search_->add(entries);
+    } catch (const std::system_error& e) {
+        fmt::print("channel log: indexing earlier runs failed: {}\n", e.what());
+    }
+}
+
+void channel_log::open_segment(std::uint32_t segment)
+{
+    close_file(segment_fd_);
+    close_file(index_fd_);
+    segment_ = segment;
+    segment_fd_ = open_file(log_format::segment_path(options_.directory, segment), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND);
+    index_fd_ = open_file(log_format::index_path(options_.directory, segment), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND);
+    segment_size_ = 0;
+    last_indexed_ = 0;
+}
+
+void channel_log::flush()
+{
+    std::unique_lock lock(mutex_);
+    const std::uint64_t ticket = ++flush_requested_;
+    wake_.notify_one();
+    flushed_.wait(lock, [&] { return flush_done_ >= ticket; });
+}
+
+void channel_log::write_loop()
+{
+    if (search_)
+        index_earlier_runs();
+
+    std::vector<char> batch;
+    std::vector<search_request> searches;
+    std::unique_lock lock(mutex_);
+    for (;;) {
+        wake_.wait_for(lock, options_.commit_interval, [this] {
+            return stopping_ || flush_requested_ != flush_done_ || pending_.size() >= wake_bytes || !searches_.empty();
+        });
+        // the IO thread gets the emptied buffer of the last batch, which
+        // keeps its capacity
+        batch.swap(pending_);
+        searches.swap(searches_);
+        const std::uint64_t requested = flush_requested_;
+        const bool stopping = stopping_;
+        lock.unlock();
+
+        if (!batch.empty())
+            commit(batch);
+        batch.clear();
+        // after the batch, so that they find what was appended before
+        for (auto& request : searches) {
+            run_search(request);
+        }
+        searches.clear();
+
+        lock.lock();
+        flush_done_ = requested;
+        flushed_.notify_all();
+        if (stopping)
+            return;
+    }
+}
+
+// Splits a batch into the names, the records and their index entries, and
+// writes each with one write per file and segment
+void channel_log::commit(const std::vector<char>& batch)
+{
+    std::size_t offset = 0;
+    while (offset < batch.size()) {
+        log_format::record_header header;
+        std::memcpy(&header, batch.data() + offset, sizeof(header));
+        const char* text = batch.data() + offset + sizeof(header);
+        const std::size_t text_size = header.size - sizeof(header);
+
+        if (header.kind == name_kind) {
+            const log_format::name_header name{ header.channel, static_cast<std::uint32_t>(text_size) };
+            const auto* bytes = reinterpret_cast<const char*>(&name);
+            names_out_.insert(names_out_.end(), bytes, bytes + sizeof(name));
+            names_out_.insert(names_out_.end(), text, text + text_size);
+            offset += header.size;
+            continue;
+        }
+
+        const std::uint64_t at = segment_size_ + records_out_.size();
+        if (at > 0 && at + header.size > options_.segment_bytes) {
+            write_out();
+            try {
+                open_segment(segment_ + 1);
+            } catch (const std::system_error& e) {
+                // the writes to the closed segment fail and are counted
+                fmt::print("channel log: {}\n", e.what());
+            }
+        }
+
+        const std::uint64_t position = segment_size_ + records_out_.size();
+        if (position == 0 || position - last_indexed_ >= options_.index_interval) {
+            const log_format::index_entry entry{ header.time, position };
+            const auto* bytes = reinterpret_cast<const char*>(&entry);
+            index_out_.insert(index_out_.end(), bytes, bytes + sizeof(entry));
+            last_indexed_ = position;
+        }
+        if (search_ && indexed(header.kind, header.channel, std::string_view(text, text_size)))
+            to_index_.push_back(search_index::entry{ { segment_, position }, header.channel, std::string_view(text, text_size) });
+        records_out_.insert(records_out_.end(), batch.data() + offset, batch.data() + offset + header.size);
+        offset += header.size;
+    }
+    write_out();
+
+    if (!to_index_.empty()) {
+        search_->add(to_index_);
+        to_index_.clear();
+    }
+}
+
+// Names first and the index last, so that whatever a reader finds in a
+// file is backed by the files written before it
+void channel_log::write_out()
+{
+    const auto sync = [this] (int fd, const std::vector<char>& data) {
+        if (!options_.sync || data.empty() || ::fdatasync(fd) == 0)
+            return true;
+        fmt::print("channel log: sync failed: {}\n", std::strerror(errno));
+        return false;
+    };
+    const bool ok = write_all(names_fd_, names_out_) && sync(names_fd_, names_out_)
+        && write_all(segment_fd_, records_out_) && sync(segment_fd_, records_out_)
+        && write_all(index_fd_, index_out_) && sync(index_fd_, index_out_);
+    if (!ok)
+        write_errors_.fetch_add(1, std::memory_order_relaxed);
+
+    segment_size_ += records_out_.size();
+    names_out_.clear();
+    records_out_.clear();
+    index_out_.clear();
+}
+
+bool channel_log::write_all(int fd, const std::vector<char>& data)
+{
+    std::size_t written = 0;
+    while (written < data.size()) {
+        const ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            fmt::print("channel log: write failed: {}\n", std::strerror(errno));
+            return false;
+        }
+        written += static_cast<std::size_t>(n);
+    }
+    return true;
+}
+
+void channel_log::search(std::string_view channel, std::string_view query, std::size_t limit, search_handler done)
+{
+    const id_type channel_id = names_.find(channel);
+    if (!search_ || channel_id == string_interner::npos) {
+        done({});
+        return;
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        searches_.push_back(search_request{ channel_id, std::string(query), limit, std::move(done) });
+    }
+    wake_.notify_one();
+}
+
+// Reads the hits from the segments, each opened once since the hits are in
+// order. They are few and recent, so their pages are likely cached.
+void channel_log::run_search(search_request& request) const
+{
+    std::vector<search_hit> hits;
+    int fd = -1;
+    // segments are numbered from 1
+    std::uint32_t opened = 0;
+    for (const auto& where : search_->search(request.channel, request.query, request.limit)) {
+        if (where.segment != opened) {
+            close_file(fd);
+            opened = where.segment;
+            fd = ::open(log_format::segment_path(options_.directory, opened).c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (fd < 0)
+            continue;
+        log_format::record_header header;
+        if (::pread(fd, &header, sizeof(header), static_cast<off_t>(where.offset)) == sizeof(header) && header.size >= sizeof(header)) {
+            search_hit hit;
+            hit.time = clock::time_point(std::chrono::duration_cast<clock::duration>(std::chrono::microseconds(header.time)));
+            hit.nick = header.nick;
+            hit.text.resize(header.size - sizeof(header));
+            const auto read = ::pread(fd, hit.text.data(), hit.text.size(), static_cast<off_t>(where.offset + sizeof(header)));
+            if (read == static_cast<ssize_t>(hit.text.size()))
+                hits.push_back(std::move(hit));
+        }
+    }
+    close_file(fd);
+    request.done(std::move(hits));
+}
+
+void channel_log_reader::mapping::open(const std::string& path)
+{
+    const int fd = open_file(path, O_RDONLY);
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw_errno(path);
+    }
+    size = static_cast<std::size_t>(st.st_size);
+    if (size > 0) {
+        void* address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            ::close(fd);
+            throw_errno(path);
+        }
+        data = static_cast<const char*>(address);
+    }
+    ::close(fd);
+}
+
+void channel_log_reader::mapping::close()
+{
+    if (data)
+        ::munmap(const_cast<char*>(data), size);
+    data = nullptr;
+    size = 0;
+}
+
+channel_log_reader::channel_log_reader(const std::string& directory)
+{
+    const auto contents = read_file(log_format::names_path(directory));
+    parse_names(contents, [this] (std::uint32_t id, std::string_view name) {
+        return id == names_.size() && names_.intern(name) == id;
+    });
+
+    try {
+        for (const auto number : log_format::list_segments(directory)) {
+            segment s;
+            s.number = number;
+            segments_.push_back(s);
+            segments_.back().records.open(log_format::segment_path(directory, number));
+            segments_.back().index.open(log_format::index_path(directory, number));
+            if (segments_.back().entries() == 0) {
+                // nothing was written to it
+                segments_.back().records.close();
+                segments_.back().index.close();
+                segments_.pop_back();
+                continue;
+            }
+            segments_.back().first_time = segments_.back().entry(0).time;
+        }
+    } catch (...) {
+        for (auto& s : segments_) {
+            s.records.close();
+            s.index.close();
+        }
+        throw;
+    }
+}
+
+channel_log_reader::~channel_log_reader()
+{
+    for (auto& s : segments_) {
+        s.records.close();
+        s.index.close();
+    }
+}
@@ -0,0 +1,431 @@
+#ifndef CHANNEL_LOG_HPP
+#define CHANNEL_LOG_HPP
+
+#include "search_index.hpp"
+#include "string_interner.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// What a channel log record is about
+enum class log_kind : std::uint8_t
+{
+    privmsg,
+    notice,
+    join,
+    part,   // text is the reason
+    kick,   // nick is the one kicked, text is the reason
+    quit,   // no channel, text is the reason
+    nick,   // no channel, text is the new nick
+};
+
+// The files of a channel log, all in host byte order. A log is a directory
+// with a names file and numbered segments, each with a time index:
+//
+//   names         name_header and the name, for ids 0, 1, 2, ...
+//   00000001.log  records in time order, a record_header then the text
+//   00000001.idx  index_entry every index_interval bytes of records, the
+//                 first one at offset 0
+//
+// Files are only ever appended to; a record cut short by a crash is
+// ignored by readers.
+namespace log_format {
+
+struct record_header
+{
+    // of the whole record, the text is size - sizeof(record_header) bytes
+    std::uint32_t size;
+    log_kind kind;
+    std::uint8_t unused[3];
+    // microseconds since the Unix epoch
+    std::int64_t time;
+    // name ids, string_interner::npos for none
+    std::uint32_t channel;
+    std::uint32_t nick;
+};
+static_assert(sizeof(record_header) == 24);
+
+struct name_header
+{
+    std::uint32_t id;
+    std::uint32_t length;
+};
+
+struct index_entry
+{
+    std::int64_t time;
+    std::uint64_t offset;
+};
+
+inline std::string names_path(std::string_view directory)
+{
+    return std::string(directory) + "/names";
+}
+
+std::string segment_path(std::string_view directory, std::uint32_t segment);
+std::string index_path(std::string_view directory, std::uint32_t segment);
+// The numbers of the segments in a directory, in order
+std::vector<std::uint32_t> list_segments(const std::string& directory);
+
+}
+
+struct channel_log_options
+{
+    // created if missing
+    std::string directory;
+    // a new segment is started once one would grow past this
+    std::size_t segment_bytes = 64 << 20;
+    // what was appended meanwhile is written, and synced, as one batch
+    std::chrono::milliseconds commit_interval{ 200 };
+    // bytes of records between time index entries
+    std::size_t index_interval = 4096;
+    // records appended while this much is waiting to be written are dropped
+    std::size_t max_pending = 16 << 20;
+    // fdatasync the files after every batch
+    bool sync = true;
+    // keep a search_index of the messages, see channel_log::search()
+    bool search = false;
+};
+
+// Appends what happens in channels to a log on disk. append() is called on
+// the IO thread and only copies the record into a batch; a thread of the
+// log writes the batch every commit_interval, with one write and one sync
+// per file (group commit). Nicks and channels are stored as ids of an
+// interner that is kept in the log's names file, so they stay the same
+// across restarts. Every start of the log begins a new segment.
+//
+// With options.search the writer also indexes the messages in channels
+// once they are written, starting with those of earlier runs, and answers
+// searches of them. Commands to the bot, messages starting with '.', are
+// not indexed.
+//
+// append(), search() and name() must always be called from the same
+// thread, or under the same strand. Throws std::system_error if the directory can't
+// be set up.
+class channel_log
+{
+public:
+    using id_type = string_interner::id_type;
+    using clock = std::chrono::system_clock;
+
+    explicit channel_log(channel_log_options options);
+    ~channel_log();
+
+    channel_log(const channel_log&) = delete;
+    channel_log& operator=(const channel_log&) = delete;
+
+    // Doesn't allocate once the batch buffer has grown and the names are
+    // known
+    void append(log_kind kind, std::string_view channel, std::string_view nick, std::string_view text, clock::time_point time = clock::now())
+    {
+        const id_type channel_id = channel.empty() ? string_interner::npos : intern(channel);
+        const id_type nick_id = nick.empty() ? string_interner::npos : intern(nick);
+
+        // the time index needs records in time order, whatever the clock does
+        const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+        last_time_ = std::max(last_time_, static_cast<std::int64_t>(micros));
+
+        text = text.substr(0, max_text);
+        {
+            std::lock_guard lock(mutex_);
+            if (!new_names_.empty()) {
+                // dropped with the record when full, the writer needs the names
+                if (pending_.size() + new_names_.size() > options_.max_pending) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                pending_.insert(pending_.end(), new_names_.begin(), new_names_.end());
+                new_names_.clear();
+            }
+            if (pending_.size() + sizeof(log_format::record_header) + text.size() > options_.max_pending) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            const bool was_small = pending_.size() < wake_bytes;
+            put(pending_, kind, last_time_, channel_id, nick_id, text);
+            // writes a big batch before the commit interval is up
+            if (was_small && pending_.size() >= wake_bytes)
+                wake_.notify_one();
+        }
+        appended_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Writes what has been appended so far and waits until it is written,
+    // and until the searches asked for before have been answered
+    void flush();
+
+    struct search_hit
+    {
+        clock::time_point time;
+        // see name()
+        id_type nick;
+        std::string text;
+    };
+    using search_handler = std::function<void (std::vector<search_hit> hits)>;
+
+    // Looks for the last `limit` messages in channel containing every word
+    // of query, see search_index, and calls done with them, oldest first.
+    // The search runs on the writer once it has written and indexed what
+    // was appended before, and done is called there. Without
+    // options.search, or for a channel the log doesn't know, done is called
+    // right away with no hits.
+    void search(std::string_view channel, std::string_view query, std::size_t limit, search_handler done);
+
+    // The name of an id of a search hit, empty if the log doesn't know it
+    std::string_view name(id_type id) const
+    {
+        return id < names_.size() ? names_.str(id) : std::string_view();
+    }
+
+    // Records appended, and dropped because too much was waiting
+    std::uint64_t appended() const { return appended_.load(std::memory_order_relaxed); }
+    std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    // Batches that failed to be written
+    std::uint64_t write_errors() const { return write_errors_.load(std::memory_order_relaxed); }
+
+    const channel_log_options& options() const { return options_; }
+
+private:
+    // longer texts are cut, IRC lines are at most 512 bytes anyway
+    static constexpr std::size_t max_text = 4096;
+    static constexpr std::size_t wake_bytes = 1 << 20;
+    // marks a name in a batch, the channel field holds its id
+    static constexpr log_kind name_kind = static_cast<log_kind>(0xff);
+
+    static void put(std::vector<char>& out, log_kind kind, std::int64_t time, id_type channel, id_type nick, std::string_view text)
+    {
+        log_format::record_header header{};
+        header.size = static_cast<std::uint32_t>(sizeof(header) + text.size());
+        header.kind = kind;
+        header.time = time;
+        header.channel = channel;
+        header.nick = nick;
+
+        const std::size_t at = out.size();
+        out.resize(at + header.size);
+        std::memcpy(out.data() + at, &header, sizeof(header));
+        std::memcpy(out.data() + at + sizeof(header), text.data(), text.size());
+    }
+
+    // Messages in channels, other than commands to the bot
+    static bool indexed(log_kind kind, id_type channel, std::string_view text)
+    {
+        return (kind == log_kind::privmsg || kind == log_kind::notice)
+            && channel != string_interner::npos
+            && !text.starts_with('.');
+    }
+
+    // New names go to the batch ahead of the record using them
+    id_type intern(std::string_view name)
+    {
+        const std::size_t known = names_.size();
+        const id_type id = names_.intern(name);
+        if (names_.size() != known)
+            put(new_names_, name_kind, 0, id, string_interner::npos, name);
+        return id;
+    }
+
+    void load_names();
+    void index_earlier_runs();
+    void open_segment(std::uint32_t segment);
+    void write_loop();
+    struct search_request;
+    void run_search(search_request& request) const;
+    void commit(const std::vector<char>& batch);
+    void write_out();
+    bool write_all(int fd, const std::vector<char>& data);
+
+    const channel_log_options options_;
+
+    // the IO thread's
+    string_interner names_;
+    std::vector<char> new_names_;
+    std::int64_t last_time_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_;
+    std::vector<char> pending_;
+    // incremented by flush(), and by the writer once it has written
+    // everything appended before
+    std::uint64_t flush_requested_ = 0;
+    std::uint64_t flush_done_ = 0;
+    bool stopping_ = false;
+    struct search_request
+    {
+        id_type channel;
+        std::string query;
+        std::size_t limit;
+        search_handler done;
+    };
+    std::vector<search_request> searches_;
+
+    // the writer's
+    int names_fd_ = -1;
+    int segment_fd_ = -1;
+    int index_fd_ = -1;
+    std::uint32_t segment_ = 0;
+    std::uint64_t segment_size_ = 0;
+    std::uint64_t last_indexed_ = 0;
+    std::vector<char> names_out_;
+    std::vector<char> records_out_;
+    std::vector<char> index_out_;
+    // messages of the batch to index once it is written
+    std::vector<search_index::entry> to_index_;
+
+    // the writer's, it adds to it and searches it
+    std::optional<search_index> search_;
+
+    std::atomic<std::uint64_t> appended_{ 0 };
+    std::atomic<std::uint64_t> dropped_{ 0 };
+    std::atomic<std::uint64_t> write_errors_{ 0 };
+
+    std::thread writer_;
+};
+
+// Reads a channel log as it was when the reader was opened. Segments and
+// their time indexes are memory mapped; seeking to a time is a
+// binary search over the segments and then over one index, followed by
+// a scan of at most index_interval bytes.
+class channel_log_reader
+{
+public:
+    using id_type = string_interner::id_type;
+    using clock = std::chrono::system_clock;
+
+    struct record
+    {
+        log_kind kind;
+        clock::time_point time;
+        id_type channel_id;
+        id_type nick_id;
+        // where the record is
+        std::uint32_t segment;
+        std::uint64_t offset;
+        // views into the mapped files, valid while the reader is
+        std::string_view channel;
+        std::string_view nick;
+        std::string_view text;
+    };
+
+    // Throws std::system_error if a file can't be opened
+    explicit channel_log_reader(const std::string& directory);
+    ~channel_log_reader();
+
+    channel_log_reader(const channel_log_reader&) = delete;
+    channel_log_reader& operator=(const channel_log_reader&) = delete;
+
+    // Calls f(const record&) for the records from `from` on, in time order,
+    // until f returns false
+    template <typename F>
+    void scan(clock::time_point from, F&& f) const
+    {
+        const std::int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(from.time_since_epoch()).count();
+        auto seg = std::upper_bound(segments_.begin(), segments_.end(), micros, [] (std::int64_t t, const segment& s) {
+            return t < s.first_time;
+        });
+        if (seg != segments_.begin())
+            --seg;
+
+        for (bool first = true; seg != segments_.end(); ++seg, first = false) {
+            std::size_t offset = first ? seg->seek(micros) : 0;
+            record r;
+            while (seg->read(offset, r, *this)) {
+                if (r.time >= from && !f(static_cast<const record&>(r)))
+                    return;
+            }
+        }
+    }
+
+    // The name of an id, empty if the log doesn't know it
+    std::string_view name(id_type id) const
+    {
+        return id < names_.size() ? names_.str(id) : std::string_view();
+    }
+
+    // The id of a name under IRC casemapping, npos if the log doesn't know it
+    id_type find(std::string_view name) const { return names_.find(name); }
+
+    std::size_t segment_count() const { return segments_.size(); }
+
+private:
+    struct mapping
+    {
+        const char* data = nullptr;
+        std::size_t size = 0;
+
+        void open(const std::string& path);
+        void close();
+    };
+
+    struct segment
+    {
+        std::uint32_t number = 0;
+        mapping records;
+        mapping index;
+        // of the first record, from the index
+        std::int64_t first_time = 0;
+
+        const log_format::index_entry& entry(std::size_t i) const
+        {
+            return reinterpret_cast<const log_format::index_entry*>(index.data)[i];
+        }
+        std::size_t entries() const { return index.size / sizeof(log_format::index_entry); }
+
+        // Offset of the last indexed record before time, or 0
+        std::size_t seek(std::int64_t time) const
+        {
+            std::size_t low = 0;
+            std::size_t high = entries();
+            while (low < high) {
+                const std::size_t mid = low + (high - low) / 2;
+                if (entry(mid).time < time)
+                    low = mid + 1;
+                else
+                    high = mid;
+            }
+            return low == 0 ? 0 : entry(low - 1).offset;
+        }
+
+        // Reads the record at offset and moves past it, false at the end
+        // or at a record cut short
+        bool read(std::size_t& offset, record& r, const channel_log_reader& reader) const
+        {
+            log_format::record_header header;
+            if (offset + sizeof(header) > records.size)
+                return false;
+            std::memcpy(&header, records.data + offset, sizeof(header));
+            if (header.size < sizeof(header) || offset + header.size > records.size)
+                return false;
+
+            r.kind = header.kind;
+            r.time = clock::time_point(std::chrono::duration_cast<clock::duration>(std::chrono::microseconds(header.time)));
+            r.channel_id = header.channel;
+            r.nick_id = header.nick;
+            r.segment = number;
+            r.offset = offset;
+            r.channel = reader.name(header.channel);
+            r.nick = reader.name(header.nick);
+            r.text = std::string_view(records.data + offset + sizeof(header), header.size - sizeof(header));
+            offset += header.size;
+            return true;
+        }
+    };
+
+    // read once, the views of records point into it
+    string_interner names_;
+    std::vector<segment> segments_;
+};
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef CHANNEL_STATE_HPP
+#define CHANNEL_STATE_HPP
+
+#include "event_bus.hpp"
+#include "irc_message.hpp"
+#include "string_interner.hpp"
+
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+// Who is in which of the channels the bot has joined, kept up to date from
+// JOIN, PART, KICK, QUIT, NICK and NAMES replies. Nicks, channels and hosts are
+// interned, and each channel's members are a sorted vector of nick ids.
+//
+// Every membership, tracked channel, host and the bot's own nick holds a
+// reference on its id, so a nick that has left every channel the bot is in
+// is forgotten along with its host, and its id is reused.
+class channel_state
+{
+public:
+    using id_type = string_interner::id_type;
+    static constexpr id_type npos = string_interner::npos;
+
+    explicit channel_state(string_interner& strings)
+        : strings_(strings)
+    {
+    }
+
+    void subscribe(event_bus& events)
+    {
+        events.subscribe("001", [this] (const irc_message& msg) {
+            set_own_nick(msg.param(0));
+        });
+        events.subscribe("JOIN", [this] (const irc_message& msg) {
+            join(msg.param(0), msg.nick(), msg.host());
+        });
+        events.subscribe("PART", [this] (const irc_message& msg) {
+            part(msg.param(0), msg.nick());
+        });
+        events.subscribe("KICK", [this] (const irc_message& msg) {
+            part(msg.param(0), msg.param(1));
+        });
+        events.subscribe("QUIT", [this] (const irc_message& msg) {
+            quit(msg.nick());
+        });
+        events.subscribe("NICK", [this] (const irc_message& msg) {
+            rename(msg.nick(), msg.param(0));
+        });
+        // <client> [<symbol>] <channel> :<names>
+        events.subscribe("353", [this] (const irc_message& msg) {
+            if (msg.param_count >= 3) {
+                names(msg.param(msg.param_count - 2), msg.text());
+            }
+        });
+        // <client> <channel> :End of /NAMES list
+        events.subscribe("366", [this] (const irc_message& msg) {
+            end_of_names(msg.param(1));
+        });
+    }
+
+    void clear()
+    {
+        for (auto& chan : channels_) {
+            forget(chan);
+        }
+        channels_.clear();
+    }
+
+    void set_own_nick(std::string_view nick)
+    {
+        const id_type old_id = own_nick_;
+        own_nick_ = strings_.acquire(nick);
+        if (old_id != npos)
+            release(old_id);
+    }
+
+    id_type own_nick() const { return own_nick_; }
+
+    void join(std::string_view channel, std::string_view nick, std::string_view host = {})
+    {
+        if (own_nick_ != npos && strings_.find(nick) == own_nick_) {
+            const id_type channel_id = strings_.acquire(channel);
+            auto it = lower_bound(channel_id);
+            if (it == std::end(channels_) || it->channel != channel_id) {
+                it = channels_.insert(it, members_of{ channel_id, {}, {} });
+            } else {
+                release(channel_id);
+                release_all(it->members);
+            }
+        }
+
+        auto* chan = find(strings_.find(channel));
+        if (!chan)
+            return;
+
+        const id_type nick_id = strings_.acquire(nick);
+        if (!host.empty()) {
+            set_host(nick_id, strings_.acquire(host));
+        }
+        if (!insert_sorted(chan->members, nick_id)) {
+            release(nick_id);
+        }
+    }
+
+    void part(std::string_view channel, std::string_view nick)
+    {
+        const id_type channel_id = strings_.find(channel);
+        const id_type nick_id = strings_.find(nick);
+        if (channel_id == npos || nick_id == npos)
+            return;
+
+        if (nick_id == own_nick_) {
+            auto it = lower_bound(channel_id);
+            if (it != std::end(channels_) && it->channel == channel_id) {
+                forget(*it);
+                channels_.erase(it);
+            }
+            return;
+        }
+
+        if (auto* chan = find(channel_id)) {
+            if (erase_sorted(chan->members, nick_id))
+                release(nick_id);
+        }
+    }
+
+    void quit(std::string_view nick)
+    {
+        const id_type nick_id = strings_.find(nick);
+        if (nick_id == npos)
+            return;
+
+        // once the last membership frees nick_id no other channel has it
+        for (auto& chan : channels_) {
+            if (erase_sorted(chan.members, nick_id))
+                release(nick_id);
+        }
+    }
+
+    // Nicks the bot doesn't know of are ignored
+    void rename(std::string_view old_nick, std::string_view new_nick)
+    {
+        const id_type old_id = strings_.find(old_nick);
+        if (old_id == npos || strings_.find(new_nick) == old_id)
+            return;
+
+        // held until the memberships have moved, so the host can move first
+        const id_type new_id = strings_.acquire(new_nick);
+        if (old_id < hosts_.size() && hosts_[old_id] != npos) {
+            strings_.add_ref(hosts_[old_id]);
+            set_host(new_id, hosts_[old_id]);
+        }
+
+        if (old_id == own_nick_) {
+            strings_.add_ref(new_id);
+            own_nick_ = new_id;
+            release(old_id);
+        }
+
+        for (auto& chan : channels_) {
+            if (!erase_sorted(chan.members, old_id))
+                continue;
+            if (insert_sorted(chan.members, new_id))
+                strings_.add_ref(new_id);
+            release(old_id);
+        }
+
+        release(new_id);
+    }
+
+    // One RPL_NAMREPLY, the list is replaced once RPL_ENDOFNAMES arrives
+    void names(std::string_view channel, std::string_view names)
+    {
+        auto* chan = find(strings_.find(channel));
+        if (!chan)
+            return;
+
+        while (!names.empty()) {
+            const auto space = names.find(' ');
+            auto name = names.substr(0, space);
+            names.remove_prefix(space == std::string_view::npos ? names.size() : space + 1);
+
+            // multi-prefix and userhost-in-names
+            while (!name.empty() && std::string_view("~&@%+!").find(name.front()) != std::string_view::npos)
+                name.remove_prefix(1);
+
+            std::string_view host;
+            if (const auto exclamation = name.find('!'); exclamation != std::string_view::npos) {
+                if (const auto at = name.find('@', exclamation); at != std::string_view::npos)
+                    host = name.substr(at + 1);
+                name = name.substr(0, exclamation);
+            }
+
+            if (name.empty())
+                continue;
+
+            const id_type nick_id = strings_.acquire(name);
+            if (!host.empty()) {
+                set_host(nick_id, strings_.acquire(host));
+            }
+            chan->pending.push_back(nick_id);
+        }
+    }
+
+    void end_of_names(std::string_view channel)
+    {
+        auto* chan = find(strings_.find(channel));
+        if (!chan)
+            return;
+
+        auto& pending = chan->pending;
+        std::sort(std::begin(pending), std::end(pending));
+        const auto duplicates = std::unique(std::begin(pending), std::end(pending));
+        std::for_each(duplicates, std::end(pending), [this] (id_type id) { release(id); });
+        pending.erase(duplicates, std::end(pending));
+        chan->members.swap(pending);
+        release_all(pending);
+        pending.shrink_to_fit();
+        chan->members.shrink_to_fit();
+    }
+
+    bool is_member(std::string_view channel, std::string_view nick) const
+    {
+        const auto* chan = find(strings_.find(channel));
+        const id_type nick_id = strings_.find(nick);
+        return chan && nick_id != npos
+            && std::binary_search(std::begin(chan->members), std::end(chan->members), nick_id);
+    }
+
+    // Sorted nick ids, or nullptr if the bot is not in the channel
+    const std::vector<id_type>* members(std::string_view channel) const
+    {
+        const auto* chan = find(strings_.find(channel));
+        return chan ? &chan->members : nullptr;
+    }
+
+    id_type host(std::string_view nick) const
+    {
+        const id_type nick_id = strings_.find(nick);
+        return nick_id < hosts_.size() ? hosts_[nick_id] : npos;
+    }
+
+    std::size_t channel_count() const { return channels_.size(); }
+
+    std::size_t memory_usage() const
+    {
+        std::size_t usage = channels_.capacity() * sizeof(members_of) + hosts_.capacity() * sizeof(id_type);
+        for (const auto& chan : channels_) {
+            usage += (chan.members.capacity() + chan.pending.capacity()) * sizeof(id_type);
+        }
+        return usage + strings_.memory_usage();
+    }
+
+private:
+    struct members_of {
+        id_type channel;
+        std::vector<id_type> members;
+        std::vector<id_type> pending;
+    };
+
+    std::vector<members_of>::iterator lower_bound(id_type channel_id)
+    {
+        return std::lower_bound(
+            std::begin(channels_), std::end(channels_), channel_id,
+            [] (const members_of& chan, id_type id) { return chan.channel < id; }
+        );
+    }
+
+    members_of* find(id_type channel_id)
+    {
+        auto it = lower_bound(channel_id);
+        return it != std::end(channels_) && it->channel == channel_id ? &*it : nullptr;
+    }
+
+    const members_of* find(id_type channel_id) const
+    {
+        return const_cast<channel_state*>(this)->find(channel_id);
+    }
+
+    // Takes over a reference on host_id
+    void set_host(id_type nick_id, id_type host_id)
+    {
+        if (nick_id >= hosts_.size())
+            hosts_.resize(nick_id + 1, npos);
+        if (hosts_[nick_id] != npos)
+            release(hosts_[nick_id]);
+        hosts_[nick_id] = host_id;
+    }
+
+    // Drops one reference, and with the last one the host of a nick. Every
+    // id goes through here, a host can be spelled like a nick.
+    void release(id_type id)
+    {
+        const id_type host_id = id < hosts_.size() ? hosts_[id] : npos;
+        if (strings_.release(id) && host_id != npos) {
+            hosts_[id] = npos;
+            release(host_id);
+        }
+    }
+
+    void release_all(std::vector<id_type>& nick_ids)
+    {
+        for (const auto id : nick_ids) {
+            release(id);
+        }
+        nick_ids.clear();
+    }
+
+    // Releases what a channel holds, before it is erased
+    void forget(members_of& chan)
+    {
+        release_all(chan.members);
+        release_all(chan.pending);
+        release(chan.channel);
+    }
+
+    static bool insert_sorted(std::vector<id_type>& ids, id_type id)
+    {
+        auto it = std::lower_bound(std::begin(ids), std::end(ids), id);
+        if (it != std::end(ids) && *it == id)
+            return false;
+        ids.insert(it, id);
+        return true;
+    }
+
+    static bool erase_sorted(std::vector<id_type>& ids, id_type id)
+    {
+        auto it = std::lower_bound(std::begin(ids), std::end(ids), id);
+        if (it == std::end(ids) || *it != id)
+            return false;
+        ids.erase(it);
+        return true;
+    }
+
+    string_interner& strings_;
+    id_type own_nick_ = npos;
+    std::vector<members_of> channels_;
+    // host of each nick, indexed by nick id
+    std::vector<id_type> hosts_;
+};
+
+#endif
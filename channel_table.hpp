@@ -0,0 +1,199 @@
+#ifndef CHANNEL_TABLE_HPP
+#define CHANNEL_TABLE_HPP
+
+#include "casemap.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Token bucket allowing `limit` events per `period`, 0 means unlimited
+class rate_limiter
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    rate_limiter(unsigned limit = 0, clock::duration period = std::chrono::minutes(1))
+        : limit_(limit)
+        , period_(period)
+        , tokens_(limit)
+    {
+    }
+
+    bool try_acquire(clock::time_point now = clock::now())
+    {
+        if (limit_ == 0)
+            return true;
+
+        if (last_refill_ != clock::time_point()) {
+            const std::chrono::duration<double> elapsed = now - last_refill_;
+            const std::chrono::duration<double> period = period_;
+            tokens_ = std::min<double>(limit_, tokens_ + limit_ * (elapsed / period));
+        }
+        last_refill_ = now;
+
+        if (tokens_ < 1.0)
+            return false;
+        tokens_ -= 1.0;
+        return true;
+    }
+
+    // When try_acquire() was last called, never for an unlimited limiter
+    clock::time_point last_used() const { return last_refill_; }
+
+private:
+    unsigned limit_;
+    clock::duration period_;
+    double tokens_;
+    clock::time_point last_refill_;
+};
+
+struct channel_settings
+{
+    bool greet = true;
+    bool hello = true;
+    bool youtube = true;
+    // .grep, needs a channel log with search
+    bool grep = true;
+    // .seen, needs a seen table
+    bool seen = true;
+
+    // replies per rate_period, 0 means unlimited
+    unsigned rate_limit = 0;
+    std::chrono::seconds rate_period = std::chrono::minutes(1);
+};
+
+struct channel_config
+{
+    std::string name;
+    channel_settings settings;
+};
+
+struct channel
+{
+    std::string name;
+    channel_settings settings;
+    rate_limiter limiter;
+};
+
+// Open addressing hash table of channels keyed by case folded name. The
+// channels are set up from the config, lookups hash and compare the name
+// in place and never allocate.
+class channel_table
+{
+public:
+    channel_table() = default;
+
+    explicit channel_table(const std::vector<channel_config>& channels)
+    {
+        for (const auto& config : channels) {
+            insert(config);
+        }
+    }
+
+    // Replaces the settings if the channel is already in the table
+    channel& insert(const channel_config& config)
+    {
+        if (auto existing = find(config.name)) {
+            existing->settings = config.settings;
+            existing->limiter = rate_limiter(config.settings.rate_limit, config.settings.rate_period);
+            return *existing;
+        }
+
+        channels_.emplace_back(channel{
+            config.name,
+            config.settings,
+            rate_limiter(config.settings.rate_limit, config.settings.rate_period),
+        });
+
+        if (channels_.size() * 2 > slots_.size()) {
+            rehash(std::max<std::size_t>(8, slots_.size() * 2));
+        } else {
+            place(channels_.size() - 1);
+        }
+        return channels_.back();
+    }
+
+    channel* find(std::string_view name)
+    {
+        if (slots_.empty())
+            return nullptr;
+
+        const std::size_t mask = slots_.size() - 1;
+        for (std::size_t i = irc_hash(name) & mask;; i = (i + 1) & mask) {
+            if (slots_[i] == empty)
+                return nullptr;
+            if (irc_equals(channels_[slots_[i]].name, name))
+                return &channels_[slots_[i]];
+        }
+    }
+
+    const channel* find(std::string_view name) const
+    {
+        return const_cast<channel_table*>(this)->find(name);
+    }
+
+    // Gives the entry of `existing` to another channel, reusing its storage
+    // so that nothing is allocated for names that fit
+    channel& replace(channel& existing, std::string_view name, const channel_settings& settings)
+    {
+        unplace(static_cast<std::size_t>(&existing - channels_.data()));
+        existing.name.assign(name);
+        existing.settings = settings;
+        existing.limiter = rate_limiter(settings.rate_limit, settings.rate_period);
+        place(static_cast<std::size_t>(&existing - channels_.data()));
+        return existing;
+    }
+
+    std::size_t size() const { return channels_.size(); }
+    auto begin() const { return std::begin(channels_); }
+    auto end() const { return std::end(channels_); }
+
+private:
+    static constexpr std::uint32_t empty = UINT32_MAX;
+
+    void rehash(std::size_t slot_count)
+    {
+        slots_.assign(slot_count, empty);
+        for (std::size_t i = 0; i < channels_.size(); ++i) {
+            place(i);
+        }
+    }
+
+    void place(std::size_t index)
+    {
+        const std::size_t mask = slots_.size() - 1;
+        std::size_t i = irc_hash(channels_[index].name) & mask;
+        while (slots_[i] != empty)
+            i = (i + 1) & mask;
+        slots_[i] = static_cast<std::uint32_t>(index);
+    }
+
+    // Takes index out of its slot and moves up the channels probed past it,
+    // so that lookups don't need tombstones
+    void unplace(std::size_t index)
+    {
+        const std::size_t mask = slots_.size() - 1;
+        std::size_t i = irc_hash(channels_[index].name) & mask;
+        while (slots_[i] != index)
+            i = (i + 1) & mask;
+
+        for (std::size_t j = (i + 1) & mask; slots_[j] != empty; j = (j + 1) & mask) {
+            const std::size_t home = irc_hash(channels_[slots_[j]].name) & mask;
+            // slots_[j] can fill the hole at i unless its home lies in (i, j]
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+        slots_[i] = empty;
+    }
+
+    std::vector<channel> channels_;
+    std::vector<std::uint32_t> slots_;
+};
+
+#endif
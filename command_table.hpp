@@ -0,0 +1,147 @@
+#ifndef COMMAND_TABLE_HPP
+#define COMMAND_TABLE_HPP
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+// A fixed set of command names with a perfect hash computed at compile time.
+// find() hashes the name once and compares against a single candidate, so the
+// cost of a lookup does not depend on how many commands are registered.
+template <std::size_t N>
+class command_table
+{
+public:
+    static constexpr std::size_t npos = N;
+
+    constexpr explicit command_table(const std::array<std::string_view, N>& names)
+        : names_(names)
+    {
+        for (std::uint32_t seed = 1; seed != 0; ++seed) {
+            if (try_seed(seed)) {
+                seed_ = seed;
+                return;
+            }
+        }
+        throw std::logic_error("command_table: no perfect hash found");
+    }
+
+    constexpr std::size_t find(std::string_view name) const
+    {
+        const std::size_t index = slots_[hash(name, seed_) & (slot_count - 1)];
+        if (index != npos && names_[index] == name)
+            return index;
+        return npos;
+    }
+
+    constexpr std::size_t size() const { return N; }
+
+    constexpr std::string_view name(std::size_t index) const { return names_[index]; }
+
+private:
+    static constexpr std::size_t next_power_of_two(std::size_t n)
+    {
+        std::size_t power = 1;
+        while (power < n)
+            power *= 2;
+        return power;
+    }
+
+    // keep the table sparse so that a collision free seed is found quickly
+    static constexpr std::size_t slot_count = next_power_of_two(N * 4);
+
+    static constexpr std::uint32_t hash(std::string_view str, std::uint32_t seed)
+    {
+        // FNV-1a, seeded
+        std::uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+        for (const char c : str) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 16777619u;
+        }
+        h ^= h >> 15;
+        return h;
+    }
+
+    constexpr bool try_seed(std::uint32_t seed)
+    {
+        for (auto& slot : slots_)
+            slot = npos;
+
+        for (std::size_t i = 0; i < N; ++i) {
+            auto& slot = slots_[hash(names_[i], seed) & (slot_count - 1)];
+            if (slot != npos)
+                return false;
+            slot = i;
+        }
+        return true;
+    }
+
+    std::array<std::string_view, N> names_;
+    std::array<std::size_t, slot_count> slots_{};
+    std::uint32_t seed_ = 0;
+};
+
+template <typename... Names>
+constexpr auto make_command_table(Names... names)
+{
+    return command_table<sizeof...(Names)>({ std::string_view(names)... });
+}
+
+// Splits ".cmd some arguments" into ".cmd" and "some arguments"
+constexpr std::pair<std::string_view, std::string_view> split_command(std::string_view text)
+{
+    const auto space = text.find(' ');
+    if (space == std::string_view::npos)
+        return { text, {} };
+
+    auto arguments = text.substr(space + 1);
+    while (!arguments.empty() && arguments.front() == ' ')
+        arguments.remove_prefix(1);
+    return { text.substr(0, space), arguments };
+}
+
+// Maps the first word of a message to the handler registered for it. Handlers
+// are bound by table index, which is resolved at compile time:
+//
+//     static constexpr auto commands = make_command_table(".hello");
+//     command_dispatcher<commands.size(), std::string_view> dispatcher(commands);
+//     dispatcher.on<commands.find(".hello")>([] (std::string_view args, std::string_view nick) { ... });
+template <std::size_t N, typename... Args>
+class command_dispatcher
+{
+public:
+    using handler = std::function<void (std::string_view arguments, Args... args)>;
+
+    explicit command_dispatcher(const command_table<N>& table)
+        : table_(table)
+    {
+    }
+
+    template <std::size_t Index>
+    void on(handler&& callback)
+    {
+        static_assert(Index < N, "command is not in the command table");
+        handlers_[Index] = std::move(callback);
+    }
+
+    // Returns true if the text started with a known command
+    bool dispatch(std::string_view text, Args... args) const
+    {
+        const auto [command, arguments] = split_command(text);
+        const std::size_t index = table_.find(command);
+        if (index == command_table<N>::npos || !handlers_[index])
+            return false;
+
+        handlers_[index](arguments, args...);
+        return true;
+    }
+
+private:
+    const command_table<N>& table_;
+    std::array<handler, N> handlers_;
+};
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef CORO_STREAM_HPP
+#define CORO_STREAM_HPP
+
+#include "handler_memory.hpp"
+#include "happy_eyeballs.hpp"
+#include "net_stream.hpp"
+#include "socket_options.hpp"
+
+#include <boost/asio.hpp>
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+// An IRC connection driven by a coroutine instead of callbacks:
+//
+//     co_await irc.connect("irc.libera.chat", "6697");
+//     co_await irc.write("NICK borky\r\n");
+//     for (;;) {
+//         std::string_view line = co_await irc.read_line();
+//         ...
+//     }
+//
+// Errors are thrown as boost::system::system_error. One read and one write
+// may be outstanding at a time.
+//
+// read_line() and write() are plain asynchronous operations rather than
+// coroutines, so awaiting one creates a single coroutine frame, which asio
+// recycles through its per-thread frame cache, and the operation itself is
+// allocated from the stream's handler_memory slots. A connection's read and
+// write loop therefore doesn't allocate once it is running. They take any
+// completion token, use_awaitable is the default.
+template <typename Stream, typename Resolver = boost::asio::ip::tcp::resolver>
+class coro_stream
+{
+public:
+    using executor_type = typename Stream::executor_type;
+    using default_token = boost::asio::use_awaitable_t<>;
+
+    explicit coro_stream(Stream& stream, socket_options options = {})
+        : stream_(&stream)
+        , resolver_(stream.get_executor())
+        , deadline_(stream.get_executor())
+        , socket_options_(options)
+    {}
+
+    // Resolves, connects to the addresses in RFC 8305 order until one
+    // accepts, and does the TLS handshake for TLS streams. Throws
+    // boost::asio::error::timed_out if all of that takes longer than timeout.
+    boost::asio::awaitable<void> connect(
+        std::string host,
+        std::string port,
+        std::chrono::steady_clock::duration timeout = std::chrono::seconds(10))
+    {
+        timed_out_ = false;
+        deadline_.expires_after(timeout);
+        deadline_.async_wait([this] (boost::system::error_code ec) {
+            if (ec)
+                return;
+            timed_out_ = true;
+            resolver_.cancel();
+            close();
+        });
+
+        try {
+            co_await connect_and_handshake(std::move(host), std::move(port));
+        } catch (const boost::system::system_error&) {
+            deadline_.cancel();
+            if (timed_out_)
+                throw boost::system::system_error(boost::asio::error::timed_out);
+            throw;
+        }
+        deadline_.cancel();
+        read_buffer_.consume(read_buffer_.size());
+        consumed_ = 0;
+    }
+
+    // The next non-empty line, without the line ending. The view is valid
+    // until the next call to read_line().
+    template <typename CompletionToken = default_token>
+    auto read_line(CompletionToken&& token = {})
+    {
+        read_buffer_.consume(consumed_);
+        consumed_ = 0;
+
+        return boost::asio::async_initiate<CompletionToken, void (boost::system::error_code, std::string_view)>(
+            [this] (auto handler) {
+                read_line_op<decltype(handler)>{ this, std::move(handler) }.start();
+            },
+            token
+        );
+    }
+
+    // Writes all of message, which is copied first
+    template <typename CompletionToken = default_token>
+    auto write(std::string_view message, CompletionToken&& token = {})
+    {
+        write_buffer_.assign(message);
+
+        return boost::asio::async_initiate<CompletionToken, void (boost::system::error_code, std::size_t)>(
+            [this] (auto handler) {
+                auto executor = boost::asio::get_associated_executor(handler, stream_->get_executor());
+                boost::asio::async_write(
+                    *stream_,
+                    boost::asio::buffer(write_buffer_),
+                    boost::asio::bind_executor(executor, bind_memory(write_memory_, std::move(handler)))
+                );
+            },
+            token
+        );
+    }
+
+    // Cancels the outstanding operations, they complete with an error
+    void close()
+    {
+        boost::system::error_code ignored;
+        stream_->lowest_layer().close(ignored);
+    }
+
+    // Reads and writes that didn't fit their recycled memory
+    std::size_t handler_memory_misses() const
+    {
+        return read_memory_.misses() + write_memory_.misses();
+    }
+
+private:
+    template <typename Handler>
+    struct read_line_op
+    {
+        coro_stream* self;
+        Handler handler;
+
+        void start()
+        {
+            auto executor = boost::asio::get_associated_executor(handler, self->stream_->get_executor());
+            boost::asio::async_read_until(
+                *self->stream_, self->read_buffer_, "\n",
+                boost::asio::bind_executor(executor, bind_memory(self->read_memory_, std::move(*this)))
+            );
+        }
+
+        void operator()(boost::system::error_code ec, std::size_t transferred)
+        {
+            if (ec) {
+                std::move(handler)(ec, std::string_view());
+                return;
+            }
+
+            std::string_view line(static_cast<const char*>(self->read_buffer_.data().data()), transferred - 1);
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+
+            if (line.empty()) {
+                self->read_buffer_.consume(transferred);
+                start();
+                return;
+            }
+
+            self->consumed_ = transferred;
+            std::move(handler)(ec, line);
+        }
+    };
+
+    boost::asio::awaitable<void> connect_and_handshake(std::string host, std::string port)
+    {
+        using boost::asio::use_awaitable;
+
+        const auto results = co_await resolver_.async_resolve(host, port, use_awaitable);
+
+        auto& socket = stream_->lowest_layer();
+        boost::system::error_code ec = boost::asio::error::host_not_found;
+        for (const auto& endpoint : interleave_address_families(results)) {
+            socket.close(ec);
+            socket.open(endpoint.protocol(), ec);
+            if (ec)
+                continue;
+            boost::system::error_code option_ec;
+            apply_socket_options(socket, socket_options_, option_ec);
+
+            co_await socket.async_connect(endpoint, boost::asio::redirect_error(use_awaitable, ec));
+            if (!ec || timed_out_)
+                break;
+        }
+        if (ec)
+            throw boost::system::system_error(ec);
+
+        if constexpr (is_tls_stream<Stream>::value) {
+            co_await stream_->async_handshake(Stream::client, use_awaitable);
+        }
+    }
+
+    Stream* stream_;
+    Resolver resolver_;
+    boost::asio::steady_timer deadline_;
+    bool timed_out_ = false;
+    socket_options socket_options_;
+
+    boost::asio::streambuf read_buffer_;
+    // length of the line last returned by read_line, consumed on the next call
+    std::size_t consumed_ = 0;
+    std::string write_buffer_;
+    handler_memory<> read_memory_;
+    handler_memory<> write_memory_;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,191 @@
+// Measures how many title lookups CurlEngine makes per second, and how long
+// they take, at several concurrency levels:
+//
+//     curl_bench [--url http://127.0.0.1:8080] [--requests 1000]
+//                [--concurrency 1,4,16,64]
+//
+// Run it against mock_youtube, which sets the latency, errors and payload
+// size. For each level c the engine is run by c threads and c requests are
+// kept in flight: the callback of one queues the next, so the numbers are
+// those of a closed loop and there is no queueing in the engine. Every
+// request is for a different id, so none are coalesced. The latency is
+// from execute() to the callback on the io_context, over the successful
+// requests. What the engine prints goes to /dev/null, the report to stderr.
+
+#include "CurlEngine.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+struct options
+{
+    // the API base URL, as in the bot's config
+    std::string url = "http://127.0.0.1:8080";
+    // requests per concurrency level
+    std::size_t requests = 1000;
+    std::vector<unsigned> concurrency{ 1, 4, 16, 64 };
+};
+
+std::vector<unsigned> parse_levels(std::string_view list)
+{
+    std::vector<unsigned> levels;
+    while (!list.empty()) {
+        const auto comma = list.find(',');
+        const unsigned level = std::stoul(std::string(list.substr(0, comma)));
+        if (level == 0)
+            throw std::invalid_argument("a concurrency level is at least 1");
+        levels.push_back(level);
+        if (comma == std::string_view::npos)
+            break;
+        list.remove_prefix(comma + 1);
+    }
+    if (levels.empty())
+        throw std::invalid_argument("no concurrency levels");
+    return levels;
+}
+
+options parse_options(int argc, const char* argv[])
+{
+    options opts;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (i + 1 >= argc)
+            throw std::invalid_argument(fmt::format("{} needs a value", arg));
+        const std::string value = argv[++i];
+        if (arg == "--url") opts.url = value;
+        else if (arg == "--requests") opts.requests = std::stoul(value);
+        else if (arg == "--concurrency") opts.concurrency = parse_levels(value);
+        else throw std::invalid_argument(fmt::format("unknown option {}", arg));
+    }
+    return opts;
+}
+
+std::int64_t percentile(std::vector<std::int64_t>& values, double p)
+{
+    if (values.empty())
+        return 0;
+    auto nth = values.begin() + static_cast<std::ptrdiff_t>(p * (values.size() - 1));
+    std::nth_element(values.begin(), nth, values.end());
+    return *nth;
+}
+
+struct level_result
+{
+    double seconds = 0;
+    std::uint64_t failures = 0;
+    // nanoseconds, of successful requests
+    std::vector<std::int64_t> latencies;
+};
+
+// Makes opts.requests requests with `concurrency` of them in flight
+level_result run_level(const options& opts, unsigned concurrency, std::size_t& next_id)
+{
+    boost::asio::io_context io_context;
+    auto work = boost::asio::make_work_guard(io_context);
+    CurlEngine engine(io_context);
+    counter failures;
+    engine.set_metrics({ nullptr, nullptr, &failures });
+
+    level_result result;
+    result.latencies.reserve(opts.requests);
+    std::size_t issued = 0;
+
+    // failed requests have no callback, so the poll below makes up for them
+    const auto issue = [&] (auto& self) -> void {
+        ++issued;
+        request_data request;
+        request.url = fmt::format("{}/videos?id=bench{}&part=snippet,contentDetails&key=bench", opts.url, next_id++);
+        request.callback = [&, start = clock_type::now()] (std::string) {
+            result.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count());
+            if (issued < opts.requests)
+                self(self);
+        };
+        engine.execute(std::move(request));
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < concurrency; ++i) {
+        pool.emplace_back([&] { engine.run(); });
+    }
+
+    const auto start = clock_type::now();
+    for (unsigned i = 0; i < concurrency && issued < opts.requests; ++i) {
+        issue(issue);
+    }
+
+    boost::asio::steady_timer poll(io_context);
+    const auto check = [&] (auto& self) -> void {
+        poll.expires_after(1ms);
+        poll.async_wait([&] (boost::system::error_code) {
+            const std::size_t done = result.latencies.size() + failures.value();
+            if (done >= opts.requests) {
+                work.reset();
+                return;
+            }
+            while (issued < opts.requests && issued - done < concurrency) {
+                issue(issue);
+            }
+            self(self);
+        });
+    };
+    check(check);
+
+    io_context.run();
+    result.seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    result.failures = failures.value();
+
+    engine.stop();
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    return result;
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    options opts;
+    try {
+        opts = parse_options(argc, argv);
+    } catch (const std::exception& e) {
+        fmt::print(stderr, "{}\n", e.what());
+        return 2;
+    }
+
+    std::freopen("/dev/null", "w", stdout);
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    fmt::print(stderr, "{:>11} {:>9} {:>10} {:>10} {:>10} {:>10} {:>9}\n",
+        "concurrency", "req/s", "p50 ms", "p99 ms", "p999 ms", "max ms", "failures");
+    std::size_t next_id = 0;
+    for (const unsigned concurrency : opts.concurrency) {
+        auto result = run_level(opts, concurrency, next_id);
+        auto& latencies = result.latencies;
+        const double total = static_cast<double>(latencies.size() + result.failures);
+        fmt::print(stderr, "{:>11} {:>9.0f} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.2f} {:>9}\n",
+            concurrency,
+            total / result.seconds,
+            percentile(latencies, 0.50) / 1e6,
+            percentile(latencies, 0.99) / 1e6,
+            percentile(latencies, 0.999) / 1e6,
+            percentile(latencies, 1.0) / 1e6,
+            result.failures);
+    }
+
+    curl_global_cleanup();
+    return 0;
+}
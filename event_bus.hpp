@@ -0,0 +1,77 @@
+#ifndef EVENT_BUS_HPP
+#define EVENT_BUS_HPP
+
+#include "command_table.hpp"
+#include "irc_message.hpp"
+
+#include <array>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Routes parsed IRC messages to the handlers subscribed to their command.
+// Numeric replies map directly to slots 0-999, the named commands we know
+// about follow after them, and anything else shares a final slot. Publishing
+// is a table lookup plus calls to the subscribers of that one command.
+class event_bus
+{
+public:
+    using handler = std::function<void (const irc_message& msg)>;
+
+    static constexpr auto named_commands = make_command_table(
+        "PING", "PONG", "PRIVMSG", "NOTICE", "JOIN", "PART", "QUIT", "NICK",
+        "MODE", "KICK", "TOPIC", "INVITE", "ERROR", "CAP", "AUTHENTICATE", "AWAY",
+        "ACCOUNT", "CHGHOST", "WALLOPS", "KILL"
+    );
+
+    static constexpr std::size_t numeric_count = 1000;
+    static constexpr std::size_t other = numeric_count + named_commands.size();
+    static constexpr std::size_t slot_count = other + 1;
+
+    static std::size_t command_id(std::string_view command)
+    {
+        if (command.size() == 3 && is_digit(command[0]) && is_digit(command[1]) && is_digit(command[2])) {
+            return (command[0] - '0') * 100 + (command[1] - '0') * 10 + (command[2] - '0');
+        }
+
+        const auto index = named_commands.find(command);
+        if (index == decltype(named_commands)::npos)
+            return other;
+        return numeric_count + index;
+    }
+
+    // Subscribe to a command ("PRIVMSG") or a numeric reply ("001")
+    void subscribe(std::string_view command, handler&& callback)
+    {
+        const auto id = command_id(command);
+        if (id == other) {
+            throw std::invalid_argument("event_bus: unknown command " + std::string(command));
+        }
+        subscribers_[id].emplace_back(std::move(callback));
+    }
+
+    // Subscribe to every command that has no slot of its own
+    void subscribe_other(handler&& callback)
+    {
+        subscribers_[other].emplace_back(std::move(callback));
+    }
+
+    void publish(const irc_message& msg) const
+    {
+        for (const auto& callback : subscribers_[command_id(msg.command)]) {
+            callback(msg);
+        }
+    }
+
+private:
+    static constexpr bool is_digit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    std::array<std::vector<handler>, slot_count> subscribers_;
+};
+
+#endif
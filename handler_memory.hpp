@@ -0,0 +1,124 @@
+#ifndef HANDLER_MEMORY_HPP
+#define HANDLER_MEMORY_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Storage for the handler of one kind of asynchronous operation, like a
+// connection's reads. Only one such operation is outstanding at a time and
+// asio frees a handler's memory before invoking it, so a single slot is
+// reused for every operation. Allocations that don't fit, or that happen
+// while the slot is taken, fall back to the heap.
+//
+// Not thread-safe, allocations are expected to happen on one strand.
+template <std::size_t Size = 1024>
+class handler_memory
+{
+public:
+    handler_memory() = default;
+    handler_memory(const handler_memory&) = delete;
+    handler_memory& operator=(const handler_memory&) = delete;
+
+    void* allocate(std::size_t size)
+    {
+        if (!in_use_ && size <= Size) {
+            in_use_ = true;
+            return &storage_;
+        }
+        ++misses_;
+        return ::operator new(size);
+    }
+
+    void deallocate(void* pointer)
+    {
+        if (pointer == &storage_) {
+            in_use_ = false;
+        } else {
+            ::operator delete(pointer);
+        }
+    }
+
+    // Allocations that went to the heap
+    std::size_t misses() const { return misses_; }
+
+private:
+    std::aligned_storage_t<Size> storage_;
+    bool in_use_ = false;
+    std::size_t misses_ = 0;
+};
+
+template <typename T, std::size_t Size = 1024>
+class handler_allocator
+{
+public:
+    using value_type = T;
+
+    explicit handler_allocator(handler_memory<Size>& memory)
+        : memory_(&memory)
+    {}
+
+    template <typename U>
+    handler_allocator(const handler_allocator<U, Size>& other) noexcept
+        : memory_(other.memory_)
+    {}
+
+    T* allocate(std::size_t n) const
+    {
+        return static_cast<T*>(memory_->allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* pointer, std::size_t) const
+    {
+        memory_->deallocate(pointer);
+    }
+
+    template <typename U>
+    struct rebind { using other = handler_allocator<U, Size>; };
+
+    bool operator==(const handler_allocator& other) const noexcept { return memory_ == other.memory_; }
+    bool operator!=(const handler_allocator& other) const noexcept { return memory_ != other.memory_; }
+
+private:
+    template <typename, std::size_t> friend class handler_allocator;
+
+    handler_memory<Size>* memory_;
+};
+
+// Wraps a handler so that asio allocates its operations from memory, via
+// the handler's associated allocator
+template <typename Handler, std::size_t Size = 1024>
+class memory_bound_handler
+{
+public:
+    using allocator_type = handler_allocator<Handler, Size>;
+
+    memory_bound_handler(handler_memory<Size>& memory, Handler handler)
+        : memory_(memory)
+        , handler_(std::move(handler))
+    {}
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type(memory_);
+    }
+
+    template <typename... Args>
+    void operator()(Args&&... args)
+    {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    handler_memory<Size>& memory_;
+    Handler handler_;
+};
+
+template <std::size_t Size, typename Handler>
+memory_bound_handler<std::decay_t<Handler>, Size> bind_memory(handler_memory<Size>& memory, Handler&& handler)
+{
+    return memory_bound_handler<std::decay_t<Handler>, Size>(memory, std::forward<Handler>(handler));
+}
+
+#endif
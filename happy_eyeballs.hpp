@@ -0,0 +1,42 @@
+#ifndef HAPPY_EYEBALLS_HPP
+#define HAPPY_EYEBALLS_HPP
+
+#include <boost/asio/ip/tcp.hpp>
+
+#include <chrono>
+#include <vector>
+
+// RFC 8305 "Connection Attempt Delay": how long to wait for an attempt
+// before starting the next one in parallel
+constexpr std::chrono::milliseconds connection_attempt_delay{250};
+
+// RFC 8305 section 4: keep the resolver's order within each address family,
+// but alternate between the families, starting with the family of the first
+// address.
+template <typename Results>
+std::vector<boost::asio::ip::tcp::endpoint> interleave_address_families(const Results& results)
+{
+    std::vector<boost::asio::ip::tcp::endpoint> preferred;
+    std::vector<boost::asio::ip::tcp::endpoint> other;
+
+    for (const auto& entry : results) {
+        const auto endpoint = entry.endpoint();
+        if (preferred.empty() || endpoint.address().is_v6() == preferred.front().address().is_v6()) {
+            preferred.push_back(endpoint);
+        } else {
+            other.push_back(endpoint);
+        }
+    }
+
+    std::vector<boost::asio::ip::tcp::endpoint> endpoints;
+    endpoints.reserve(preferred.size() + other.size());
+    for (std::size_t i = 0; i < preferred.size() || i < other.size(); ++i) {
+        if (i < preferred.size())
+            endpoints.push_back(preferred[i]);
+        if (i < other.size())
+            endpoints.push_back(other[i]);
+    }
+    return endpoints;
+}
+
+#endif
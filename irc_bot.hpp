@@ -0,0 +1,435 @@
+#ifndef IRC_BOT_HPP
+#define IRC_BOT_HPP
+
+#include "channel_log.hpp"
+#include "channel_state.hpp"
+#include "channel_table.hpp"
+#include "command_table.hpp"
+#include "event_bus.hpp"
+#include "find_youtube_ids.hpp"
+#include "irc_message.hpp"
+#include "metrics.hpp"
+#include "seen_table.hpp"
+#include "string_interner.hpp"
+#include "title_cache.hpp"
+
+#include <fmt/chrono.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+struct network_config
+{
+    std::string name;
+    std::string server;
+    std::string nick;
+    std::vector<channel_config> channels;
+
+    // used for private messages to the bot, the rate limit applies to each
+    // sender on its own
+    channel_settings query_settings;
+};
+
+// Everything the bots on the different networks have in common
+template <typename HttpEngine>
+struct bot_shared
+{
+    HttpEngine& http;
+    title_cache& titles;
+    std::string youtube_key;
+    // title cache lookups, optional
+    counter* title_hits = nullptr;
+    counter* title_misses = nullptr;
+    // where the YouTube Data API is, without the trailing slash
+    std::string youtube_api = "https://www.googleapis.com/youtube/v3";
+};
+
+// Irc types that can run a function on the executor the bot runs on, like
+// net_stream::post()
+template <typename Irc, typename = void>
+struct has_post : std::false_type {};
+
+template <typename Irc>
+struct has_post<
+    Irc,
+    std::void_t<decltype(std::declval<Irc&>().post(std::declval<void (*)()>()))>
+> : std::true_type {};
+
+inline constexpr auto bot_commands = make_command_table(
+    ".hello",
+    ".grep",
+    ".seen"
+);
+
+// The bot's behaviour on one network. Irc is anything with write(std::string_view)
+// and flush_backlog() members, normally a net_stream. HttpEngine has
+// execute(request_type&&) and overloaded(), and may call back on any thread;
+// when Irc has post(f), the callbacks are handled through it, otherwise
+// they have to be called where the bot runs.
+template <typename Irc, typename HttpEngine>
+class irc_bot
+{
+public:
+    irc_bot(Irc& irc, bot_shared<HttpEngine>& shared, network_config config)
+        : irc_(irc)
+        , shared_(shared)
+        , config_(std::move(config))
+        , channels_(config_.channels)
+        , query_(channel{ {}, config_.query_settings, rate_limiter(config_.query_settings.rate_limit, config_.query_settings.rate_period) })
+        , state_(strings_)
+        , commands_(bot_commands)
+    {
+        subscribe();
+    }
+
+    void on_connected()
+    {
+        joined_ = false;
+        state_.clear();
+        state_.set_own_nick(config_.nick);
+
+        std::string connect_msg;
+        connect_msg += fmt::format("NICK {}\r\n", config_.nick);
+        connect_msg += fmt::format("USER {} remotehost remoteserver :Forkey Bot\r\n", config_.nick);
+        irc_.write(connect_msg);
+    }
+
+    void on_read(std::string_view line)
+    {
+        fmt::print("[{}] < {}\n", config_.name, line);
+        if (auto msg = parse_irc_message(line)) {
+            events_.publish(*msg);
+        }
+    }
+
+    // While overloaded the bot only writes what keeps the connection going,
+    // like PONG and JOIN, and ignores commands and links
+    void set_overloaded(bool overloaded) { overloaded_ = overloaded; }
+    bool overloaded() const { return overloaded_; }
+
+    // Sends QUIT after whatever is queued; commands and links are ignored
+    // from then on
+    void quit(std::string_view message)
+    {
+        quitting_ = true;
+        send("QUIT :{}\r\n", message);
+    }
+
+    // Notes who was last seen in the configured channels from then on, and
+    // answers .seen from it. Null stops both.
+    void set_seen(seen_table* seen) { seen_ = seen; }
+
+    // Logs messages, joins, parts and kicks in the configured channels, and
+    // quits and nick changes, from then on. .grep searches it. Null stops
+    // logging.
+    void set_log(channel_log* log) { log_ = log; }
+
+    const network_config& config() const { return config_; }
+    const channel_state& state() const { return state_; }
+    const string_interner& strings() const { return strings_; }
+
+private:
+    // replies to a .grep
+    static constexpr std::size_t grep_results = 3;
+
+    void subscribe()
+    {
+        state_.subscribe(events_);
+        subscribe_log();
+        subscribe_seen();
+
+        commands_.on<bot_commands.find(".hello")>([this] (std::string_view, const irc_message& msg, channel& target) {
+            if (target.settings.hello && target.limiter.try_acquire()) {
+                send("PRIVMSG {} :hi {}\r\n", reply_target(msg), msg.nick());
+            }
+        });
+
+        // .grep <words> answers with the last messages in the channel
+        // containing all of the words. The log searches on its own thread.
+        commands_.on<bot_commands.find(".grep")>([this] (std::string_view words, const irc_message& msg, channel& target) {
+            if (!log_ || !is_channel_name(msg.param(0)) || !target.settings.grep || !target.limiter.try_acquire())
+                return;
+            log_->search(msg.param(0), words, grep_results,
+                [this, channel = std::string(msg.param(0))] (std::vector<channel_log::search_hit> hits) {
+                    on_own_executor([this, channel, hits = std::move(hits)] {
+                        reply_grep(channel, hits);
+                    });
+                });
+        });
+
+        // .seen <nick>
+        commands_.on<bot_commands.find(".seen")>([this] (std::string_view args, const irc_message& msg, channel& target) {
+            const std::string_view nick = args.substr(0, args.find(' '));
+            if (!seen_ || nick.empty() || !target.settings.seen || !target.limiter.try_acquire())
+                return;
+            reply_seen(reply_target(msg), nick);
+        });
+
+        events_.subscribe("PING", [this] (const irc_message& msg) {
+            send("PONG :{}\r\n", msg.text());
+        });
+
+        events_.subscribe("MODE", [this] (const irc_message& msg) {
+            if (msg.param(0) == config_.nick && !joined_) {
+                join_channel();
+                joined_ = true;
+                // whatever was written while we were disconnected
+                irc_.flush_backlog();
+            }
+        });
+
+        events_.subscribe("PRIVMSG", [this] (const irc_message& msg) {
+            channel* target = find_channel(msg);
+            if (!target || overloaded_ || quitting_)
+                return;
+
+            if (msg.text().find('.') == 0) {
+                commands_.dispatch(msg.text(), msg, *target);
+            }
+
+            if (target->settings.youtube) {
+                for (const auto id : find_youtube_ids(msg.text())) {
+                    if (target->limiter.try_acquire()) {
+                        lookup_youtube(id, reply_target(msg));
+                    }
+                }
+            }
+        });
+    }
+
+    void subscribe_log()
+    {
+        // the channels of the log are those in the config, not queries
+        const auto logged = [this] (std::string_view target) {
+            return log_ && is_channel_name(target) && channels_.find(target);
+        };
+        const auto reason = [] (const irc_message& msg, std::size_t index) {
+            return msg.param_count > index ? msg.text() : std::string_view();
+        };
+
+        events_.subscribe("PRIVMSG", [this, logged] (const irc_message& msg) {
+            if (logged(msg.param(0)))
+                log_->append(log_kind::privmsg, msg.param(0), msg.nick(), msg.text());
+        });
+        events_.subscribe("NOTICE", [this, logged] (const irc_message& msg) {
+            if (logged(msg.param(0)))
+                log_->append(log_kind::notice, msg.param(0), msg.nick(), msg.text());
+        });
+        events_.subscribe("JOIN", [this, logged] (const irc_message& msg) {
+            if (logged(msg.param(0)))
+                log_->append(log_kind::join, msg.param(0), msg.nick(), {});
+        });
+        events_.subscribe("PART", [this, logged, reason] (const irc_message& msg) {
+            if (logged(msg.param(0)))
+                log_->append(log_kind::part, msg.param(0), msg.nick(), reason(msg, 1));
+        });
+        // <channel> <nick> [:<reason>]
+        events_.subscribe("KICK", [this, logged, reason] (const irc_message& msg) {
+            if (logged(msg.param(0)))
+                log_->append(log_kind::kick, msg.param(0), msg.param(1), reason(msg, 2));
+        });
+        events_.subscribe("QUIT", [this, reason] (const irc_message& msg) {
+            if (log_)
+                log_->append(log_kind::quit, {}, msg.nick(), reason(msg, 0));
+        });
+        events_.subscribe("NICK", [this] (const irc_message& msg) {
+            if (log_)
+                log_->append(log_kind::nick, {}, msg.nick(), msg.param(0));
+        });
+    }
+
+    void subscribe_seen()
+    {
+        const auto noted = [this] (std::string_view target) {
+            return seen_ && is_channel_name(target) && channels_.find(target);
+        };
+        const auto reason = [] (const irc_message& msg, std::size_t index) {
+            return msg.param_count > index ? msg.text() : std::string_view();
+        };
+
+        events_.subscribe("PRIVMSG", [this, noted] (const irc_message& msg) {
+            if (noted(msg.param(0)))
+                seen_->update(seen_event::message, msg.nick(), msg.param(0), msg.text());
+        });
+        events_.subscribe("JOIN", [this, noted] (const irc_message& msg) {
+            if (noted(msg.param(0)))
+                seen_->update(seen_event::join, msg.nick(), msg.param(0), {});
+        });
+        events_.subscribe("PART", [this, noted, reason] (const irc_message& msg) {
+            if (noted(msg.param(0)))
+                seen_->update(seen_event::part, msg.nick(), msg.param(0), reason(msg, 1));
+        });
+        events_.subscribe("QUIT", [this, reason] (const irc_message& msg) {
+            if (seen_)
+                seen_->update(seen_event::quit, msg.nick(), {}, reason(msg, 0));
+        });
+    }
+
+    void reply_seen(std::string_view target, std::string_view nick)
+    {
+        const auto seen = seen_->find(nick);
+        if (!seen) {
+            send("PRIVMSG {} :I haven't seen {}\r\n", target, nick);
+            return;
+        }
+
+        const auto time = fmt::gmtime(seen_table::clock::to_time_t(seen->time));
+        switch (seen->event) {
+        case seen_event::message:
+            send("PRIVMSG {} :{} was last seen {:%Y-%m-%d %H:%M} UTC in {} saying: {}\r\n", target, seen->nick, time, seen->channel, seen->excerpt);
+            break;
+        case seen_event::join:
+            send("PRIVMSG {} :{} was last seen {:%Y-%m-%d %H:%M} UTC joining {}\r\n", target, seen->nick, time, seen->channel);
+            break;
+        case seen_event::part:
+            send("PRIVMSG {} :{} was last seen {:%Y-%m-%d %H:%M} UTC leaving {}{}{}\r\n", target, seen->nick, time, seen->channel,
+                seen->excerpt.empty() ? "" : ": ", seen->excerpt);
+            break;
+        case seen_event::quit:
+            send("PRIVMSG {} :{} was last seen {:%Y-%m-%d %H:%M} UTC quitting{}{}\r\n", target, seen->nick, time,
+                seen->excerpt.empty() ? "" : ": ", seen->excerpt);
+            break;
+        }
+    }
+
+    // Formats into a string that keeps its capacity, so that sending
+    // doesn't allocate once the bot has sent its longest message
+    template <typename... Args>
+    void send(fmt::format_string<Args...> format, Args&&... args)
+    {
+        out_.clear();
+        fmt::format_to(std::back_inserter(out_), format, std::forward<Args>(args)...);
+        irc_.write(out_);
+    }
+
+    void reply_grep(std::string_view channel, const std::vector<channel_log::search_hit>& hits)
+    {
+        // the log that found them is gone
+        if (!log_)
+            return;
+        if (hits.empty()) {
+            send("PRIVMSG {} :no matches\r\n", channel);
+            return;
+        }
+        for (const auto& hit : hits) {
+            send("PRIVMSG {} :[{:%Y-%m-%d %H:%M}] <{}> {}\r\n",
+                channel, fmt::gmtime(channel_log::clock::to_time_t(hit.time)), log_->name(hit.nick), hit.text);
+        }
+    }
+
+    // Runs f where the bot's handlers run, send() and the bot's state are
+    // not safe anywhere else
+    template <typename F>
+    void on_own_executor(F&& f)
+    {
+        if constexpr (has_post<Irc>::value) {
+            irc_.post(std::forward<F>(f));
+        } else {
+            f();
+        }
+    }
+
+    void join_channel()
+    {
+        static constexpr std::string_view join_msg = "C++ is a \x02great\x02 language";
+        std::string msg;
+        for (const auto& chan : channels_) {
+            msg += fmt::format("JOIN {}\r\n", chan.name);
+            if (chan.settings.greet) {
+                msg += fmt::format("PRIVMSG {} :{}\r\n", chan.name, join_msg);
+            }
+        }
+        if (!msg.empty()) {
+            irc_.write(msg);
+        }
+    }
+
+    // Messages to a channel are answered in the channel, private messages
+    // are answered to the sender
+    std::string_view reply_target(const irc_message& msg) const
+    {
+        const auto target = msg.param(0);
+        return is_channel_name(target) ? target : msg.nick();
+    }
+
+    channel* find_channel(const irc_message& msg)
+    {
+        const auto target = msg.param(0);
+        if (is_channel_name(target))
+            return channels_.find(target);
+        if (config_.query_settings.rate_limit == 0)
+            return &query_;
+
+        if (auto* query = queries_.find(msg.nick()))
+            return query;
+        if (queries_.size() < max_query_senders)
+            return &queries_.insert(channel_config{ std::string(msg.nick()), config_.query_settings });
+
+        // the sender that was limited longest ago makes room; whoever is
+        // flooding right now keeps their empty budget
+        const auto oldest = std::min_element(queries_.begin(), queries_.end(), [] (const channel& a, const channel& b) {
+            return a.limiter.last_used() < b.limiter.last_used();
+        });
+        return &queries_.replace(*queries_.find(oldest->name), msg.nick(), config_.query_settings);
+    }
+
+    void lookup_youtube(std::string_view id, std::string_view target)
+    {
+        if (auto title = shared_.titles.find(id)) {
+            if (shared_.title_hits)
+                shared_.title_hits->add();
+            send("PRIVMSG {} :{}\r\n", target, *title);
+            return;
+        }
+        if (shared_.title_misses)
+            shared_.title_misses->add();
+        if (shared_.http.overloaded())
+            return;
+
+        typename HttpEngine::request_type request;
+        request.url = fmt::format(
+            "{}/videos?id={}&part=snippet,contentDetails&key={}",
+            shared_.youtube_api,
+            id,
+            shared_.youtube_key
+        );
+        request.callback = [this, id = std::string(id), target = std::string(target)] (std::string title) {
+            on_own_executor([this, id, target, title = std::move(title)] () mutable {
+                send("PRIVMSG {} :{}\r\n", target, title);
+                shared_.titles.insert(id, std::move(title));
+            });
+        };
+
+        shared_.http.execute(std::move(request));
+    }
+
+    Irc& irc_;
+    bot_shared<HttpEngine>& shared_;
+    const network_config config_;
+    channel_table channels_;
+    // private messages while they aren't rate limited
+    channel query_;
+    // private messages by sender, keeping each sender's rate limit
+    channel_table queries_;
+    static constexpr std::size_t max_query_senders = 1024;
+    string_interner strings_;
+    channel_state state_;
+    event_bus events_;
+    // handlers are called with the command arguments, the message and the
+    // channel (or query) it was sent to
+    command_dispatcher<bot_commands.size(), const irc_message&, channel&> commands_;
+    bool joined_ = false;
+    bool overloaded_ = false;
+    bool quitting_ = false;
+    channel_log* log_ = nullptr;
+    seen_table* seen_ = nullptr;
+    std::string out_;
+};
+
+#endif
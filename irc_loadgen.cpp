@@ -0,0 +1,423 @@
+// A fake IRC server for load testing the bot over loopback TLS:
+//
+//     irc_loadgen [--port 6697] [--rate 10000] [--duration 30] [--nick borky]
+//                 [--channel #bots] [--mix privmsg=70,ping=10,link=10,hello=10]
+//
+// It listens on 127.0.0.1 with a self-signed certificate and takes one
+// connection: point a network of the bot at localhost with "tls": true.
+// Once the bot has registered and joined the channel, it sends lines of the
+// mix at the given rate (0 is as fast as the bot takes them) and checks the
+// replies:
+//
+//   privmsg  chatter that needs no reply
+//   ping     PING with a sequence number, the PONG must echo it
+//   link     a YouTube link, answered with a title (by the real HTTP engine)
+//   hello    .hello, answered with "hi <nick>"
+//
+// Every second it prints what was sent and received and the PONG latency.
+// At the end it waits a few seconds for late replies, prints a summary and
+// exits with 1 if any PING went unanswered or a reply was malformed.
+// Replies to links and .hello are subject to the bot's rate limits, so they
+// are counted but not required.
+
+#include "self_signed_cert.hpp"
+
+#include <utility> // before asio, its awaitable.hpp uses std::exchange
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std::chrono_literals;
+using boost::asio::ip::tcp;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+struct options
+{
+    unsigned short port = 6697;
+    // lines per second, 0 is as fast as possible
+    unsigned rate = 10000;
+    std::chrono::seconds duration{ 30 };
+    std::string nick = "borky";
+    std::string channel = "#bots";
+    // weights of the line kinds
+    unsigned privmsg = 70;
+    unsigned ping = 10;
+    unsigned link = 10;
+    unsigned hello = 10;
+};
+
+void parse_mix(std::string_view mix, options& opts)
+{
+    opts.privmsg = opts.ping = opts.link = opts.hello = 0;
+    while (!mix.empty()) {
+        const auto comma = mix.find(',');
+        const auto item = mix.substr(0, comma);
+        mix = comma == std::string_view::npos ? std::string_view() : mix.substr(comma + 1);
+
+        const auto equals = item.find('=');
+        if (equals == std::string_view::npos)
+            throw std::invalid_argument(fmt::format("bad mix item '{}'", item));
+        const auto kind = item.substr(0, equals);
+        const unsigned weight = std::stoul(std::string(item.substr(equals + 1)));
+        if (kind == "privmsg") opts.privmsg = weight;
+        else if (kind == "ping") opts.ping = weight;
+        else if (kind == "link") opts.link = weight;
+        else if (kind == "hello") opts.hello = weight;
+        else throw std::invalid_argument(fmt::format("unknown line kind '{}'", kind));
+    }
+    if (opts.privmsg + opts.ping + opts.link + opts.hello == 0)
+        throw std::invalid_argument("the mix is empty");
+}
+
+options parse_options(int argc, const char* argv[])
+{
+    options opts;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (i + 1 >= argc)
+            throw std::invalid_argument(fmt::format("{} needs a value", arg));
+        const std::string value = argv[++i];
+        if (arg == "--port") opts.port = static_cast<unsigned short>(std::stoul(value));
+        else if (arg == "--rate") opts.rate = std::stoul(value);
+        else if (arg == "--duration") opts.duration = std::chrono::seconds(std::stoul(value));
+        else if (arg == "--nick") opts.nick = value;
+        else if (arg == "--channel") opts.channel = value;
+        else if (arg == "--mix") parse_mix(value, opts);
+        else throw std::invalid_argument(fmt::format("unknown option {}", arg));
+    }
+    return opts;
+}
+
+struct counts
+{
+    std::uint64_t sent = 0;
+    std::uint64_t pings = 0;
+    std::uint64_t pongs = 0;
+    std::uint64_t links = 0;
+    std::uint64_t titles = 0;
+    std::uint64_t hellos = 0;
+    std::uint64_t his = 0;
+    // replies that don't match anything sent
+    std::uint64_t unexpected = 0;
+};
+
+std::int64_t percentile(std::vector<std::int64_t> values, double p)
+{
+    if (values.empty())
+        return 0;
+    auto nth = values.begin() + static_cast<std::ptrdiff_t>(p * (values.size() - 1));
+    std::nth_element(values.begin(), nth, values.end());
+    return *nth;
+}
+
+class load_session
+{
+public:
+    load_session(boost::asio::io_context& io_context, boost::asio::ssl::context& ssl_context, tcp::socket socket, options opts)
+        : stream_(std::move(socket), ssl_context)
+        , tick_(io_context)
+        , opts_(std::move(opts))
+        , weight_total_(opts_.privmsg + opts_.ping + opts_.link + opts_.hello)
+    {}
+
+    void start()
+    {
+        stream_.async_handshake(boost::asio::ssl::stream_base::server, [this] (boost::system::error_code ec) {
+            if (ec) {
+                fmt::print("TLS handshake failed: {}\n", ec.message());
+                return;
+            }
+            fmt::print("Bot connected, waiting for registration\n");
+            read();
+        });
+    }
+
+    bool failed() const { return total_.unexpected > 0 || !outstanding_pings_.empty(); }
+
+private:
+    enum class phase { registering, joining, blasting, draining, done };
+
+    void read()
+    {
+        boost::asio::async_read_until(stream_, read_buffer_, "\r\n", [this] (boost::system::error_code ec, std::size_t n) {
+            if (ec) {
+                fmt::print("Connection closed: {}\n", ec.message());
+                finish();
+                return;
+            }
+            std::string_view line(static_cast<const char*>(read_buffer_.data().data()), n - 2);
+            on_line(line);
+            read_buffer_.consume(n);
+            read();
+        });
+    }
+
+    void on_line(std::string_view line)
+    {
+        switch (phase_) {
+        case phase::registering:
+            if (line.starts_with("NICK "))
+                got_nick_ = true;
+            if (line.starts_with("USER "))
+                got_user_ = true;
+            if (got_nick_ && got_user_) {
+                phase_ = phase::joining;
+                send(fmt::format(":loadgen 001 {0} :Welcome to the load generator\r\n:{0} MODE {0} :+i\r\n", opts_.nick));
+            }
+            break;
+        case phase::joining:
+            if (line == fmt::format("JOIN {}", opts_.channel)) {
+                send(fmt::format(":{}!bot@localhost JOIN {}\r\n", opts_.nick, opts_.channel));
+                fmt::print("Bot joined {}, sending for {}s\n", opts_.channel, opts_.duration.count());
+                phase_ = phase::blasting;
+                started_ = last_report_ = clock_type::now();
+                tick();
+            }
+            break;
+        case phase::blasting:
+        case phase::draining:
+            check_reply(line);
+            break;
+        case phase::done:
+            break;
+        }
+    }
+
+    void check_reply(std::string_view line)
+    {
+        if (line.starts_with("PONG :t")) {
+            const auto seq = std::stoull(std::string(line.substr(7)));
+            const auto it = outstanding_pings_.find(seq);
+            if (it == outstanding_pings_.end()) {
+                ++total_.unexpected;
+                return;
+            }
+            const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now() - it->second).count();
+            latencies_.push_back(latency);
+            interval_latencies_.push_back(latency);
+            outstanding_pings_.erase(it);
+            ++total_.pongs;
+            return;
+        }
+
+        const auto reply_prefix = fmt::format("PRIVMSG {} :", opts_.channel);
+        if (line.starts_with(reply_prefix)) {
+            const auto text = line.substr(reply_prefix.size());
+            if (text.starts_with("\x02youtube\x02: ")) {
+                ++total_.titles;
+                return;
+            }
+            if (text.starts_with("hi user")) {
+                ++total_.his;
+                return;
+            }
+        }
+        // the bot's greeting when it joins
+        if (line.starts_with(reply_prefix) && line.find("language") != std::string_view::npos)
+            return;
+
+        ++total_.unexpected;
+        if (total_.unexpected <= 10)
+            fmt::print("Unexpected reply: {}\n", line);
+    }
+
+    void tick()
+    {
+        const auto now = clock_type::now();
+        if (phase_ == phase::blasting && now - started_ >= opts_.duration) {
+            phase_ = phase::draining;
+            fmt::print("Done sending, waiting for replies\n");
+            drain_until_ = now + 5s;
+        }
+        if (phase_ == phase::draining && (outstanding_pings_.empty() || now >= drain_until_)) {
+            report(now);
+            finish();
+            return;
+        }
+
+        if (phase_ == phase::blasting) {
+            std::uint64_t due;
+            if (opts_.rate == 0) {
+                // keep one batch queued behind the write in flight
+                due = pending_.empty() ? total_.sent + 256 : total_.sent;
+            } else {
+                const double elapsed = std::chrono::duration<double>(now - started_).count();
+                due = static_cast<std::uint64_t>(elapsed * opts_.rate);
+            }
+            while (total_.sent < due) {
+                pending_ += next_line(now);
+                ++total_.sent;
+            }
+            flush();
+        }
+
+        if (now - last_report_ >= 1s)
+            report(now);
+
+        tick_.expires_after(opts_.rate == 0 ? 0ms : 1ms);
+        tick_.async_wait([this] (boost::system::error_code ec) {
+            if (!ec)
+                tick();
+        });
+    }
+
+    std::string next_line(clock_type::time_point now)
+    {
+        // spread the kinds evenly by their weights
+        const unsigned slot = static_cast<unsigned>(total_.sent % weight_total_);
+        const auto nick = fmt::format("user{}", total_.sent % 50);
+        if (slot < opts_.ping) {
+            ++total_.pings;
+            outstanding_pings_.emplace(total_.sent, now);
+            return fmt::format("PING :t{}\r\n", total_.sent);
+        }
+        if (slot < opts_.ping + opts_.link) {
+            ++total_.links;
+            static constexpr std::string_view ids[] = { "dQw4w9WgXcQ", "9bZkp7q19f0", "kJQP7kiw5Fk", "JGwWNGJdvx8" };
+            return fmt::format(":{0}!{0}@localhost PRIVMSG {1} :have a look https://youtu.be/{2}\r\n",
+                nick, opts_.channel, ids[total_.sent % std::size(ids)]);
+        }
+        if (slot < opts_.ping + opts_.link + opts_.hello) {
+            ++total_.hellos;
+            return fmt::format(":{0}!{0}@localhost PRIVMSG {1} :.hello\r\n", nick, opts_.channel);
+        }
+        return fmt::format(":{0}!{0}@localhost PRIVMSG {1} :message {2} with nothing in it for the bot\r\n",
+            nick, opts_.channel, total_.sent);
+    }
+
+    void send(std::string message)
+    {
+        pending_ += message;
+        flush();
+    }
+
+    // Writes what is pending unless a write is in flight, which flushes
+    // again when it completes
+    void flush()
+    {
+        if (writing_ || pending_.empty())
+            return;
+        writing_ = true;
+        std::swap(in_flight_, pending_);
+        pending_.clear();
+        boost::asio::async_write(stream_, boost::asio::buffer(in_flight_), [this] (boost::system::error_code ec, std::size_t) {
+            writing_ = false;
+            if (ec) {
+                fmt::print("Write failed: {}\n", ec.message());
+                return;
+            }
+            flush();
+        });
+    }
+
+    void report(clock_type::time_point now)
+    {
+        const double seconds = std::chrono::duration<double>(now - last_report_).count();
+        fmt::print(
+            "sent {:>8.0f}/s  pongs {:>6}  pong latency p50 {:>6}us p99 {:>7}us max {:>7}us  titles {}  hellos {}  unanswered pings {}  unexpected {}\n",
+            (total_.sent - reported_sent_) / seconds,
+            interval_latencies_.size(),
+            percentile(interval_latencies_, 0.5),
+            percentile(interval_latencies_, 0.99),
+            percentile(interval_latencies_, 1.0),
+            total_.titles,
+            total_.his,
+            outstanding_pings_.size(),
+            total_.unexpected);
+        interval_latencies_.clear();
+        reported_sent_ = total_.sent;
+        last_report_ = now;
+    }
+
+    void finish()
+    {
+        if (phase_ == phase::done)
+            return;
+        phase_ = phase::done;
+        tick_.cancel();
+
+        const double seconds = std::chrono::duration<double>(clock_type::now() - started_).count();
+        fmt::print("\nSummary\n");
+        fmt::print("  lines sent:        {} ({:.0f}/s)\n", total_.sent, total_.sent / seconds);
+        fmt::print("  pings answered:    {} of {}\n", total_.pongs, total_.pings);
+        fmt::print("  pong latency:      p50 {}us, p99 {}us, p999 {}us, max {}us\n",
+            percentile(latencies_, 0.5), percentile(latencies_, 0.99), percentile(latencies_, 0.999), percentile(latencies_, 1.0));
+        fmt::print("  link titles:       {} for {} links\n", total_.titles, total_.links);
+        fmt::print("  hello replies:     {} for {} .hello\n", total_.his, total_.hellos);
+        fmt::print("  unexpected lines:  {}\n", total_.unexpected);
+
+        boost::system::error_code ignored;
+        stream_.lowest_layer().close(ignored);
+    }
+
+    boost::asio::ssl::stream<tcp::socket> stream_;
+    boost::asio::steady_timer tick_;
+    const options opts_;
+    const unsigned weight_total_;
+
+    phase phase_ = phase::registering;
+    bool got_nick_ = false;
+    bool got_user_ = false;
+
+    boost::asio::streambuf read_buffer_;
+    std::string pending_;
+    std::string in_flight_;
+    bool writing_ = false;
+
+    clock_type::time_point started_;
+    clock_type::time_point last_report_;
+    clock_type::time_point drain_until_;
+    counts total_;
+    std::uint64_t reported_sent_ = 0;
+    std::unordered_map<std::uint64_t, clock_type::time_point> outstanding_pings_;
+    std::vector<std::int64_t> latencies_;
+    std::vector<std::int64_t> interval_latencies_;
+};
+
+}
+
+int main(int argc, const char* argv[])
+{
+    options opts;
+    try {
+        opts = parse_options(argc, argv);
+    } catch (const std::exception& e) {
+        fmt::print("{}\n", e.what());
+        return 2;
+    }
+
+    boost::asio::io_context io_context;
+    boost::asio::ssl::context ssl_context(boost::asio::ssl::context::tls_server);
+    use_self_signed_certificate(ssl_context);
+
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), opts.port));
+    fmt::print("Listening on 127.0.0.1:{}\n", opts.port);
+
+    std::optional<load_session> session;
+    acceptor.async_accept([&] (boost::system::error_code ec, tcp::socket socket) {
+        if (ec) {
+            fmt::print("Accept failed: {}\n", ec.message());
+            return;
+        }
+        acceptor.close();
+        session.emplace(io_context, ssl_context, std::move(socket), opts);
+        session->start();
+    });
+
+    io_context.run();
+    return session && !session->failed() ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+#ifndef IRC_MESSAGE_HPP
+#define IRC_MESSAGE_HPP
+
+#include <array>
+#include <optional>
+#include <string_view>
+
+// A parsed IRC line. All fields are views into the line that was parsed, so
+// the line must outlive the message.
+struct irc_message
+{
+    static constexpr std::size_t max_params = 15;
+
+    std::string_view tags;
+    std::string_view prefix;
+    std::string_view command;
+    std::array<std::string_view, max_params> params;
+    std::size_t param_count = 0;
+
+    std::string_view param(std::size_t index) const
+    {
+        return index < param_count ? params[index] : std::string_view();
+    }
+
+    // The last parameter, which is the message text for PRIVMSG and NOTICE
+    std::string_view text() const
+    {
+        return param_count > 0 ? params[param_count - 1] : std::string_view();
+    }
+
+    // nick!user@host -> nick
+    std::string_view nick() const
+    {
+        return prefix.substr(0, prefix.find_first_of("!@"));
+    }
+
+    // nick!user@host -> host
+    std::string_view host() const
+    {
+        const auto at = prefix.find('@');
+        return at == std::string_view::npos ? std::string_view() : prefix.substr(at + 1);
+    }
+};
+
+// [@tags] [:prefix] command [params...] [:trailing]
+inline std::optional<irc_message> parse_irc_message(std::string_view line)
+{
+    irc_message msg;
+
+    const auto next_word = [&line] {
+        const auto space = line.find(' ');
+        auto word = line.substr(0, space);
+        line.remove_prefix(space == std::string_view::npos ? line.size() : space + 1);
+        while (!line.empty() && line.front() == ' ')
+            line.remove_prefix(1);
+        return word;
+    };
+
+    if (!line.empty() && line.front() == '@') {
+        msg.tags = next_word().substr(1);
+    }
+
+    if (!line.empty() && line.front() == ':') {
+        msg.prefix = next_word().substr(1);
+    }
+
+    msg.command = next_word();
+    if (msg.command.empty())
+        return std::nullopt;
+
+    while (!line.empty() && msg.param_count < irc_message::max_params) {
+        if (line.front() == ':') {
+            msg.params[msg.param_count++] = line.substr(1);
+            break;
+        }
+        msg.params[msg.param_count++] = next_word();
+    }
+
+    return msg;
+}
+
+#endif
@@ -2,40 +2,41 @@
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
 
+#include "alloc_accounting.hpp"
+#include "channel_log.hpp"
 #include "net_stream.hpp"
+#include "irc_bot.hpp"
+#include "metrics.hpp"
+#include "metrics_server.hpp"
+#include "seen_table.hpp"
+#include "trace.hpp"
+#include "title_cache.hpp"
+#include "wheel_timer_engine.hpp"
 #include "CurlEngine.hpp"
-#include "find_youtube_ids.hpp"
 
 #include "fmt/format.h"
 
 #include "nlohmann/json.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <filesystem>
 #include <iostream>
 #include <list>
+#include <optional>
+#include <vector>
 #include <fstream>
 
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
 
 using namespace std::literals;
 
-class TimerEngine
-{
-public:
-    using timer_type = boost::asio::steady_timer;
-
-    TimerEngine(boost::asio::io_context& executor)
-        : executor_(executor)
-    {}
-
-    timer_type create_timer()
-    {
-        return boost::asio::steady_timer(executor_);
-    }
-private:
-    boost::asio::io_context& executor_;
-};
+// All timers share one timing wheel and one asio timer
+using TimerEngine = wheel_timer_engine;
 
 nlohmann::json get_config()
 {
@@ -54,144 +55,660 @@ nlohmann::json get_config()
     }
 }
 
-int main(int, const char*[])
+channel_settings get_channel_settings(const nlohmann::json& json)
 {
-    const auto config = get_config();
+    channel_settings settings;
+    settings.greet = json.value("greet", settings.greet);
+    settings.hello = json.value("hello", settings.hello);
+    settings.youtube = json.value("youtube", settings.youtube);
+    settings.grep = json.value("grep", settings.grep);
+    settings.seen = json.value("seen", settings.seen);
+    settings.rate_limit = json.value("rate_limit", settings.rate_limit);
+    settings.rate_period = std::chrono::seconds(json.value("rate_period", settings.rate_period.count()));
+    return settings;
+}
 
-    const std::string irc_server = config.at("irc").at("server");
-    const std::string irc_channel = config.at("irc").at("channel");
-    const std::string irc_nick = config.at("irc").at("nick");
-    const std::string youtube_key = config.at("apis").at("youtube").at("key");
-    // TODO: better error handling above...
+// A channel is either just its name, or an object with a name and settings
+channel_config get_channel_config(const nlohmann::json& json)
+{
+    if (json.is_string()) {
+        return channel_config{ json.get<std::string>(), {} };
+    }
+    return channel_config{ json.at("name").get<std::string>(), get_channel_settings(json) };
+}
 
-    curl_global_init(CURL_GLOBAL_ALL);
+network_config get_network_config(const nlohmann::json& network)
+{
+    network_config result;
+    result.server = network.at("server");
+    result.nick = network.at("nick");
+    result.name = network.value("name", result.server);
+
+    if (network.contains("channels")) {
+        for (const auto& channel : network.at("channels")) {
+            result.channels.emplace_back(get_channel_config(channel));
+        }
+    } else {
+        result.channels.emplace_back(get_channel_config(network.at("channel")));
+    }
 
-    boost::asio::io_context io_context;
-    boost::asio::ip::tcp::resolver resolver(io_context);
-    boost::asio::ssl::context ssl_context(boost::asio::ssl::context_base::sslv23);
-    boost::asio::ssl::stream<boost::asio::ip::tcp::socket> stream(io_context, ssl_context);
+    if (network.contains("query")) {
+        result.query_settings = get_channel_settings(network.at("query"));
+    }
 
-    TimerEngine timer_engine(io_context);
-    CurlEngine http_engine(io_context);
-    std::thread thread{ [&] { http_engine.run(); } };
+    return result;
+}
 
-    net_stream<
-        boost::asio::io_context,
-        boost::asio::ssl::stream<boost::asio::ip::tcp::socket>,
-        boost::asio::ip::tcp::resolver,
-        TimerEngine>
-    irc(io_context, resolver, stream, timer_engine);
+// "policy" is one of drop_oldest, drop_newest, reject and coalesce
+queue_limits get_queue_limits(const nlohmann::json& json)
+{
+    static constexpr std::pair<std::string_view, overflow_policy> policies[] = {
+        { "drop_oldest", overflow_policy::drop_oldest },
+        { "drop_newest", overflow_policy::drop_newest },
+        { "reject", overflow_policy::reject },
+        { "coalesce", overflow_policy::coalesce },
+    };
 
-    irc.on_connected([&, irc_nick] {
-        std::string connect_msg;
-        connect_msg += fmt::format("NICK {}\r\n", irc_nick);
-        connect_msg += fmt::format("USER {} remotehost remoteserver :Forkey Bot\r\n", irc_nick);
+    queue_limits limits;
+    limits.capacity = json.value("capacity", limits.capacity);
+    if (json.contains("policy")) {
+        const std::string policy = json.at("policy");
+        const auto it = std::find_if(std::begin(policies), std::end(policies), [&] (const auto& p) {
+            return p.first == policy;
+        });
+        if (it == std::end(policies)) {
+            fmt::print("Unknown queue policy: {}\n", policy);
+            exit(1);
+        }
+        limits.policy = it->second;
+    }
+    return limits;
+}
 
-        irc.write(connect_msg);
-    });
+channel_log_options get_channel_log_options(const nlohmann::json& json)
+{
+    channel_log_options options;
+    options.directory = json.at("directory");
+    options.segment_bytes = json.value("segment_mb", options.segment_bytes >> 20) << 20;
+    options.commit_interval = std::chrono::milliseconds(json.value("commit_ms", options.commit_interval.count()));
+    options.sync = json.value("sync", options.sync);
+    options.search = json.value("search", options.search);
+    return options;
+}
 
-    irc.connect(irc_server);
+struct seen_config
+{
+    // each network's table is saved to a file of its name in directory
+    std::string directory;
+    std::size_t capacity = 16384;
+    std::chrono::seconds snapshot_interval{ 60 };
+};
 
-    irc.on_error([] (boost::system::error_code ec) {
-        throw boost::system::system_error(ec);
-    });
+seen_config get_seen_config(const nlohmann::json& json)
+{
+    seen_config config;
+    config.directory = json.at("directory");
+    config.capacity = json.value("capacity", config.capacity);
+    config.snapshot_interval = std::chrono::seconds(json.value("snapshot_s", config.snapshot_interval.count()));
+    return config;
+}
 
-    const auto is_ping_message = [] (std::string_view msg) {
-        return msg.find("PING :") == 0;
-    };
+struct shutdown_config
+{
+    // how long the HTTP requests being made get to finish
+    std::chrono::milliseconds http_timeout{ 5000 };
+    // how long servers get to close the connection after QUIT
+    std::chrono::milliseconds quit_timeout{ 5000 };
+    std::string message = "Shutting down";
+};
 
-    const auto make_pong = [] (std::string_view ping) {
-        ping.remove_prefix(ping.find(":"));
-        return fmt::format("PONG {}\r\n", ping);
-    };
+shutdown_config get_shutdown_config(const nlohmann::json& json)
+{
+    shutdown_config result;
+    result.http_timeout = std::chrono::milliseconds(json.value("http_ms", result.http_timeout.count()));
+    result.quit_timeout = std::chrono::milliseconds(json.value("quit_ms", result.quit_timeout.count()));
+    result.message = json.value("message", result.message);
+    return result;
+}
 
-    const auto is_mode_message = [irc_nick] (std::string_view msg) {
-        static const std::string modeline = fmt::format("MODE {}", irc_nick);
-        return msg.find(modeline) != std::string_view::npos;
-    };
+struct transport_config
+{
+    bool tls = true;
+    std::string port = "6667";
+    socket_options socket;
+    // limits the messages waiting to be written
+    queue_limits queue{ 256, overflow_policy::drop_oldest };
+};
 
-    std::function<void()> join_channel = [&] {
-        static constexpr std::string_view join_msg = "C++ is a \x02great\x02 language";
-        std::string msg = fmt::format("JOIN {}\r\n", irc_channel);
-        msg += fmt::format("PRIVMSG {} :{}\r\n", irc_channel, join_msg);
-        irc.write(msg);
-    };
+transport_config get_transport_config(const nlohmann::json& network)
+{
+    transport_config result;
+    result.tls = network.value("tls", result.tls);
+    if (network.contains("port")) {
+        const auto& port = network.at("port");
+        result.port = port.is_string() ? port.get<std::string>() : std::to_string(port.get<unsigned>());
+    }
 
-    const auto is_privmsg = [] (std::string_view msg) {
-        auto space = msg.find(" ");
-        if (space == std::string_view::npos)
-            return false;
-        auto privmsg = msg.find("PRIVMSG", space + 1);
-        return privmsg != std::string_view::npos;
-    };
+    if (network.contains("socket")) {
+        const auto& json = network.at("socket");
+        auto& options = result.socket;
+        options.no_delay = json.value("no_delay", options.no_delay);
+        options.receive_buffer_size = json.value("receive_buffer", options.receive_buffer_size);
+        options.send_buffer_size = json.value("send_buffer", options.send_buffer_size);
+        if (json.contains("keepalive")) {
+            const auto& keepalive_json = json.at("keepalive");
+            keepalive_settings keepalive;
+            keepalive.idle = std::chrono::seconds(keepalive_json.value("idle", keepalive.idle.count()));
+            keepalive.interval = std::chrono::seconds(keepalive_json.value("interval", keepalive.interval.count()));
+            keepalive.count = keepalive_json.value("count", keepalive.count);
+            options.keepalive = keepalive;
+        }
+    }
 
-    const auto is_hello = [] (std::string_view msg) {
-        auto space = msg.find(" ");
-        if (space == std::string_view::npos)
-            return false;
-        auto text = msg.find(":", space + 1);
-        if (text == std::string_view::npos)
-            return false;
-        msg.remove_prefix(text);
-        return msg.find(":.hello") == 0;
-    };
+    if (network.contains("queue")) {
+        result.queue = get_queue_limits(network.at("queue"));
+    }
 
-    const auto get_nick = [] (std::string_view msg) -> std::optional<std::string_view> {
-        auto exclamation = msg.find("!");
-        if (exclamation == std::string_view::npos)
-            return std::nullopt;
-        msg.remove_suffix(msg.size() - exclamation);
-        msg.remove_prefix(1);
-        return msg;
-    };
+    return result;
+}
 
-    irc.on_read([&] (std::string_view msg) {
-        fmt::print("< {}\n", msg);
-        if (is_ping_message(msg)) {
-            irc.write(make_pong(msg));
+struct network_entry
+{
+    network_config bot;
+    transport_config transport;
+};
+
+// Either a list of networks under "networks", or a single one under "irc"
+std::vector<network_entry> get_networks(const nlohmann::json& config)
+{
+    std::vector<network_entry> networks;
+
+    try {
+        if (config.contains("networks")) {
+            for (const auto& network : config.at("networks")) {
+                networks.push_back({ get_network_config(network), get_transport_config(network) });
+            }
+        } else {
+            const auto& network = config.at("irc");
+            networks.push_back({ get_network_config(network), get_transport_config(network) });
         }
+    } catch (const nlohmann::json::exception& e) {
+        fmt::print("Invalid network config: {}\n", e.what());
+        exit(1);
+    }
 
-        if (is_mode_message(msg) && join_channel) {
-            join_channel();
-            join_channel = nullptr;
+    if (networks.empty()) {
+        fmt::print("No networks configured\n");
+        exit(1);
+    }
+
+    return networks;
+}
+
+using strand = boost::asio::strand<boost::asio::io_context::executor_type>;
+using plain_stream = boost::asio::ip::tcp::socket;
+using ssl_stream = boost::asio::ssl::stream<boost::asio::ip::tcp::socket>;
+
+// One connection to one network. The connection reconnects by itself after
+// errors, so a failing network does not affect the others. All of the
+// connection's handlers run on its own strand, and it is the handler of its
+// net_stream so that lines go to the bot without an indirect call.
+template <typename Stream>
+struct irc_connection
+{
+    using irc_stream = net_stream<
+        strand,
+        Stream,
+        boost::asio::ip::tcp::resolver,
+        TimerEngine,
+        irc_connection>;
+
+    irc_connection(
+        boost::asio::io_context& io_context,
+        boost::asio::ssl::context& ssl_context,
+        TimerEngine& timer_engine,
+        bot_shared<CurlEngine>& shared,
+        metrics_registry& metrics,
+        tracer& tracer,
+        network_entry network)
+        : executor(boost::asio::make_strand(io_context))
+        , ssl_context(ssl_context)
+        , resolver(executor)
+        , snapshot_timer(executor)
+        , irc(executor, resolver, make_stream(), timer_engine, *this)
+        , bot(irc, shared, std::move(network.bot))
+        , transport(std::move(network.transport))
+    {
+        reconnect_policy policy;
+        // the bot sends the backlog once it has rejoined its channels
+        policy.hold_backlog = true;
+        irc.enable_reconnect(policy, [this] () -> Stream& { return make_stream(); });
+        irc.set_socket_options(transport.socket);
+        irc.set_queue_limits(transport.queue);
+
+        const std::string labels = fmt::format("network=\"{}\"", bot.config().name);
+        irc.set_metrics({
+            &metrics.add_counter("irc_lines_read_total", "Lines read from the server", labels),
+            &metrics.add_counter("irc_bytes_in_total", "Bytes read from the server", labels),
+            &metrics.add_counter("irc_bytes_out_total", "Bytes written to the server", labels),
+            &metrics.add_gauge("irc_write_queue_depth", "Messages waiting to be written", labels),
+        });
+        irc.set_tracer(&tracer);
+        handler_time = &metrics.add_histogram("irc_handler_seconds", "Time the bot takes to handle a line", labels);
+        irc.on_overload([this] (bool overloaded) {
+            fmt::print("[{}] write queue {}\n", bot.config().name, overloaded ? "overloaded" : "drained");
+            bot.set_overloaded(overloaded);
+        });
+        irc.on_rejected([this] (std::string_view message) {
+            fmt::print("[{}] write queue full, rejected: {}", bot.config().name, message);
+        });
+    }
+
+    void on_connected() { bot.on_connected(); }
+    void on_read(std::string_view line)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        bot.on_read(line);
+        handler_time->observe(std::chrono::steady_clock::now() - start);
+    }
+    void on_error(boost::system::error_code ec)
+    {
+        fmt::print("[{}] connection error: {}\n", bot.config().name, ec.message());
+    }
+
+    void start()
+    {
+        irc.connect(bot.config().server, transport.port);
+    }
+
+    // The network logs to a directory of its own under options.directory
+    void enable_log(channel_log_options options)
+    {
+        options.directory += "/" + bot.config().name;
+        try {
+            log.emplace(std::move(options));
+        } catch (const std::system_error& e) {
+            fmt::print("Failed to open the channel log: {}\n", e.what());
+            exit(1);
         }
+        bot.set_log(&*log);
+    }
 
-        if (is_privmsg(msg) && is_hello(msg)) {
-            if (auto nick = get_nick(msg)) {
-                irc.write(fmt::format("PRIVMSG {} :hi {}\r\n", irc_channel, *nick));
-            }
+    // Loads the network's seen table, and saves a copy of it on disk every
+    // snapshot_interval
+    void enable_seen(const seen_config& config, boost::asio::thread_pool& disk)
+    {
+        seen_path = config.directory + "/" + bot.config().name;
+        seen.emplace(config.capacity);
+        snapshot.emplace(config.capacity);
+        try {
+            std::filesystem::create_directories(config.directory);
+            seen->load(seen_path);
+        } catch (const std::exception& e) {
+            fmt::print("Failed to load the seen table: {}\n", e.what());
+            exit(1);
         }
+        bot.set_seen(&*seen);
+
+        boost::asio::dispatch(executor, [this, interval = config.snapshot_interval, &disk] {
+            snapshot_seen(interval, disk);
+        });
+    }
 
-        if (is_privmsg(msg)) {
-            if (auto youtube_ids = find_youtube_ids(msg); !youtube_ids.empty()) {
-                std::for_each(
-                    std::begin(youtube_ids), std::end(youtube_ids),
-                    [&] (const auto id) {
-                        std::string url = fmt::format(
-                            R"(https://www.googleapis.com/youtube/v3/videos?id={}&part=snippet,contentDetails&key={})",
-                            id,
-                            youtube_key
-                        );
-
-                        request_data request;
-                        request.url = url;
-                        request.callback = [&] (std::string title) {
-                            irc.write(fmt::format("PRIVMSG {} :{}\r\n", irc_channel, title));
-                        };
-
-                        http_engine.execute(std::move(request));
+    // Copies the table on the strand, which doesn't allocate, and writes the
+    // copy on a disk thread. A snapshot is skipped while the last one is
+    // still being written.
+    void snapshot_seen(std::chrono::seconds interval, boost::asio::thread_pool& disk)
+    {
+        snapshot_timer.expires_after(interval);
+        snapshot_timer.async_wait([this, interval, &disk] (const boost::system::error_code& ec) {
+            if (ec)
+                return;
+            if (!saving.exchange(true)) {
+                *snapshot = *seen;
+                boost::asio::post(disk, [this] {
+                    try {
+                        snapshot->save(seen_path);
+                    } catch (const std::system_error& e) {
+                        fmt::print("[{}] failed to save the seen table: {}\n", bot.config().name, e.what());
                     }
-                );
+                    saving = false;
+                });
             }
+            snapshot_seen(interval, disk);
+        });
+    }
+
+    // Call once the io_context and the disk threads are stopped
+    void save_seen()
+    {
+        if (!seen)
+            return;
+        try {
+            seen->save(seen_path);
+        } catch (const std::system_error& e) {
+            fmt::print("[{}] failed to save the seen table: {}\n", bot.config().name, e.what());
+        }
+    }
+
+    // Sends QUIT and closes the connection, see net_stream::close. closed
+    // is called on the connection's strand.
+    void quit(std::string message, std::chrono::milliseconds timeout, std::function<void ()> closed)
+    {
+        boost::asio::dispatch(executor, [this, message = std::move(message), timeout, closed = std::move(closed)] () mutable {
+            bot.quit(message);
+            irc.close(timeout, std::move(closed));
+        });
+    }
+
+    Stream& make_stream()
+    {
+        if constexpr (is_tls_stream<Stream>::value) {
+            return stream.emplace(executor, ssl_context);
+        } else {
+            return stream.emplace(executor);
+        }
+    }
+
+    strand executor;
+    boost::asio::ssl::context& ssl_context;
+    boost::asio::ip::tcp::resolver resolver;
+    // replaced on reconnect, an ssl::stream can't be used again once closed
+    std::optional<Stream> stream;
+    std::optional<seen_table> seen;
+    // what the disk thread writes
+    std::optional<seen_table> snapshot;
+    std::string seen_path;
+    std::atomic<bool> saving{ false };
+    boost::asio::steady_timer snapshot_timer;
+    irc_stream irc;
+    irc_bot<irc_stream, CurlEngine> bot;
+    // after the bot, so that the writer is stopped before the bot its
+    // searches answer to is gone
+    std::optional<channel_log> log;
+    transport_config transport;
+    histogram* handler_time = nullptr;
+};
+
+// Serves the metrics on the Unix socket at "unix", or on the loopback
+// interface at "port"
+struct metrics_endpoint
+{
+    std::optional<metrics_server<boost::asio::local::stream_protocol>> local;
+    std::optional<metrics_server<boost::asio::ip::tcp>> tcp;
+
+    metrics_endpoint(boost::asio::io_context& io_context, const nlohmann::json& config, const metrics_registry& registry)
+    {
+        try {
+            if (config.contains("unix")) {
+                const std::string path = config.at("unix");
+                // left behind by an earlier run
+                std::remove(path.c_str());
+                local.emplace(io_context.get_executor(), boost::asio::local::stream_protocol::endpoint(path), registry);
+                local->start();
+            }
+            if (config.contains("port")) {
+                const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), config.at("port").get<unsigned short>());
+                tcp.emplace(io_context.get_executor(), endpoint, registry);
+                tcp->start();
+            }
+        } catch (const std::exception& e) {
+            fmt::print("Failed to serve metrics: {}\n", e.what());
+            exit(1);
+        }
+    }
+};
+
+// Shuts down on the first SIGINT or SIGTERM, within the two timeouts:
+// lookups are no longer made and the HTTP requests being made get
+// http_timeout to finish, so that their replies are queued. Then every
+// network is sent QUIT after what is queued for it, and the server gets
+// quit_timeout to close the connection. Once all are closed the io_context
+// is stopped. A second signal stops it at once.
+class graceful_shutdown
+{
+public:
+    using quit_function = std::function<void (std::function<void ()> closed)>;
+
+    graceful_shutdown(boost::asio::io_context& io_context, CurlEngine& http, shutdown_config config)
+        : io_context_(io_context)
+        , strand_(boost::asio::make_strand(io_context))
+        , signals_(strand_, SIGINT, SIGTERM)
+        , timer_(strand_)
+        , http_(http)
+        , config_(std::move(config))
+    {
+    }
+
+    // Connection is an irc_connection
+    template <typename Connection>
+    void add_network(Connection& connection)
+    {
+        networks_.push_back([this, &connection] (std::function<void ()> closed) {
+            connection.quit(config_.message, config_.quit_timeout, std::move(closed));
+        });
+    }
+
+    void start()
+    {
+        signals_.async_wait([this] (const boost::system::error_code& ec, int signal) {
+            if (ec)
+                return;
+            fmt::print("Caught signal {}, shutting down\n", signal);
+            signals_.async_wait([this] (const boost::system::error_code& ec, int) {
+                if (ec)
+                    return;
+                fmt::print("Caught another signal, stopping now\n");
+                io_context_.stop();
+            });
+            flush_http();
+        });
+    }
+
+private:
+    // drained comes after the title callbacks have posted their replies to
+    // the connections' strands, where the QUITs are queued behind them
+    void flush_http()
+    {
+        http_.close([this] {
+            boost::asio::post(strand_, [this] { quit_networks(); });
+        });
+        timer_.expires_after(config_.http_timeout);
+        timer_.async_wait([this] (const boost::system::error_code& ec) {
+            if (ec)
+                return;
+            fmt::print("HTTP requests didn't finish in time\n");
+            quit_networks();
+        });
+    }
+
+    void quit_networks()
+    {
+        if (quitting_)
+            return;
+        quitting_ = true;
+        // aborts the requests that didn't finish in time
+        http_.stop();
+
+        if (networks_.empty()) {
+            io_context_.stop();
+            return;
+        }
+
+        open_ = networks_.size();
+        for (const auto& quit : networks_) {
+            quit([this] {
+                if (--open_ == 0) {
+                    fmt::print("All networks closed\n");
+                    io_context_.stop();
+                }
+            });
         }
+
+        // the connections time out by themselves, this is in case one doesn't
+        timer_.expires_after(config_.quit_timeout + 1s);
+        timer_.async_wait([this] (const boost::system::error_code& ec) {
+            if (ec)
+                return;
+            fmt::print("Networks didn't close in time\n");
+            io_context_.stop();
+        });
+    }
+
+    boost::asio::io_context& io_context_;
+    strand strand_;
+    boost::asio::signal_set signals_;
+    boost::asio::steady_timer timer_;
+    CurlEngine& http_;
+    const shutdown_config config_;
+    std::vector<quit_function> networks_;
+    bool quitting_ = false;
+    // networks not yet closed, counted down on their strands
+    std::atomic<std::size_t> open_{ 0 };
+};
+
+int main(int, const char*[])
+{
+    const auto config = get_config();
+
+    const auto networks = get_networks(config);
+    const std::string youtube_key = config.at("apis").at("youtube").at("key");
+    const std::string youtube_api = config.at("apis").at("youtube").value("url", "https://www.googleapis.com/youtube/v3");
+    // threads making HTTP requests, each one request at a time
+    const unsigned http_threads = std::max(1u, config.value("http_threads", 1u));
+    const unsigned io_threads = std::max(1u, config.value("threads", 1u));
+    // TODO: better error handling above...
+
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    boost::asio::io_context io_context(io_threads);
+    boost::asio::ssl::context ssl_context(boost::asio::ssl::context_base::sslv23);
+
+    metrics_registry metrics;
+    // destroyed before metrics, which owns its counters
+    std::optional<alloc_metrics> alloc_counting;
+    if (alloc_accounting_enabled()) {
+        alloc_counting.emplace(metrics);
+    }
+
+    // lines are traced until their reply is written, slow ones are
+    // sampled to "samples"
+    tracer_options trace_options;
+    if (config.contains("trace")) {
+        const auto& json = config.at("trace");
+        trace_options.slow = std::chrono::milliseconds(json.value("slow_ms", trace_options.slow.count()));
+        trace_options.sample_path = json.value("samples", trace_options.sample_path);
+        trace_options.samples_per_second = json.value("samples_per_second", trace_options.samples_per_second);
+    }
+    tracer traces(metrics, trace_options);
+    // file writes that should stay off the io threads: seen snapshots and
+    // trace samples
+    boost::asio::thread_pool disk(1);
+    traces.write_samples_with([&disk] (std::function<void ()> write) {
+        boost::asio::post(disk, std::move(write));
     });
 
-    fmt::print("Starting executor\n");
+    TimerEngine timer_engine(io_context);
+    queue_limits http_limits{ 64, overflow_policy::reject };
+    if (config.contains("http_queue")) {
+        http_limits = get_queue_limits(config.at("http_queue"));
+    }
+    CurlEngine http_engine(io_context, http_limits);
+    http_engine.on_overload([] (bool overloaded) {
+        fmt::print("http queue {}\n", overloaded ? "overloaded, skipping uncached lookups" : "drained");
+    });
+    http_engine.on_rejected([] (std::string url) {
+        fmt::print("http queue full, rejected: {}\n", url);
+    });
+    http_engine.set_metrics({
+        &metrics.add_gauge("http_queue_depth", "HTTP requests waiting to be made"),
+        &metrics.add_histogram("http_request_seconds", "Time taken by HTTP requests"),
+        &metrics.add_counter("http_failures_total", "HTTP requests that failed"),
+    });
+    http_engine.set_tracer(&traces);
+    std::vector<std::thread> http_pool;
+    for (unsigned i = 0; i < http_threads; ++i) {
+        http_pool.emplace_back([&] { http_engine.run(); });
+    }
+
+    title_cache titles(1024, 6h);
+    bot_shared<CurlEngine> shared{
+        http_engine,
+        titles,
+        youtube_key,
+        &metrics.add_counter("title_cache_hits_total", "Title lookups answered from the cache"),
+        &metrics.add_counter("title_cache_misses_total", "Title lookups that needed an HTTP request"),
+        youtube_api,
+    };
+
+    std::list<irc_connection<ssl_stream>> tls_connections;
+    std::list<irc_connection<plain_stream>> plain_connections;
+    // channel history, see channel_log.hpp
+    std::optional<channel_log_options> log_options;
+    if (config.contains("channel_log")) {
+        log_options = get_channel_log_options(config.at("channel_log"));
+    }
+    // last seen nicks, see seen_table.hpp
+    std::optional<seen_config> seen_options;
+    if (config.contains("seen")) {
+        seen_options = get_seen_config(config.at("seen"));
+    }
+    const auto start = [&] (auto& connection) {
+        if (log_options) {
+            connection.enable_log(*log_options);
+        }
+        if (seen_options) {
+            connection.enable_seen(*seen_options, disk);
+        }
+        connection.start();
+    };
+    for (const auto& network : networks) {
+        if (network.transport.tls) {
+            start(tls_connections.emplace_back(io_context, ssl_context, timer_engine, shared, metrics, traces, network));
+        } else {
+            start(plain_connections.emplace_back(io_context, ssl_context, timer_engine, shared, metrics, traces, network));
+        }
+    }
+
+    // metrics are all registered by now
+    std::optional<metrics_endpoint> scrape;
+    if (config.contains("metrics")) {
+        scrape.emplace(io_context, config.at("metrics"), metrics);
+    }
+
+    graceful_shutdown shutdown(io_context, http_engine, get_shutdown_config(config.value("shutdown", nlohmann::json::object())));
+    for (auto& connection : tls_connections) {
+        shutdown.add_network(connection);
+    }
+    for (auto& connection : plain_connections) {
+        shutdown.add_network(connection);
+    }
+    shutdown.start();
+
+    fmt::print("Starting executor on {} thread(s)\n", io_threads);
+    std::vector<std::thread> io_pool;
+    for (unsigned i = 1; i < io_threads; ++i) {
+        io_pool.emplace_back([&] { io_context.run(); });
+    }
     io_context.run();
+    for (auto& io_thread : io_pool) {
+        io_thread.join();
+    }
     fmt::print("Executor stopped\n");
 
+    // trace samples from HTTP requests still finishing after this are dropped
+    disk.join();
+    for (auto& connection : tls_connections) {
+        connection.save_seen();
+    }
+    for (auto& connection : plain_connections) {
+        connection.save_seen();
+    }
+
     http_engine.stop();
-    thread.join();
+    for (auto& http_thread : http_pool) {
+        http_thread.join();
+    }
 
     curl_global_cleanup();
 
@@ -0,0 +1,104 @@
+#ifndef MESSAGE_QUEUE_HPP
+#define MESSAGE_QUEUE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// FIFO of outgoing messages in a ring of strings. Popped strings keep their
+// capacity and are reused by later pushes, so once the queue has seen its
+// working size and message lengths, pushing no longer allocates.
+//
+// The ring holds its strings by pointer, so growing it or erasing behind a
+// message doesn't move that message's characters: front().data() can be
+// handed to an async write and stays valid until pop().
+//
+// Each message can carry a tag for the owner, like the trace it belongs to.
+class message_queue
+{
+public:
+    using tag_type = std::uint32_t;
+
+    void push(std::string_view message, tag_type tag = 0)
+    {
+        if (size_ == ring_.size())
+            grow();
+        entry& e = *ring_[(head_ + size_) % ring_.size()];
+        e.text.assign(message);
+        e.tag = tag;
+        ++size_;
+    }
+
+    std::string& front() { return ring_[head_]->text; }
+    tag_type front_tag() const { return ring_[head_]->tag; }
+    const std::string& operator[](std::size_t i) const { return ring_[(head_ + i) % ring_.size()]->text; }
+    tag_type tag(std::size_t i) const { return ring_[(head_ + i) % ring_.size()]->tag; }
+
+    // Whether message is queued at position from or later
+    bool contains(std::string_view message, std::size_t from = 0) const
+    {
+        for (std::size_t i = from; i < size_; ++i) {
+            if ((*this)[i] == message)
+                return true;
+        }
+        return false;
+    }
+
+    // Removes the message at position i. The strings behind it move up,
+    // and the removed one goes to the back to be reused. Strings in front
+    // of i are untouched.
+    void erase(std::size_t i)
+    {
+        for (; i + 1 < size_; ++i) {
+            std::swap(at(i), at(i + 1));
+        }
+        --size_;
+    }
+
+    void pop()
+    {
+        head_ = (head_ + 1) % ring_.size();
+        --size_;
+    }
+
+    void clear()
+    {
+        head_ = 0;
+        size_ = 0;
+    }
+
+    bool empty() const { return size_ == 0; }
+    std::size_t size() const { return size_; }
+
+private:
+    struct entry
+    {
+        std::string text;
+        tag_type tag = 0;
+    };
+
+    std::unique_ptr<entry>& at(std::size_t i) { return ring_[(head_ + i) % ring_.size()]; }
+
+    // Moves the pointers to a bigger ring, the entries stay where they are
+    void grow()
+    {
+        std::vector<std::unique_ptr<entry>> ring(ring_.empty() ? 8 : ring_.size() * 2);
+        for (std::size_t i = 0; i < ring_.size(); ++i) {
+            ring[i] = std::move(at(i));
+        }
+        for (std::size_t i = ring_.size(); i < ring.size(); ++i) {
+            ring[i] = std::make_unique<entry>();
+        }
+        ring_ = std::move(ring);
+        head_ = 0;
+    }
+
+    std::vector<std::unique_ptr<entry>> ring_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+};
+
+#endif
@@ -0,0 +1,256 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace metrics_detail {
+
+// Counters and histograms are split in shards, each thread updates its own,
+// so threads don't fight over cache lines. Reads add the shards up.
+inline constexpr std::size_t shards = 16;
+
+inline std::size_t thread_shard()
+{
+    static std::atomic<std::size_t> next{ 0 };
+    thread_local const std::size_t shard = next.fetch_add(1, std::memory_order_relaxed) % shards;
+    return shard;
+}
+
+struct alignas(64) counter_shard
+{
+    std::atomic<std::uint64_t> value{ 0 };
+};
+
+}
+
+// Monotonic count of events
+class counter
+{
+public:
+    void add(std::uint64_t n = 1)
+    {
+        shards_[metrics_detail::thread_shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    std::uint64_t value() const
+    {
+        std::uint64_t total = 0;
+        for (const auto& shard : shards_) {
+            total += shard.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    std::array<metrics_detail::counter_shard, metrics_detail::shards> shards_;
+};
+
+// A value that goes up and down, like a queue depth. Usually set by the one
+// thread that owns the measured thing, so it isn't sharded.
+class gauge
+{
+public:
+    void set(std::int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    void add(std::int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+    std::int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<std::int64_t> value_{ 0 };
+};
+
+// Distribution of durations in buckets that double in width: bucket 0 is
+// everything below about a microsecond (2^10 ns), bucket i up to 2^(i+10) ns,
+// and the last one everything from about 34 seconds. Observing is a
+// couple of relaxed increments on the thread's shard.
+class histogram
+{
+public:
+    static constexpr std::size_t buckets = 27;
+    static constexpr unsigned first_bucket_bits = 10;
+
+    static std::size_t bucket_of(std::uint64_t nanoseconds)
+    {
+        const unsigned width = std::bit_width(nanoseconds);
+        const std::size_t bucket = width > first_bucket_bits ? width - first_bucket_bits : 0;
+        return bucket < buckets ? bucket : buckets - 1;
+    }
+
+    // Upper bound of a bucket in nanoseconds, the last one has none
+    static std::uint64_t upper_bound(std::size_t bucket)
+    {
+        return std::uint64_t(1) << (bucket + first_bucket_bits);
+    }
+
+    void observe(std::chrono::nanoseconds duration)
+    {
+        const std::uint64_t ns = duration.count() > 0 ? duration.count() : 0;
+        auto& shard = shards_[metrics_detail::thread_shard()];
+        shard.counts[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    struct snapshot
+    {
+        std::array<std::uint64_t, buckets> counts{};
+        std::uint64_t count = 0;
+        std::uint64_t sum_ns = 0;
+    };
+
+    snapshot read() const
+    {
+        snapshot result;
+        for (const auto& shard : shards_) {
+            for (std::size_t i = 0; i < buckets; ++i) {
+                const auto n = shard.counts[i].load(std::memory_order_relaxed);
+                result.counts[i] += n;
+                result.count += n;
+            }
+            result.sum_ns += shard.sum.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+private:
+    struct alignas(64) shard_type
+    {
+        std::array<std::atomic<std::uint64_t>, buckets> counts{};
+        std::atomic<std::uint64_t> sum{ 0 };
+    };
+
+    std::array<shard_type, metrics_detail::shards> shards_;
+};
+
+// Owns the metrics of the program and writes them in the Prometheus text
+// format. Metrics are registered at startup, before the registry is
+// exposed; the returned references stay valid for the registry's lifetime.
+// Metrics of one name can be registered several times with different
+// labels, given as they appear between the braces: network="libera".
+class metrics_registry
+{
+public:
+    counter& add_counter(std::string_view name, std::string_view help, std::string_view labels = {})
+    {
+        add_entry(kind::counter, name, help, labels, counters_.size());
+        return counters_.emplace_back();
+    }
+
+    gauge& add_gauge(std::string_view name, std::string_view help, std::string_view labels = {})
+    {
+        add_entry(kind::gauge, name, help, labels, gauges_.size());
+        return gauges_.emplace_back();
+    }
+
+    // Durations are exposed in seconds
+    histogram& add_histogram(std::string_view name, std::string_view help, std::string_view labels = {})
+    {
+        add_entry(kind::histogram, name, help, labels, histograms_.size());
+        return histograms_.emplace_back();
+    }
+
+    // Appends the exposition of all metrics to out
+    void expose(std::string& out) const
+    {
+        for (const auto& family : families_) {
+            out += fmt::format("# HELP {} {}\n# TYPE {} {}\n", family.name, family.help, family.name, type_name(family.type));
+            for (const auto& series : family.series) {
+                expose(out, family, series);
+            }
+        }
+    }
+
+    std::string expose() const
+    {
+        std::string out;
+        expose(out);
+        return out;
+    }
+
+private:
+    enum class kind { counter, gauge, histogram };
+
+    struct series_entry
+    {
+        std::string labels;
+        std::size_t index;
+    };
+
+    struct family_entry
+    {
+        std::string name;
+        std::string help;
+        kind type;
+        std::vector<series_entry> series;
+    };
+
+    static std::string_view type_name(kind type)
+    {
+        switch (type) {
+        case kind::counter: return "counter";
+        case kind::gauge: return "gauge";
+        case kind::histogram: return "histogram";
+        }
+        return "untyped";
+    }
+
+    void add_entry(kind type, std::string_view name, std::string_view help, std::string_view labels, std::size_t index)
+    {
+        for (auto& family : families_) {
+            if (family.name == name) {
+                family.series.push_back({ std::string(labels), index });
+                return;
+            }
+        }
+        families_.push_back({ std::string(name), std::string(help), type, { { std::string(labels), index } } });
+    }
+
+    void expose(std::string& out, const family_entry& family, const series_entry& series) const
+    {
+        const std::string_view labels = series.labels;
+        const auto braced = [&] (std::string_view extra = {}) {
+            if (labels.empty() && extra.empty())
+                return std::string();
+            if (labels.empty() || extra.empty())
+                return fmt::format("{{{}{}}}", labels, extra);
+            return fmt::format("{{{},{}}}", labels, extra);
+        };
+
+        switch (family.type) {
+        case kind::counter:
+            out += fmt::format("{}{} {}\n", family.name, braced(), counters_[series.index].value());
+            break;
+        case kind::gauge:
+            out += fmt::format("{}{} {}\n", family.name, braced(), gauges_[series.index].value());
+            break;
+        case kind::histogram: {
+            const auto snapshot = histograms_[series.index].read();
+            std::uint64_t cumulative = 0;
+            for (std::size_t i = 0; i + 1 < histogram::buckets; ++i) {
+                cumulative += snapshot.counts[i];
+                const double le = histogram::upper_bound(i) / 1e9;
+                out += fmt::format("{}_bucket{} {}\n", family.name, braced(fmt::format("le=\"{}\"", le)), cumulative);
+            }
+            out += fmt::format("{}_bucket{} {}\n", family.name, braced("le=\"+Inf\""), snapshot.count);
+            out += fmt::format("{}_sum{} {}\n", family.name, braced(), snapshot.sum_ns / 1e9);
+            out += fmt::format("{}_count{} {}\n", family.name, braced(), snapshot.count);
+            break;
+        }
+        }
+    }
+
+    std::vector<family_entry> families_;
+    std::deque<counter> counters_;
+    std::deque<gauge> gauges_;
+    std::deque<histogram> histograms_;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef METRICS_SERVER_HPP
+#define METRICS_SERVER_HPP
+
+#include "metrics.hpp"
+
+#include <utility> // before asio, its awaitable.hpp uses std::exchange
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+// Serves a metrics_registry to Prometheus over HTTP on a stream socket,
+// normally a Unix socket or a loopback TCP port. Every request gets the
+// metrics, whatever its path, and the connection is closed after the
+// response, or after a few seconds without a complete request. Runs on the
+// executor it is given, each connection on a strand of its own.
+template <typename Protocol>
+class metrics_server
+{
+public:
+    using endpoint_type = typename Protocol::endpoint;
+    using acceptor_type = typename Protocol::acceptor;
+    using socket_type = typename Protocol::socket;
+
+    template <typename Executor>
+    metrics_server(const Executor& executor, const endpoint_type& endpoint, const metrics_registry& registry)
+        : acceptor_(executor, endpoint)
+        , registry_(registry)
+    {
+    }
+
+    // How long a client gets to send its request before it is disconnected
+    void set_request_timeout(std::chrono::steady_clock::duration timeout)
+    {
+        request_timeout_ = timeout;
+    }
+
+    void start()
+    {
+        acceptor_.async_accept(boost::asio::make_strand(acceptor_.get_executor()), [this] (boost::system::error_code ec, socket_type socket) {
+            if (ec == boost::asio::error::operation_aborted)
+                return;
+            if (!ec) {
+                std::make_shared<session>(std::move(socket), registry_)->start(request_timeout_);
+            }
+            start();
+        });
+    }
+
+    void stop()
+    {
+        boost::system::error_code ignored;
+        acceptor_.close(ignored);
+    }
+
+    endpoint_type local_endpoint() const { return acceptor_.local_endpoint(); }
+
+private:
+    struct session : std::enable_shared_from_this<session>
+    {
+        // requests are only read to their end, nothing in them is used
+        static constexpr std::size_t max_request = 8192;
+
+        session(socket_type socket, const metrics_registry& registry)
+            : socket(std::move(socket))
+            , deadline(this->socket.get_executor())
+            , request(max_request)
+            , registry(registry)
+        {}
+
+        void start(std::chrono::steady_clock::duration timeout)
+        {
+            deadline.expires_after(timeout);
+            deadline.async_wait([self = this->shared_from_this()] (boost::system::error_code ec) {
+                if (ec)
+                    return;
+                // fails the read below
+                boost::system::error_code ignored;
+                self->socket.close(ignored);
+            });
+
+            boost::asio::async_read_until(socket, request, "\r\n\r\n",
+                [self = this->shared_from_this()] (boost::system::error_code ec, std::size_t) {
+                    self->deadline.cancel();
+                    if (!ec)
+                        self->respond();
+                }
+            );
+        }
+
+        void respond()
+        {
+            std::string body;
+            registry.expose(body);
+            response = fmt::format(
+                "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: {}\r\n"
+                "Connection: close\r\n"
+                "\r\n",
+                body.size()
+            );
+            response += body;
+
+            boost::asio::async_write(socket, boost::asio::buffer(response),
+                [self = this->shared_from_this()] (boost::system::error_code, std::size_t) {
+                    boost::system::error_code ignored;
+                    self->socket.shutdown(socket_type::shutdown_both, ignored);
+                }
+            );
+        }
+
+        socket_type socket;
+        boost::asio::steady_timer deadline;
+        boost::asio::streambuf request;
+        std::string response;
+        const metrics_registry& registry;
+    };
+
+    acceptor_type acceptor_;
+    const metrics_registry& registry_;
+    std::chrono::steady_clock::duration request_timeout_ = std::chrono::seconds(5);
+};
+
+#endif
@@ -0,0 +1,272 @@
+// A stand-in for the YouTube Data API, for benchmarks and trying the bot
+// without a key:
+//
+//     mock_youtube [--port 8080] [--latency-ms 50] [--jitter-ms 0]
+//                  [--error-rate 0] [--payload-bytes 1024]
+//
+// It listens on 127.0.0.1 over plain HTTP and answers GET /videos?id=...
+// with a canned response in the shape the bot parses, titled after the id.
+// Point the bot at it with "apis": { "youtube": { "url":
+// "http://127.0.0.1:8080" } }.
+//
+// Every response is delayed by the latency plus a uniformly random part of
+// the jitter, a fraction error-rate of them are 500 Internal Server Error,
+// and the description is padded so that the body is about payload-bytes
+// long. Other paths are 404. Connections are closed after the response.
+// Every second it prints how many requests it answered.
+
+#include <utility> // before asio, its awaitable.hpp uses std::exchange
+
+#include <boost/asio.hpp>
+
+#include <fmt/format.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+
+using namespace std::chrono_literals;
+using boost::asio::ip::tcp;
+
+namespace {
+
+struct options
+{
+    unsigned short port = 8080;
+    std::chrono::milliseconds latency{ 50 };
+    std::chrono::milliseconds jitter{ 0 };
+    // fraction of requests answered with a 500
+    double error_rate = 0.0;
+    // approximate size of a response body
+    std::size_t payload_bytes = 1024;
+};
+
+options parse_options(int argc, const char* argv[])
+{
+    options opts;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (i + 1 >= argc)
+            throw std::invalid_argument(fmt::format("{} needs a value", arg));
+        const std::string value = argv[++i];
+        if (arg == "--port") opts.port = static_cast<unsigned short>(std::stoul(value));
+        else if (arg == "--latency-ms") opts.latency = std::chrono::milliseconds(std::stoul(value));
+        else if (arg == "--jitter-ms") opts.jitter = std::chrono::milliseconds(std::stoul(value));
+        else if (arg == "--error-rate") opts.error_rate = std::stod(value);
+        else if (arg == "--payload-bytes") opts.payload_bytes = std::stoul(value);
+        else throw std::invalid_argument(fmt::format("unknown option {}", arg));
+    }
+    if (opts.error_rate < 0.0 || opts.error_rate > 1.0)
+        throw std::invalid_argument("--error-rate is a fraction between 0 and 1");
+    return opts;
+}
+
+struct counts
+{
+    std::uint64_t ok = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t not_found = 0;
+};
+
+// The value of a query parameter in a request target, empty if missing
+std::string_view query_value(std::string_view target, std::string_view name)
+{
+    const auto query = target.find('?');
+    if (query == std::string_view::npos)
+        return {};
+    std::string_view rest = target.substr(query + 1);
+    while (!rest.empty()) {
+        const auto end = rest.find('&');
+        const std::string_view param = rest.substr(0, end);
+        if (param.size() > name.size() && param.starts_with(name) && param[name.size()] == '=')
+            return param.substr(name.size() + 1);
+        if (end == std::string_view::npos)
+            break;
+        rest.remove_prefix(end + 1);
+    }
+    return {};
+}
+
+std::string videos_body(std::string_view id, std::size_t payload_bytes)
+{
+    std::string body = fmt::format(
+        R"({{"kind":"youtube#videoListResponse","items":[{{"kind":"youtube#video","id":"{}",)"
+        R"("snippet":{{"title":"Mock video {}","description":"",)"
+        R"("channelTitle":"mock_youtube"}},"contentDetails":{{"duration":"PT3M33S"}}}}]}})",
+        id, id);
+    if (body.size() < payload_bytes) {
+        const auto description = body.find(R"("description":"")") + std::string_view(R"("description":")").size();
+        body.insert(description, payload_bytes - body.size(), 'x');
+    }
+    return body;
+}
+
+class http_session : public std::enable_shared_from_this<http_session>
+{
+public:
+    // requests are small GETs, anything longer is dropped
+    static constexpr std::size_t max_request = 8192;
+
+    http_session(tcp::socket socket, const options& opts, std::mt19937& random, counts& counts)
+        : socket_(std::move(socket))
+        , timer_(socket_.get_executor())
+        , request_(max_request)
+        , opts_(opts)
+        , random_(random)
+        , counts_(counts)
+    {}
+
+    void start()
+    {
+        boost::asio::async_read_until(socket_, request_, "\r\n\r\n",
+            [self = shared_from_this()] (boost::system::error_code ec, std::size_t) {
+                if (!ec)
+                    self->delay();
+            }
+        );
+    }
+
+private:
+    void delay()
+    {
+        auto latency = opts_.latency;
+        if (opts_.jitter.count() > 0) {
+            std::uniform_int_distribution<std::int64_t> jitter(0, opts_.jitter.count());
+            latency += std::chrono::milliseconds(jitter(random_));
+        }
+        timer_.expires_after(latency);
+        timer_.async_wait([self = shared_from_this()] (boost::system::error_code ec) {
+            if (!ec)
+                self->respond();
+        });
+    }
+
+    void respond()
+    {
+        // GET <target> HTTP/1.1
+        std::string request(boost::asio::buffers_begin(request_.data()), boost::asio::buffers_end(request_.data()));
+        std::string_view line = std::string_view(request).substr(0, request.find("\r\n"));
+        std::string_view target;
+        if (line.starts_with("GET ")) {
+            target = line.substr(4);
+            target = target.substr(0, target.find(' '));
+        }
+
+        std::string_view status = "200 OK";
+        std::string body;
+        if (!target.starts_with("/videos")) {
+            status = "404 Not Found";
+            body = R"({"error":{"code":404,"message":"Not Found"}})";
+            ++counts_.not_found;
+        } else if (std::bernoulli_distribution(opts_.error_rate)(random_)) {
+            status = "500 Internal Server Error";
+            body = R"({"error":{"code":500,"message":"Backend Error"}})";
+            ++counts_.errors;
+        } else {
+            body = videos_body(query_value(target, "id"), opts_.payload_bytes);
+            ++counts_.ok;
+        }
+
+        response_ = fmt::format(
+            "HTTP/1.1 {}\r\n"
+            "Content-Type: application/json; charset=UTF-8\r\n"
+            "Content-Length: {}\r\n"
+            "Connection: close\r\n"
+            "\r\n",
+            status,
+            body.size()
+        );
+        response_ += body;
+
+        boost::asio::async_write(socket_, boost::asio::buffer(response_),
+            [self = shared_from_this()] (boost::system::error_code, std::size_t) {
+                boost::system::error_code ignored;
+                self->socket_.shutdown(tcp::socket::shutdown_both, ignored);
+            }
+        );
+    }
+
+    tcp::socket socket_;
+    boost::asio::steady_timer timer_;
+    boost::asio::streambuf request_;
+    std::string response_;
+    const options& opts_;
+    std::mt19937& random_;
+    counts& counts_;
+};
+
+class mock_server
+{
+public:
+    mock_server(boost::asio::io_context& io_context, const options& opts)
+        : acceptor_(io_context, tcp::endpoint(boost::asio::ip::address_v4::loopback(), opts.port))
+        , report_timer_(io_context)
+        , opts_(opts)
+    {}
+
+    void start()
+    {
+        accept();
+        report();
+    }
+
+private:
+    void accept()
+    {
+        acceptor_.async_accept([this] (boost::system::error_code ec, tcp::socket socket) {
+            if (!ec)
+                std::make_shared<http_session>(std::move(socket), opts_, random_, counts_)->start();
+            accept();
+        });
+    }
+
+    void report()
+    {
+        report_timer_.expires_after(1s);
+        report_timer_.async_wait([this] (boost::system::error_code ec) {
+            if (ec)
+                return;
+            if (counts_.ok != reported_.ok || counts_.errors != reported_.errors || counts_.not_found != reported_.not_found) {
+                fmt::print("{} ok, {} errors, {} not found\n",
+                    counts_.ok - reported_.ok,
+                    counts_.errors - reported_.errors,
+                    counts_.not_found - reported_.not_found);
+                std::fflush(stdout);
+                reported_ = counts_;
+            }
+            report();
+        });
+    }
+
+    tcp::acceptor acceptor_;
+    boost::asio::steady_timer report_timer_;
+    const options& opts_;
+    std::mt19937 random_{ std::random_device{}() };
+    counts counts_;
+    counts reported_;
+};
+
+}
+
+int main(int argc, const char* argv[])
+{
+    options opts;
+    try {
+        opts = parse_options(argc, argv);
+    } catch (const std::exception& e) {
+        fmt::print("{}\n", e.what());
+        return 2;
+    }
+
+    boost::asio::io_context io_context(1);
+    mock_server server(io_context, opts);
+    server.start();
+    fmt::print("Serving videos on http://127.0.0.1:{}\n", opts.port);
+    std::fflush(stdout);
+
+    io_context.run();
+    return 0;
+}
@@ -1,83 +1,313 @@
 #ifndef NET_STREAM_HPP
 #define NET_STREAM_HPP
 
+#include "alloc_accounting.hpp"
+#include "backpressure.hpp"
+#include "handler_memory.hpp"
+#include "happy_eyeballs.hpp"
+#include "message_queue.hpp"
+#include "metrics.hpp"
+#include "socket_options.hpp"
+#include "trace.hpp"
+#include "tls_session.hpp"
+
 #include <boost/asio.hpp>
 
 #include <fmt/format.h> // TODO: replace with some logger stuff
 
+#include <chrono>
 #include <string_view>
 #include <list>
 #include <deque>
+#include <functional>
+#include <optional>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+template <typename Executor, typename = void>
+struct has_running_in_this_thread : std::false_type {};
+
+template <typename Executor>
+struct has_running_in_this_thread<
+    Executor,
+    std::void_t<decltype(std::declval<const Executor&>().running_in_this_thread())>
+> : std::true_type {};
+
+// Streams that need a client handshake once connected, like
+// boost::asio::ssl::stream. Other streams are plaintext.
+template <typename Stream, typename = void>
+struct is_tls_stream : std::false_type {};
+
+template <typename Stream>
+struct is_tls_stream<
+    Stream,
+    std::void_t<decltype(std::declval<Stream&>().async_handshake(
+        Stream::client, std::declval<void (*)(boost::system::error_code)>()))>
+> : std::true_type {};
+
+struct reconnect_policy
+{
+    std::chrono::milliseconds initial_delay = std::chrono::seconds(1);
+    std::chrono::milliseconds max_delay = std::chrono::minutes(5);
+    double multiplier = 2.0;
+    // every delay is shortened by a random fraction of up to this much
+    double jitter = 0.5;
+    // resolved endpoints are reused by reconnects for this long
+    std::chrono::milliseconds endpoint_ttl = std::chrono::minutes(5);
+    // keep messages written while disconnected until flush_backlog() is
+    // called, instead of sending them right after on_connected
+    bool hold_backlog = false;
+};
+
+struct net_stream_stats
+{
+    // TLS handshakes that resumed the session of the previous connection
+    std::size_t tls_resumption_hits = 0;
+    // full TLS handshakes, with or without a session to offer
+    std::size_t tls_resumption_misses = 0;
+};
+
+// Where a net_stream reports to a metrics_registry, unset ones are skipped
+struct stream_metrics
+{
+    counter* lines_read = nullptr;
+    counter* bytes_in = nullptr;
+    counter* bytes_out = nullptr;
+    // messages waiting to be written, including the backlog
+    gauge* write_queue = nullptr;
+};
+
+// The default Handler of net_stream, with callbacks set through
+// on_read(), on_connected() and on_error()
+struct function_handler
+{
+    std::function<void (std::string_view)> read;
+    std::function<void ()> connected;
+    std::function<void (boost::system::error_code)> error;
+
+    void on_read(std::string_view line) { if (read) read(line); }
+    void on_connected() { if (connected) connected(); }
+    void on_error(boost::system::error_code ec) { if (error) error(ec); }
+};
 
+// Callbacks are posted to Executor, and Stream, Resolver and the timers are
+// expected to complete on it as well. Use a strand as the Executor when the
+// io_context is run by several threads.
+//
+// Handler receives the events through on_read(std::string_view),
+// on_connected() and on_error(boost::system::error_code). Any type other
+// than function_handler is called directly, so the calls can be inlined,
+// and has to be passed to the constructor.
 template<
     typename Executor,
     typename Stream,
     typename Resolver,
-    typename TimerEngine
+    typename TimerEngine,
+    typename Handler = function_handler
 >
 class net_stream
 {
 public:
     net_stream(Executor& executor, Resolver& resolver, Stream& stream, TimerEngine& timer_engine)
+        : net_stream(executor, resolver, stream, timer_engine, callbacks_)
+    {
+        static_assert(std::is_same_v<Handler, function_handler>, "a Handler has to be passed to net_stream");
+    }
+
+    net_stream(Executor& executor, Resolver& resolver, Stream& stream, TimerEngine& timer_engine, Handler& handler)
         : executor_(executor)
         , resolver_(resolver)
-        , stream_(stream)
+        , stream_(&stream)
+        , handler_(&handler)
         , connect_timer_(timer_engine.create_timer())
+        , reconnect_timer_(timer_engine.create_timer())
+        , random_(std::random_device()())
+        , attempt_timer_(timer_engine.create_timer())
     {
     }
 
-    void connect(std::string_view address)
+    void connect(std::string_view address, std::string_view port = "6667")
     {
-        resolver_.async_resolve(
-            std::string(address),
-            "6667",
-            [this] (const boost::system::error_code & ec, boost::asio::ip::tcp::resolver::results_type results) {
-                fmt::print("resolve callback\n");
-                connect_timer_.cancel();
+        address_ = std::string(address);
+        port_ = std::string(port);
+        state_ = state::connecting;
+        resolve();
+    }
 
-                if (ec) {
-                    boost::asio::post(executor_, [this, ec] { error_callback_(ec); });
-                    return;
-                }
+    // After an error the connection is closed and reconnected with
+    // exponential backoff. make_stream is called before every reconnect and
+    // returns the stream to use, for streams that cannot be reused once
+    // closed (like ssl::stream).
+    using stream_factory = std::function<Stream& ()>;
+    void enable_reconnect(reconnect_policy policy, stream_factory&& make_stream = nullptr)
+    {
+        reconnect_ = policy;
+        make_stream_ = std::move(make_stream);
+    }
 
-                connect(results);
-            }
-        );
+    // Limits the messages waiting to be written, including the backlog.
+    // Messages coalesce with equal ones that aren't being written yet.
+    void set_queue_limits(queue_limits limits)
+    {
+        queue_guard_ = queue_guard(limits);
+    }
 
-        using namespace std::chrono_literals;
-        set_timeout(10s);
+    // Called on the executor when the write queue fills up, and again once
+    // it has drained to half its capacity
+    using overload_callback = std::function<void (bool overloaded)>;
+    void on_overload(overload_callback&& callback)
+    {
+        on_overload_ = std::move(callback);
+    }
+
+    // Called with messages refused by a full queue with the reject policy
+    using reject_callback = std::function<void (std::string_view message)>;
+    void on_rejected(reject_callback&& callback)
+    {
+        on_rejected_ = std::move(callback);
     }
 
+    bool overloaded() const { return queue_guard_.overloaded(); }
+    const queue_counters& queue_stats() const { return queue_guard_.counters(); }
+
+    // Used for the sockets of all following connection attempts
+    void set_socket_options(const socket_options& options)
+    {
+        socket_options_ = options;
+    }
+
+    // Only with the default function_handler
     using error_callback = std::function<void (boost::system::error_code)>;
     void on_error(error_callback&& callback)
     {
-        error_callback_ = callback;
+        callbacks_.error = std::move(callback);
     }
 
     using connect_callback = std::function<void ()>;
     void on_connected(connect_callback&& callback)
     {
-        // TODO: add tests
-        on_connect_ = std::move(callback);
+        callbacks_.connected = std::move(callback);
     }
 
     using read_callback = std::function<void (std::string_view str)>;
     void on_read(read_callback&& callback)
     {
-        on_read_ = std::move(callback);
+        callbacks_.read = std::move(callback);
     }
 
+    // Safe to call from any thread when Executor is a strand; the message is
+    // then queued from within the strand. Messages written while not
+    // connected are kept in a backlog.
     void write(std::string_view message)
     {
-        const bool start_writing = message_queue_.empty();
-        message_queue_.emplace_back(std::string(message));
-        if (start_writing) {
+        alloc_scope tag(alloc_tag::irc);
+        if constexpr (has_running_in_this_thread<Executor>::value) {
+            if (!executor_.running_in_this_thread()) {
+                post([this, message = std::string(message)] { write(message); });
+                return;
+            }
+        }
+
+        if (state_ != state::connected) {
+            // nothing would ever send it once closed
+            if (!closing_)
+                enqueue(backlog_, message);
+            return;
+        }
+
+        enqueue(message_queue_, message);
+        if (!writing_ && !message_queue_.empty()) {
             do_write();
         }
     }
 
+    // Runs f on the executor with the trace that is current now, for work
+    // coming back from other threads like HTTP callbacks
+    template <typename F>
+    void post(F&& f)
+    {
+        const trace_id trace = tracer_ ? current_trace() : 0;
+        if (trace)
+            tracer_->add_ref(trace);
+        boost::asio::post(executor_, [this, f = std::forward<F>(f), trace] () mutable {
+            {
+                trace_scope scope(trace);
+                f();
+            }
+            if (trace)
+                tracer_->release(trace);
+        });
+    }
+
+    // Closes the connection for good: it isn't reconnected and the backlog
+    // is dropped. Messages already queued are still written, and the
+    // connection is closed once the server closes it, normally in answer to
+    // a QUIT written before, or when the timeout runs out. done is called
+    // on the executor once it is closed. Call on the executor.
+    template <typename Duration>
+    void close(Duration timeout, std::function<void ()> done)
+    {
+        closing_ = true;
+        on_closed_ = std::move(done);
+        reconnect_.reset();
+        reconnect_timer_.cancel();
+        if (state_ != state::connected) {
+            closed();
+            return;
+        }
+
+        connect_timer_.cancel();
+        connect_timer_.expires_after(timeout);
+        connect_timer_.async_wait(boost::asio::bind_executor(
+            executor_,
+            [this, attempt = attempt_] (const boost::system::error_code& ec) {
+                if (ec && ec == boost::asio::error::operation_aborted)
+                    return;
+                if (attempt != attempt_)
+                    return;
+                fmt::print("{} didn't close the connection in time\n", address_);
+                closed();
+            }
+        ));
+    }
+
+    // Sends the messages written while the connection was down
+    void flush_backlog()
+    {
+        if (state_ != state::connected || backlog_.empty())
+            return;
+
+        while (!backlog_.empty()) {
+            message_queue_.push(backlog_.front(), backlog_.front_tag());
+            backlog_.pop();
+        }
+        if (!writing_) {
+            do_write();
+        }
+    }
+
+    bool is_connected() const { return state_ == state::connected; }
+
+    const net_stream_stats& stats() const { return stats_; }
+
+    void set_metrics(stream_metrics metrics) { metrics_ = metrics; }
+
+    // Lines read start a trace, which is current while the handler runs.
+    // Messages written while a trace is current are part of it until they
+    // have been written.
+    void set_tracer(tracer* tracer) { tracer_ = tracer; }
+
+    // Read and write handlers that didn't fit their recycled memory
+    std::size_t handler_memory_misses() const
+    {
+        return read_memory_.misses() + write_memory_.misses();
+    }
+
     void do_write()
     {
+        writing_ = true;
+
         fmt::print("> ");
         std::for_each(
             std::begin(message_queue_.front()), std::end(message_queue_.front()),
@@ -94,43 +324,127 @@ public:
         fmt::print("\n");
 
         boost::asio::async_write(
-            stream_,
+            *stream_,
             boost::asio::buffer(
                 message_queue_.front().data(),
                 message_queue_.front().length()),
-            [this](boost::system::error_code ec, std::size_t /*length*/)
+            bind_memory(write_memory_, [this, attempt = attempt_](boost::system::error_code ec, std::size_t length)
             {
+                if (attempt != attempt_)
+                    return;
+
+                alloc_scope tag(alloc_tag::irc);
                 if (ec) {
-                    boost::asio::post( executor_, [this, ec] { error_callback_(ec); });
+                    writing_ = false;
+                    fail(ec);
                     return;
                 }
 
-                message_queue_.pop_front();
+                if (metrics_.bytes_out)
+                    metrics_.bytes_out->add(length);
+                if (const trace_id trace = message_queue_.front_tag()) {
+                    tracer_->stamp(trace, trace_stage::written);
+                    tracer_->release(trace);
+                }
+                message_queue_.pop();
+                queue_changed();
                 if (!message_queue_.empty()) {
                     do_write();
+                } else {
+                    writing_ = false;
                 }
-            }
+            })
         );
     }
 
 private:
-    void connect(boost::asio::ip::tcp::resolver::results_type results)
+    enum class state { idle, connecting, connected, waiting };
+
+    // Queues a message within the queue limits. The message being written
+    // stays at the front of message_queue_ and is never dropped.
+    void enqueue(message_queue& queue, std::string_view message)
     {
-        auto& tcp = stream_.lowest_layer();
-        boost::asio::async_connect(
-            tcp,
-            std::begin(results),
-            std::end(results),
-            [this] (boost::system::error_code ec, auto) {
-                fmt::print("Socket connected\n");
+        const std::size_t in_flight = &queue == &message_queue_ && writing_ ? 1 : 0;
+        auto outcome = queue_guard_.admit(
+            message_queue_.size() + backlog_.size(),
+            [&] { return queue.contains(message, in_flight); }
+        );
+
+        if (outcome == queue_guard::admission::drop_oldest) {
+            // the backlog holds the older messages while it isn't flushed
+            if (!backlog_.empty()) {
+                drop(backlog_, 0);
+            } else if (message_queue_.size() > (writing_ ? 1 : 0)) {
+                drop(message_queue_, writing_ ? 1 : 0);
+            } else {
+                outcome = queue_guard::admission::drop_newest;
+            }
+        }
+
+        switch (outcome) {
+        case queue_guard::admission::push:
+        case queue_guard::admission::drop_oldest: {
+            const trace_id trace = tracer_ ? current_trace() : 0;
+            if (trace) {
+                tracer_->add_ref(trace);
+                tracer_->stamp(trace, trace_stage::write_queued);
+            }
+            queue.push(message, trace);
+            break;
+        }
+        case queue_guard::admission::reject:
+            if (on_rejected_)
+                on_rejected_(message);
+            break;
+        case queue_guard::admission::drop_newest:
+        case queue_guard::admission::coalesce:
+            break;
+        }
+        queue_guard_.count(outcome);
+        queue_changed();
+    }
+
+    void drop(message_queue& queue, std::size_t i)
+    {
+        if (const trace_id trace = queue.tag(i))
+            tracer_->release(trace);
+        queue.erase(i);
+    }
+
+    void queue_changed()
+    {
+        const std::size_t depth = message_queue_.size() + backlog_.size();
+        if (metrics_.write_queue)
+            metrics_.write_queue->set(depth);
+        if (!queue_guard_.update(depth))
+            return;
+        if (on_overload_) {
+            boost::asio::post(executor_, [this, overloaded = queue_guard_.overloaded()] {
+                on_overload_(overloaded);
+            });
+        }
+    }
+
+    void resolve()
+    {
+        resolver_.async_resolve(
+            address_,
+            port_,
+            [this, attempt = attempt_] (const boost::system::error_code & ec, boost::asio::ip::tcp::resolver::results_type results) {
+                fmt::print("resolve callback\n");
+                if (attempt != attempt_)
+                    return;
+
                 connect_timer_.cancel();
 
                 if (ec) {
-                    boost::asio::post( executor_, [this, ec] { error_callback_(ec); });
+                    fail(ec);
                     return;
                 }
 
-                handshake();
+                endpoints_ = results;
+                resolved_at_ = std::chrono::steady_clock::now();
+                connect(results);
             }
         );
 
@@ -138,59 +452,206 @@ private:
         set_timeout(10s);
     }
 
-    void handshake()
+    // Races connection attempts across the resolved addresses (RFC 8305).
+    // A new attempt starts every connection_attempt_delay, or as soon as
+    // the previous one fails. The first socket to connect becomes the
+    // stream's socket and the other attempts are closed.
+    void connect(boost::asio::ip::tcp::resolver::results_type results)
     {
-        fmt::print("handshake\n");
-        stream_.async_handshake(
-            Stream::client,
-            [this] (boost::system::error_code ec) {
-                fmt::print("handshake callback\n");
-                connect_timer_.cancel();
+        stop_race();
+        race_endpoints_ = interleave_address_families(results);
+        race_next_ = 0;
+        race_pending_ = 0;
+        start_attempt();
+
+        using namespace std::chrono_literals;
+        set_timeout(10s);
+    }
+
+    void start_attempt()
+    {
+        attempt_timer_.cancel();
+        if (race_next_ == race_endpoints_.size())
+            return;
+
+        const auto endpoint = race_endpoints_[race_next_++];
+        auto& socket = race_sockets_.emplace_back(stream_->lowest_layer().get_executor());
+        ++race_pending_;
+
+        // if opening fails here, async_connect reports the error
+        boost::system::error_code ec;
+        socket.open(endpoint.protocol(), ec);
+        if (!ec) {
+            apply_socket_options(socket, socket_options_, ec);
+            if (ec)
+                fmt::print("setting socket options failed: {}\n", ec.message());
+        }
+
+        socket.async_connect(
+            endpoint,
+            [this, race = race_, socket = std::prev(std::end(race_sockets_)), endpoint] (boost::system::error_code ec) {
+                if (race != race_)
+                    return;
+
+                --race_pending_;
                 if (ec) {
-                    fmt::print("err: {}\n", ec.message());
-                    boost::asio::post(executor_, [this, ec] { error_callback_(ec); });
+                    fmt::print("connect to {} failed: {}\n", endpoint.address().to_string(), ec.message());
+                    race_error_ = ec;
+                    if (race_next_ < race_endpoints_.size()) {
+                        start_attempt();
+                    } else if (race_pending_ == 0) {
+                        connect_timer_.cancel();
+                        stop_race();
+                        // don't trust the cached addresses on the next attempt
+                        endpoints_ = {};
+                        fail(race_error_);
+                    }
                     return;
                 }
 
-                do_read();
+                fmt::print("Socket connected to {}\n", endpoint.address().to_string());
+                connect_timer_.cancel();
 
-                if (on_connect_) {
-                    executor_.post([this] { on_connect_(); });
-                }
+                auto winner = std::move(*socket);
+                stop_race();
+                stream_->lowest_layer() = std::move(winner);
 
+                handshake();
             }
         );
 
-        using namespace std::chrono_literals;
-        set_timeout(10s);
+        if (race_next_ < race_endpoints_.size()) {
+            attempt_timer_.expires_after(connection_attempt_delay);
+            attempt_timer_.async_wait(boost::asio::bind_executor(
+                executor_,
+                [this, race = race_] (const boost::system::error_code & ec) {
+                    if (ec && ec == boost::asio::error::operation_aborted)
+                        return;
+                    if (race != race_)
+                        return;
+                    start_attempt();
+                }
+            ));
+        }
+    }
+
+    // Closes the sockets of a connection race, their handlers are ignored
+    void stop_race()
+    {
+        ++race_;
+        attempt_timer_.cancel();
+        for (auto& socket : race_sockets_) {
+            boost::system::error_code ignored;
+            socket.close(ignored);
+        }
+        race_sockets_.clear();
+    }
+
+    void handshake()
+    {
+        if constexpr (is_tls_stream<Stream>::value) {
+            fmt::print("handshake\n");
+            if constexpr (has_ssl_handle<Stream>::value) {
+                tls_session_.offer(stream_->native_handle());
+            }
+
+            stream_->async_handshake(
+                Stream::client,
+                [this, attempt = attempt_] (boost::system::error_code ec) {
+                    fmt::print("handshake callback\n");
+                    if (attempt != attempt_)
+                        return;
+
+                    connect_timer_.cancel();
+                    if (ec) {
+                        fmt::print("err: {}\n", ec.message());
+                        if constexpr (has_ssl_handle<Stream>::value) {
+                            tls_session_.reset();
+                        }
+                        fail(ec);
+                        return;
+                    }
+
+                    if constexpr (has_ssl_handle<Stream>::value) {
+                        if (tls_session::reused(stream_->native_handle())) {
+                            fmt::print("TLS session resumed\n");
+                            ++stats_.tls_resumption_hits;
+                        } else {
+                            ++stats_.tls_resumption_misses;
+                        }
+                        tls_session_.save(stream_->native_handle());
+                    }
+
+                    established();
+                }
+            );
+
+            using namespace std::chrono_literals;
+            set_timeout(10s);
+        } else {
+            established();
+        }
+    }
+
+    void established()
+    {
+        state_ = state::connected;
+        failures_ = 0;
+        do_read();
+
+        boost::asio::post(executor_, [this] {
+            handler_->on_connected();
+            if (!reconnect_ || !reconnect_->hold_backlog) {
+                flush_backlog();
+            }
+        });
     }
 
     void do_read()
     {
         boost::asio::async_read_until(
-            stream_, read_buffer_, "\n",
-            [this] (boost::system::error_code ec, std::size_t transferred) {
-                (void)transferred;
+            *stream_, read_buffer_, "\n",
+            boost::asio::bind_executor(executor_, bind_memory(read_memory_, [this, attempt = attempt_] (boost::system::error_code ec, std::size_t transferred) {
+                if (attempt != attempt_)
+                    return;
 
+                alloc_scope tag(alloc_tag::irc);
                 if (ec) {
                     fmt::print("read callback, ec={} transfer={}\n", ec.message(), transferred);
-                    boost::asio::post( executor_, [this, ec] { error_callback_(ec); });
+                    fail(ec);
                     return;
                 }
 
-                std::istream is(&read_buffer_);
-                std::string str;
-                std::getline(is, str);
-
-                if (str.back() == '\r')
-                    str.pop_back();
-
-                if (!str.empty() && on_read_) {
-                    executor_.post([this, str = std::move(str)] { on_read_(str); });
+                if (metrics_.lines_read)
+                    metrics_.lines_read->add();
+                if (metrics_.bytes_in)
+                    metrics_.bytes_in->add(transferred);
+
+                // The line is passed straight out of the buffer, the handler
+                // is bound to the executor
+                std::string_view line(static_cast<const char*>(read_buffer_.data().data()), transferred - 1);
+                if (!line.empty() && line.back() == '\r')
+                    line.remove_suffix(1);
+
+                if (!line.empty()) {
+                    const trace_id trace = tracer_ ? tracer_->begin(line) : 0;
+                    {
+                        trace_scope scope(trace);
+                        alloc_scope tag(alloc_tag::bot);
+                        handler_->on_read(line);
+                    }
+                    if (trace) {
+                        tracer_->stamp(trace, trace_stage::handled);
+                        tracer_->release(trace);
+                    }
+                    // the read callback may have closed the connection
+                    if (attempt != attempt_)
+                        return;
                 }
 
+                read_buffer_.consume(transferred);
                 do_read();
-            }
+            }))
         );
     }
 
@@ -198,31 +659,182 @@ private:
     void set_timeout(Duration duration)
     {
         connect_timer_.expires_after(duration);
-        connect_timer_.async_wait(
-            [this] (const boost::system::error_code & ec) {
+        connect_timer_.async_wait(boost::asio::bind_executor(
+            executor_,
+            [this, attempt = attempt_] (const boost::system::error_code & ec) {
                 if (ec && ec == boost::asio::error::operation_aborted)
                     return;
+                if (attempt != attempt_)
+                    return;
                 fmt::print("timer callback: err: {}\n", ec.message());
 
                 resolver_.cancel();
-                boost::asio::post(
-                    executor_,
-                    [this, ec] { error_callback_(ec); }
-                );
+                stop_race();
+                fail(boost::asio::error::timed_out);
             }
-        );
+        ));
+    }
+
+    void fail(boost::system::error_code ec)
+    {
+        if (state_ == state::waiting)
+            return;
+        // the server closing the connection is what close() waits for
+        if (closing_) {
+            closed();
+            return;
+        }
+
+        boost::asio::post(executor_, [this, ec] {
+            handler_->on_error(ec);
+        });
+
+        if (reconnect_) {
+            disconnect();
+            schedule_reconnect();
+        }
+    }
+
+    // Closes the connection. Handlers of operations started before this
+    // belong to an old attempt and are ignored when they complete.
+    void disconnect()
+    {
+        if constexpr (has_ssl_handle<Stream>::value) {
+            if (state_ == state::connected) {
+                tls_session_.save(stream_->native_handle());
+            }
+        }
+
+        ++attempt_;
+        state_ = state::waiting;
+
+        connect_timer_.cancel();
+        resolver_.cancel();
+        stop_race();
+        boost::system::error_code ignored;
+        stream_->lowest_layer().close(ignored);
+        read_buffer_.consume(read_buffer_.size());
+
+        // anything not yet written, including a message that may have been
+        // partly sent, is sent again after reconnecting
+        while (!message_queue_.empty()) {
+            backlog_.push(message_queue_.front(), message_queue_.front_tag());
+            message_queue_.pop();
+        }
+        writing_ = false;
+    }
+
+    // Ends a close(): disconnects, drops what wasn't written and calls the
+    // close callback
+    void closed()
+    {
+        disconnect();
+        state_ = state::idle;
+        while (!backlog_.empty()) {
+            drop(backlog_, 0);
+        }
+        queue_changed();
+
+        if (on_closed_) {
+            boost::asio::post(executor_, std::move(on_closed_));
+            on_closed_ = nullptr;
+        }
+    }
+
+    void schedule_reconnect()
+    {
+        const auto& policy = *reconnect_;
+
+        double delay = policy.initial_delay.count();
+        for (unsigned i = 0; i < failures_ && delay < policy.max_delay.count(); ++i)
+            delay *= policy.multiplier;
+        delay = std::min<double>(delay, policy.max_delay.count());
+        delay -= delay * policy.jitter * std::uniform_real_distribution<double>(0.0, 1.0)(random_);
+        ++failures_;
+
+        const auto wait = std::chrono::milliseconds(static_cast<std::chrono::milliseconds::rep>(delay));
+        fmt::print("reconnecting to {} in {}ms\n", address_, wait.count());
+
+        reconnect_timer_.expires_after(wait);
+        reconnect_timer_.async_wait(boost::asio::bind_executor(
+            executor_,
+            [this] (const boost::system::error_code & ec) {
+                if (ec && ec == boost::asio::error::operation_aborted)
+                    return;
+                reconnect();
+            }
+        ));
+    }
+
+    void reconnect()
+    {
+        if (make_stream_) {
+            stream_ = &make_stream_();
+        }
+
+        state_ = state::connecting;
+
+        const bool endpoints_fresh = std::begin(endpoints_) != std::end(endpoints_)
+            && std::chrono::steady_clock::now() - resolved_at_ < reconnect_->endpoint_ttl;
+        if (endpoints_fresh) {
+            fmt::print("reusing resolved endpoints for {}\n", address_);
+            connect(endpoints_);
+        } else {
+            resolve();
+        }
     }
 
     Executor& executor_;
     Resolver& resolver_;
-    Stream& stream_;
+    Stream* stream_;
+    struct no_callbacks {};
+    std::conditional_t<std::is_same_v<Handler, function_handler>, function_handler, no_callbacks> callbacks_;
+    Handler* handler_;
     typename TimerEngine::timer_type connect_timer_;
+    typename TimerEngine::timer_type reconnect_timer_;
     boost::asio::streambuf read_buffer_;
-    read_callback on_read_;
-    connect_callback on_connect_;
-    error_callback error_callback_;
-    std::deque<std::string> message_queue_;
-
+    handler_memory<> read_memory_;
+    handler_memory<> write_memory_;
+    message_queue message_queue_;
+    message_queue backlog_;
+    queue_guard queue_guard_;
+    overload_callback on_overload_;
+    reject_callback on_rejected_;
+    bool writing_ = false;
+    // set by close(), the connection isn't used again
+    bool closing_ = false;
+    std::function<void ()> on_closed_;
+
+    state state_ = state::idle;
+    // incremented on every disconnect, handlers from older attempts are ignored
+    std::size_t attempt_ = 0;
+    std::string address_;
+    std::string port_;
+    socket_options socket_options_;
+    boost::asio::ip::tcp::resolver::results_type endpoints_;
+    std::chrono::steady_clock::time_point resolved_at_;
+
+    std::optional<reconnect_policy> reconnect_;
+    stream_factory make_stream_;
+    unsigned failures_ = 0;
+    std::minstd_rand random_;
+
+    using socket_type = typename std::decay_t<
+        decltype(std::declval<Stream&>().lowest_layer())>::protocol_type::socket;
+    typename TimerEngine::timer_type attempt_timer_;
+    std::vector<boost::asio::ip::tcp::endpoint> race_endpoints_;
+    std::list<socket_type> race_sockets_;
+    std::size_t race_next_ = 0;
+    std::size_t race_pending_ = 0;
+    boost::system::error_code race_error_;
+    // incremented whenever a race ends, handlers of older races are ignored
+    std::size_t race_ = 0;
+
+    struct no_tls_session {};
+    std::conditional_t<has_ssl_handle<Stream>::value, tls_session, no_tls_session> tls_session_;
+    net_stream_stats stats_;
+    stream_metrics metrics_;
+    tracer* tracer_ = nullptr;
 };
 
 #endif
@@ -0,0 +1,227 @@
+// Replays IRC traffic through net_stream and the bot as fast as it can and
+// reports how fast that was:
+//
+//     replay_bench <log> [repeat]      lines received from a server, one per line
+//     replay_bench --synthetic <lines> a fixed mix of pings, chat, links and joins
+//
+// net_stream runs on the fakes of the tests, so there is no socket, TLS or
+// real time involved; the numbers are for our own code. Links are answered
+// by an HTTP engine that replies at once. Everything the bot and net_stream
+// print goes to /dev/null, the report goes to stderr.
+
+#include "alloc_accounting.hpp"
+#include "irc_bot.hpp"
+#include "net_stream.hpp"
+#include "test_fakes.hpp"
+#include "title_cache.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Answers every request with the same title, on the next run of the executor
+struct instant_http_engine
+{
+    struct request_type {
+        std::string url;
+        std::function<void(std::string)> callback;
+    };
+
+    void execute(request_type&& request)
+    {
+        boost::asio::post(io_context, [callback = std::move(request.callback)] {
+            callback("\x02youtube\x02: Replayed (3m33s)");
+        });
+    }
+
+    bool overloaded() const { return false; }
+
+    boost::asio::io_context& io_context;
+};
+
+// The net_stream handler, like irc_connection in main.cpp, timing each line
+struct replay_connection
+{
+    using irc_stream = net_stream<
+        boost::asio::io_context,
+        FakeSslStream,
+        FakeResolver,
+        ManualTimerEngine,
+        replay_connection>;
+
+    replay_connection(
+        boost::asio::io_context& io_context,
+        FakeResolver& resolver,
+        FakeSslStream& stream,
+        ManualTimerEngine& timer_engine,
+        bot_shared<instant_http_engine>& shared,
+        network_config config)
+        : irc(io_context, resolver, stream, timer_engine, *this)
+        , bot(irc, shared, std::move(config))
+    {}
+
+    void on_connected() { bot.on_connected(); }
+    void on_error(boost::system::error_code ec)
+    {
+        fmt::print(stderr, "connection error: {}\n", ec.message());
+    }
+
+    void on_read(std::string_view line)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        bot.on_read(line);
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    irc_stream irc;
+    irc_bot<irc_stream, instant_http_engine> bot;
+    std::vector<std::int64_t> latencies;
+};
+
+std::string synthetic_log(std::size_t lines)
+{
+    static constexpr std::string_view mix[] = {
+        ":alice!a@host.example.org PRIVMSG #bots :anyone tried the new compiler release yet?\r\n",
+        ":bob!b@host.example.org PRIVMSG #bots :yes, builds are about ten percent faster here\r\n",
+        "PING :irc.hostname.org\r\n",
+        ":carol!c@host.example.org PRIVMSG #bots :this one https://youtu.be/dQw4w9WgXcQ\r\n",
+        ":dave!d@host.example.org JOIN #bots\r\n",
+        ":erin!e@host.example.org PRIVMSG #bots :.hello\r\n",
+        ":dave!d@host.example.org PART #bots :later\r\n",
+        ":frank!f@host.example.org PRIVMSG #other :not a channel we are in\r\n",
+    };
+
+    std::string log;
+    for (std::size_t i = 0; i < lines; ++i) {
+        log += mix[i % std::size(mix)];
+    }
+    return log;
+}
+
+std::size_t count_lines(std::string_view log)
+{
+    return std::count(log.begin(), log.end(), '\n');
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    std::string log;
+    std::size_t repeat = 1;
+    if (argc >= 3 && std::string_view(argv[1]) == "--synthetic") {
+        log = synthetic_log(std::stoul(argv[2]));
+    } else if (argc >= 2) {
+        std::ifstream file(argv[1], std::ios::binary);
+        if (!file) {
+            fmt::print(stderr, "Unable to open {}\n", argv[1]);
+            return 1;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        log = contents.str();
+        if (argc >= 3)
+            repeat = std::stoul(argv[2]);
+    } else {
+        fmt::print(stderr, "usage: {} <log> [repeat] | --synthetic <lines>\n", argv[0]);
+        return 1;
+    }
+    if (!log.empty() && log.back() != '\n')
+        log += '\n';
+
+    std::freopen("/dev/null", "w", stdout);
+
+    boost::asio::io_context io_context;
+    ManualExecutor executor(io_context);
+    ManualTimerEngine timer_engine;
+    FakeResolver resolver(io_context);
+    FakeSslStream stream(io_context.get_executor());
+    instant_http_engine http{ io_context };
+    title_cache titles(1024, 6h);
+    bot_shared<instant_http_engine> shared{ http, titles, "key" };
+
+    network_config config;
+    config.name = "replay";
+    config.server = "irc.hostname.org";
+    config.nick = "borky";
+    config.channels.emplace_back(channel_config{ "#bots", {} });
+    config.query_settings.rate_limit = 1000000;
+    config.channels.back().settings.rate_limit = 1000000;
+
+    replay_connection connection(io_context, resolver, stream, timer_engine, shared, config);
+    const std::size_t lines = count_lines(log) * repeat;
+    connection.latencies.reserve(lines);
+
+    connection.irc.connect("irc.hostname.org");
+    resolver.simulate_resolve();
+    executor.run();
+    SocketListener::instance()->pending_connects.at(0).callback({});
+    executor.run();
+    stream.simulate_handshake();
+    executor.run();
+
+    // completes every write, including those started by completing one
+    const auto complete_writes = [&] {
+        for (std::size_t i = 0; i < stream.writes.size(); ++i) {
+            auto callback = std::move(stream.writes[i].callback);
+            callback(boost::system::error_code(), stream.writes[i].data.size());
+        }
+        stream.writes.clear();
+    };
+
+    const auto replay = [&] {
+        std::string_view rest = log;
+        while (!rest.empty()) {
+            const std::size_t n = std::min(rest.size(), stream.pending_reads.front().buffers.size());
+            stream.push(rest.substr(0, n));
+            rest.remove_prefix(n);
+            executor.run();
+            complete_writes();
+            executor.run();
+        }
+    };
+
+    const auto allocations_before = thread_alloc_counts();
+    const auto bot_allocations_before = thread_alloc_counts(alloc_tag::bot);
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < repeat; ++i) {
+        replay();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const auto allocations = thread_alloc_counts().allocations - allocations_before.allocations;
+    const auto bot_allocations = thread_alloc_counts(alloc_tag::bot).allocations - bot_allocations_before.allocations;
+
+    auto& latencies = connection.latencies;
+    if (latencies.empty()) {
+        fmt::print(stderr, "No lines replayed\n");
+        return 1;
+    }
+    const auto percentile = [&] (double p) {
+        auto nth = latencies.begin() + static_cast<std::ptrdiff_t>(p * (latencies.size() - 1));
+        std::nth_element(latencies.begin(), nth, latencies.end());
+        return *nth;
+    };
+
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    const double handled = static_cast<double>(latencies.size());
+    fmt::print(stderr, "lines:             {}\n", latencies.size());
+    fmt::print(stderr, "lines/sec:         {:.0f}\n", handled / seconds);
+    fmt::print(stderr, "ns/line:           {:.0f}\n", seconds * 1e9 / handled);
+    fmt::print(stderr, "allocs/line:       {:.2f} (bot), {:.2f} (total, including the fakes)\n",
+        bot_allocations / handled, allocations / handled);
+    fmt::print(stderr, "dispatch p50:      {} ns\n", percentile(0.50));
+    fmt::print(stderr, "dispatch p99:      {} ns\n", percentile(0.99));
+    fmt::print(stderr, "dispatch max:      {} ns\n", percentile(1.0));
+    return 0;
+}
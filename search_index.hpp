@@ -0,0 +1,298 @@
+#ifndef SEARCH_INDEX_HPP
+#define SEARCH_INDEX_HPP
+
+#include "string_interner.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+// Inverted index over the messages of a channel log. Messages are numbered
+// in the order they are added, and every word has a postings list of the
+// numbers of the messages containing it, stored as varint deltas. Every
+// skip_interval postings the list has a skip entry, which splits it into
+// blocks that can be decoded on their own. A search takes the blocks of
+// the shortest list newest first and seeks the other lists to each of
+// their postings, so it decodes little of long lists and stops once it has
+// found the last matches. The channel of a message is indexed as a word of
+// its own that no text can contain, which makes searching one channel part
+// of the intersection.
+//
+// Words are runs of ASCII letters and digits, and of bytes of UTF-8
+// sequences, of two bytes or more; they are matched under IRC casemapping
+// and cut at max_word bytes.
+//
+// add() and search() may be called from different threads: a search
+// holds a shared lock, and each add() a unique lock for its batch.
+class search_index
+{
+public:
+    using message_id = std::uint32_t;
+
+    // Where a message is in the log
+    struct location
+    {
+        std::uint32_t segment;
+        std::uint64_t offset;
+    };
+
+    struct entry
+    {
+        location where;
+        // the log's name id of the channel
+        std::uint32_t channel;
+        std::string_view text;
+    };
+
+    static constexpr std::size_t max_word = 32;
+
+    // Calls f(word) for the words of text, repeated words included
+    template <typename F>
+    static void for_each_word(std::string_view text, F&& f)
+    {
+        std::size_t i = 0;
+        while (i < text.size()) {
+            while (i < text.size() && !is_word_byte(text[i])) {
+                ++i;
+            }
+            const std::size_t start = i;
+            while (i < text.size() && is_word_byte(text[i])) {
+                ++i;
+            }
+            if (i - start >= 2)
+                f(text.substr(start, std::min(i - start, max_word)));
+        }
+    }
+
+    void add(const std::vector<entry>& entries)
+    {
+        std::unique_lock lock(mutex_);
+        for (const auto& e : entries) {
+            const auto id = static_cast<message_id>(messages_.size());
+            messages_.push_back(e.where);
+
+            char key[16];
+            postings_for(channel_key(key, e.channel)).push(id);
+            for_each_word(e.text, [&] (std::string_view word) {
+                postings_for(word).push(id);
+            });
+        }
+    }
+
+    // The locations of the last `limit` messages in channel that contain
+    // every word of query, oldest first. Nothing if query has no words.
+    std::vector<location> search(std::uint32_t channel, std::string_view query, std::size_t limit) const
+    {
+        std::vector<location> result;
+        std::shared_lock lock(mutex_);
+
+        char key[16];
+        std::vector<cursor> cursors;
+        bool words = false;
+        bool known = add_cursor(cursors, channel_key(key, channel));
+        for_each_word(query, [&] (std::string_view word) {
+            words = true;
+            known = add_cursor(cursors, word) && known;
+        });
+        if (!words || !known || limit == 0)
+            return result;
+
+        // the shortest list leads, the others are sought to its postings.
+        // Its blocks are taken newest first, until there are enough matches.
+        std::sort(cursors.begin(), cursors.end(), [] (const cursor& a, const cursor& b) {
+            return a.list->count < b.list->count;
+        });
+
+        std::vector<message_id> found;
+        std::vector<message_id> block;
+        const postings& lead = *cursors[0].list;
+        for (std::size_t b = lead.skips.size() + 1; b-- > 0 && found.size() < limit;) {
+            block.clear();
+            for (cursor c(lead, b); c.next();) {
+                block.push_back(c.id);
+            }
+            for (std::size_t i = 1; i < cursors.size(); ++i) {
+                cursors[i] = cursor(*cursors[i].list);
+            }
+
+            auto matches = block.begin();
+            for (const message_id candidate : block) {
+                bool all = true;
+                for (std::size_t i = 1; i < cursors.size() && all; ++i) {
+                    all = cursors[i].seek(candidate) && cursors[i].id == candidate;
+                }
+                if (all)
+                    *matches++ = candidate;
+            }
+            found.insert(found.begin(), block.begin(), matches);
+        }
+
+        const std::size_t first = found.size() > limit ? found.size() - limit : 0;
+        for (std::size_t i = first; i < found.size(); ++i) {
+            result.push_back(messages_[found[i]]);
+        }
+        return result;
+    }
+
+    // Messages indexed
+    std::size_t size() const
+    {
+        std::shared_lock lock(mutex_);
+        return messages_.size();
+    }
+
+    // Distinct words, channels included
+    std::size_t words() const
+    {
+        std::shared_lock lock(mutex_);
+        return postings_.size();
+    }
+
+private:
+    static constexpr std::uint32_t skip_interval = 64;
+
+    struct skip
+    {
+        // a posting, and where the one after it starts
+        message_id id;
+        std::uint32_t next;
+    };
+
+    struct postings
+    {
+        std::vector<std::uint8_t> bytes;
+        std::vector<skip> skips;
+        message_id last = 0;
+        std::uint32_t count = 0;
+
+        void push(message_id id)
+        {
+            // a word repeated in a message
+            if (count > 0 && id == last)
+                return;
+            for (std::uint32_t delta = id - last; ; delta >>= 7) {
+                if (delta < 0x80) {
+                    bytes.push_back(static_cast<std::uint8_t>(delta));
+                    break;
+                }
+                bytes.push_back(static_cast<std::uint8_t>(delta | 0x80));
+            }
+            last = id;
+            if (++count % skip_interval == 0)
+                skips.push_back(skip{ id, static_cast<std::uint32_t>(bytes.size()) });
+        }
+    };
+
+    // Decodes a postings list, or a block of one
+    struct cursor
+    {
+        const postings* list;
+        std::size_t position = 0;
+        std::size_t end = 0;
+        std::size_t skipped = 0;
+        message_id id = 0;
+
+        // At the first posting of the list
+        explicit cursor(const postings& p)
+            : list(&p)
+            , end(p.bytes.size())
+        {
+            next();
+        }
+
+        // Before the first posting of block b, the postings after skip entry
+        // b - 1 and up to entry b
+        cursor(const postings& p, std::size_t b)
+            : list(&p)
+            , position(b == 0 ? 0 : p.skips[b - 1].next)
+            , end(b < p.skips.size() ? p.skips[b].next : p.bytes.size())
+            , skipped(b)
+            , id(b == 0 ? 0 : p.skips[b - 1].id)
+        {
+        }
+
+        bool next()
+        {
+            if (position == end)
+                return false;
+            std::uint32_t delta = 0;
+            for (unsigned shift = 0; ; shift += 7) {
+                const std::uint8_t byte = list->bytes[position++];
+                delta |= static_cast<std::uint32_t>(byte & 0x7f) << shift;
+                if (byte < 0x80)
+                    break;
+            }
+            id += delta;
+            return true;
+        }
+
+        // Moves to the first posting not before target, false if there is
+        // none
+        bool seek(message_id target)
+        {
+            if (id >= target)
+                return true;
+            const auto begin = list->skips.begin() + static_cast<std::ptrdiff_t>(skipped);
+            const auto after = std::lower_bound(begin, list->skips.end(), target, [] (const skip& s, message_id t) {
+                return s.id < t;
+            });
+            skipped = static_cast<std::size_t>(after - list->skips.begin());
+            if (after != begin && std::prev(after)->id > id) {
+                id = std::prev(after)->id;
+                position = std::prev(after)->next;
+            }
+            while (id < target) {
+                if (!next())
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    static bool is_word_byte(char c)
+    {
+        const auto byte = static_cast<unsigned char>(c);
+        return byte >= 0x80
+            || (byte >= '0' && byte <= '9')
+            || (byte >= 'a' && byte <= 'z')
+            || (byte >= 'A' && byte <= 'Z');
+    }
+
+    // \x01 and the id in decimal, which casemapping leaves alone
+    static std::string_view channel_key(char (&key)[16], std::uint32_t channel)
+    {
+        key[0] = '\x01';
+        const auto end = std::to_chars(key + 1, key + sizeof(key), channel).ptr;
+        return std::string_view(key, static_cast<std::size_t>(end - key));
+    }
+
+    postings& postings_for(std::string_view word)
+    {
+        const auto id = words_.intern(word);
+        if (id == postings_.size())
+            postings_.emplace_back();
+        return postings_[id];
+    }
+
+    // False if no message has the word
+    bool add_cursor(std::vector<cursor>& cursors, std::string_view word) const
+    {
+        const auto id = words_.find(word);
+        if (id == string_interner::npos)
+            return false;
+        cursors.emplace_back(postings_[id]);
+        return true;
+    }
+
+    mutable std::shared_mutex mutex_;
+    // ids of words are indexes into postings_
+    string_interner words_;
+    std::vector<postings> postings_;
+    std::vector<location> messages_;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "seen_table.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+
+#include <unistd.h>
+
+namespace {
+
+[[noreturn]] void throw_errno(const std::string& what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+struct file_closer
+{
+    void operator()(std::FILE* file) const { std::fclose(file); }
+};
+using file_ptr = std::unique_ptr<std::FILE, file_closer>;
+
+}
+
+void seen_table::save(const std::string& path) const
+{
+    const std::string temporary = path + ".tmp";
+    file_ptr file(std::fopen(temporary.c_str(), "wb"));
+    if (!file)
+        throw_errno(temporary);
+
+    file_header header{};
+    std::memcpy(header.magic, file_magic, sizeof(header.magic));
+    header.slot_size = sizeof(slot);
+    header.capacity = slots_.size();
+    if (std::fwrite(&header, sizeof(header), 1, file.get()) != 1
+        || std::fwrite(slots_.data(), sizeof(slot), slots_.size(), file.get()) != slots_.size()
+        || std::fflush(file.get()) != 0
+        || ::fsync(::fileno(file.get())) != 0)
+        throw_errno(temporary);
+
+    if (std::fclose(file.release()) != 0)
+        throw_errno(temporary);
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+        throw_errno(path);
+}
+
+void seen_table::load(const std::string& path)
+{
+    file_ptr file(std::fopen(path.c_str(), "rb"));
+    if (!file) {
+        if (errno == ENOENT)
+            return;
+        throw_errno(path);
+    }
+
+    file_header header;
+    if (std::fread(&header, sizeof(header), 1, file.get()) != 1
+        || std::memcmp(header.magic, file_magic, sizeof(header.magic)) != 0
+        || header.slot_size != sizeof(slot))
+        throw std::runtime_error(path + " is not a seen table");
+
+    slot s;
+    for (std::uint64_t i = 0; i < header.capacity; ++i) {
+        if (std::fread(&s, sizeof(s), 1, file.get()) != 1)
+            throw std::runtime_error(path + " is cut short");
+        if (s.nick_length > max_nick || s.channel_length > max_channel || s.excerpt_length > max_excerpt)
+            throw std::runtime_error(path + " is not a seen table");
+        if (s.nick_length == 0)
+            continue;
+        update(
+            s.event,
+            s.nick_view(),
+            std::string_view(s.channel, s.channel_length),
+            std::string_view(s.excerpt, s.excerpt_length),
+            clock::time_point(std::chrono::duration_cast<clock::duration>(std::chrono::microseconds(s.time))));
+    }
+}
@@ -0,0 +1,170 @@
+#ifndef SEEN_TABLE_HPP
+#define SEEN_TABLE_HPP
+
+#include "casemap.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// What a nick was last seen doing
+enum class seen_event : std::uint8_t
+{
+    message,
+    join,
+    part,
+    quit,   // no channel
+};
+
+// When each nick was last seen, where and doing what, for .seen. A fixed
+// array of slots with open addressing: a nick is looked for in the
+// max_probe slots from its hash, compared under IRC casemapping. The slots
+// hold the nick, channel and an excerpt of the text themselves, so that
+// update() is O(1) and never allocates. Slots are never emptied; once the
+// slots of a nick are all taken it replaces the one seen longest ago.
+//
+// The slots are plain data and are saved to disk as they are, see save().
+class seen_table
+{
+public:
+    using clock = std::chrono::system_clock;
+
+    static constexpr std::size_t max_nick = 32;
+    static constexpr std::size_t max_channel = 56;
+    static constexpr std::size_t max_excerpt = 88;
+
+    struct seen
+    {
+        seen_event event;
+        clock::time_point time;
+        // views into the table, valid until the next update()
+        std::string_view nick;
+        std::string_view channel;
+        std::string_view excerpt;
+    };
+
+    // capacity is rounded up to a power of two
+    explicit seen_table(std::size_t capacity = 16384)
+        : slots_(std::bit_ceil(std::max<std::size_t>(capacity, max_probe)))
+    {
+    }
+
+    // Longer nicks are not kept, longer channels are kept without the
+    // channel, and the text is cut to an excerpt
+    void update(seen_event event, std::string_view nick, std::string_view channel, std::string_view text, clock::time_point time = clock::now())
+    {
+        if (nick.empty() || nick.size() > max_nick)
+            return;
+        if (channel.size() > max_channel)
+            channel = {};
+
+        const std::uint32_t hash = irc_hash(nick);
+        slot* target = nullptr;
+        for (std::size_t i = 0; i < max_probe; ++i) {
+            slot& s = slots_[(hash + i) & (slots_.size() - 1)];
+            if (s.nick_length == 0 || (s.hash == hash && irc_equals(s.nick_view(), nick))) {
+                target = &s;
+                break;
+            }
+            if (!target || s.time < target->time)
+                target = &s;
+        }
+
+        target->hash = hash;
+        target->event = event;
+        target->time = std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+        target->nick_length = static_cast<std::uint8_t>(nick.size());
+        std::memcpy(target->nick, nick.data(), nick.size());
+        target->channel_length = static_cast<std::uint8_t>(channel.size());
+        std::memcpy(target->channel, channel.data(), channel.size());
+        const std::string_view excerpt = cut(text);
+        target->excerpt_length = static_cast<std::uint8_t>(excerpt.size());
+        std::memcpy(target->excerpt, excerpt.data(), excerpt.size());
+    }
+
+    std::optional<seen> find(std::string_view nick) const
+    {
+        if (nick.empty() || nick.size() > max_nick)
+            return std::nullopt;
+
+        const std::uint32_t hash = irc_hash(nick);
+        for (std::size_t i = 0; i < max_probe; ++i) {
+            const slot& s = slots_[(hash + i) & (slots_.size() - 1)];
+            if (s.nick_length == 0)
+                break;
+            if (s.hash == hash && irc_equals(s.nick_view(), nick)) {
+                return seen{
+                    s.event,
+                    clock::time_point(std::chrono::duration_cast<clock::duration>(std::chrono::microseconds(s.time))),
+                    s.nick_view(),
+                    std::string_view(s.channel, s.channel_length),
+                    std::string_view(s.excerpt, s.excerpt_length),
+                };
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::size_t capacity() const { return slots_.size(); }
+
+    // Writes the table to path, through a temporary file renamed over it.
+    // Throws std::system_error.
+    void save(const std::string& path) const;
+
+    // Adds the nicks saved to path. A missing file is an empty table, a file
+    // of a table of another capacity is added slot by slot. Throws
+    // std::system_error, or std::runtime_error if the file is not a table.
+    void load(const std::string& path);
+
+private:
+    static constexpr std::size_t max_probe = 16;
+
+    struct slot
+    {
+        std::uint32_t hash = 0;
+        seen_event event = seen_event::message;
+        // 0 for an empty slot
+        std::uint8_t nick_length = 0;
+        std::uint8_t channel_length = 0;
+        std::uint8_t excerpt_length = 0;
+        // microseconds since the Unix epoch
+        std::int64_t time = 0;
+        char nick[max_nick];
+        char channel[max_channel];
+        char excerpt[max_excerpt];
+
+        std::string_view nick_view() const { return std::string_view(nick, nick_length); }
+    };
+    static_assert(sizeof(slot) == 192);
+
+    // At most max_excerpt bytes, not ending within a UTF-8 sequence
+    static std::string_view cut(std::string_view text)
+    {
+        if (text.size() <= max_excerpt)
+            return text;
+        std::size_t size = max_excerpt;
+        while (size > 0 && (static_cast<unsigned char>(text[size]) & 0xc0) == 0x80) {
+            --size;
+        }
+        return text.substr(0, size);
+    }
+
+    struct file_header
+    {
+        char magic[8];
+        std::uint32_t slot_size;
+        std::uint32_t unused;
+        std::uint64_t capacity;
+    };
+    static constexpr char file_magic[8] = { 's', 'e', 'e', 'n', 't', 'b', 'l', '1' };
+
+    std::vector<slot> slots_;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef SELF_SIGNED_CERT_HPP
+#define SELF_SIGNED_CERT_HPP
+
+#include <boost/asio/ssl/context.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include <memory>
+#include <stdexcept>
+
+// Generates a throwaway EC key and a self-signed certificate for it, and
+// loads both into the context. Meant for local test servers only.
+inline void use_self_signed_certificate(boost::asio::ssl::context& context, const char* common_name = "localhost")
+{
+    const auto check = [] (bool ok, const char* what) {
+        if (!ok)
+            throw std::runtime_error(std::string("self-signed certificate: ") + what);
+    };
+
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> key_ctx(
+        EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr), &EVP_PKEY_CTX_free);
+    check(key_ctx != nullptr, "EVP_PKEY_CTX_new_id");
+    check(EVP_PKEY_keygen_init(key_ctx.get()) == 1, "EVP_PKEY_keygen_init");
+    check(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_ctx.get(), NID_X9_62_prime256v1) == 1, "curve");
+
+    EVP_PKEY* raw_key = nullptr;
+    check(EVP_PKEY_keygen(key_ctx.get(), &raw_key) == 1, "EVP_PKEY_keygen");
+    std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(raw_key, &EVP_PKEY_free);
+
+    std::unique_ptr<X509, decltype(&X509_free)> cert(X509_new(), &X509_free);
+    check(cert != nullptr, "X509_new");
+    check(X509_set_version(cert.get(), 2) == 1, "X509_set_version");
+    check(ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1) == 1, "serial");
+    check(X509_gmtime_adj(X509_getm_notBefore(cert.get()), -60) != nullptr, "notBefore");
+    check(X509_gmtime_adj(X509_getm_notAfter(cert.get()), 60L * 60 * 24 * 365) != nullptr, "notAfter");
+    check(X509_set_pubkey(cert.get(), key.get()) == 1, "X509_set_pubkey");
+
+    X509_NAME* name = X509_get_subject_name(cert.get());
+    check(X509_NAME_add_entry_by_txt(
+        name, "CN", MBSTRING_ASC,
+        reinterpret_cast<const unsigned char*>(common_name), -1, -1, 0) == 1, "CN");
+    check(X509_set_issuer_name(cert.get(), name) == 1, "X509_set_issuer_name");
+    check(X509_sign(cert.get(), key.get(), EVP_sha256()) > 0, "X509_sign");
+
+    check(SSL_CTX_use_certificate(context.native_handle(), cert.get()) == 1, "SSL_CTX_use_certificate");
+    check(SSL_CTX_use_PrivateKey(context.native_handle(), key.get()) == 1, "SSL_CTX_use_PrivateKey");
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef SOCKET_OPTIONS_HPP
+#define SOCKET_OPTIONS_HPP
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/socket_base.hpp>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+
+struct keepalive_settings
+{
+    // idle time before the first probe, time between probes and the number
+    // of unanswered probes before the connection is dropped
+    std::chrono::seconds idle{60};
+    std::chrono::seconds interval{10};
+    int count = 6;
+};
+
+// Applied to every socket before it connects, so that the buffer sizes
+// are taken into account for the TCP window. 0 keeps the kernel default.
+struct socket_options
+{
+    bool no_delay = true;
+    std::optional<keepalive_settings> keepalive;
+    std::size_t receive_buffer_size = 0;
+    std::size_t send_buffer_size = 0;
+};
+
+// An int socket option that boost::asio doesn't provide
+template <int Level, int Name>
+class int_socket_option
+{
+public:
+    explicit int_socket_option(int value) : value_(value) {}
+
+    template <typename Protocol> int level(const Protocol&) const { return Level; }
+    template <typename Protocol> int name(const Protocol&) const { return Name; }
+    template <typename Protocol> const int* data(const Protocol&) const { return &value_; }
+    template <typename Protocol> std::size_t size(const Protocol&) const { return sizeof(value_); }
+
+private:
+    int value_;
+};
+
+// Sets the options on an open socket. Failures are reported through ec,
+// the remaining options are still applied.
+template <typename Socket>
+void apply_socket_options(Socket& socket, const socket_options& options, boost::system::error_code& ec)
+{
+    const auto set = [&] (const auto& option) {
+        boost::system::error_code option_ec;
+        socket.set_option(option, option_ec);
+        if (option_ec && !ec)
+            ec = option_ec;
+    };
+
+    set(boost::asio::ip::tcp::no_delay(options.no_delay));
+
+    if (options.keepalive) {
+        set(boost::asio::socket_base::keep_alive(true));
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+        set(int_socket_option<IPPROTO_TCP, TCP_KEEPIDLE>(options.keepalive->idle.count()));
+        set(int_socket_option<IPPROTO_TCP, TCP_KEEPINTVL>(options.keepalive->interval.count()));
+        set(int_socket_option<IPPROTO_TCP, TCP_KEEPCNT>(options.keepalive->count));
+#endif
+    }
+
+    if (options.receive_buffer_size)
+        set(boost::asio::socket_base::receive_buffer_size(options.receive_buffer_size));
+    if (options.send_buffer_size)
+        set(boost::asio::socket_base::send_buffer_size(options.send_buffer_size));
+}
+
+#endif
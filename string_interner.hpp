@@ -0,0 +1,208 @@
+#ifndef STRING_INTERNER_HPP
+#define STRING_INTERNER_HPP
+
+#include "casemap.hpp"
+
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Maps nicks, channels and hosts to dense 32 bit ids. Strings that are equal
+// under RFC 1459 casemapping share an id, and the spelling seen first is the
+// one kept. All strings live back to back in one buffer.
+//
+// Ids from intern() are never reused, so they can be stored and compared for
+// as long as the interner lives. Ids from acquire() are reference counted
+// instead: once release() drops the last reference the string is forgotten
+// and its id is handed out again, which keeps the table as small as what is
+// still referenced. A string that is both acquired and interned stays.
+class string_interner
+{
+public:
+    using id_type = std::uint32_t;
+    static constexpr id_type npos = UINT32_MAX;
+
+    id_type intern(std::string_view str)
+    {
+        const std::uint32_t hash = irc_hash(str);
+        if (const auto existing = find(str, hash); existing != npos) {
+            entries_[existing].refs = pinned;
+            return existing;
+        }
+        return add(str, hash, pinned);
+    }
+
+    // Like intern(), and takes a reference that is given back with release()
+    id_type acquire(std::string_view str)
+    {
+        const std::uint32_t hash = irc_hash(str);
+        if (const auto existing = find(str, hash); existing != npos) {
+            add_ref(existing);
+            return existing;
+        }
+
+        return add(str, hash, 1);
+    }
+
+    void add_ref(id_type id)
+    {
+        if (entries_[id].refs != pinned)
+            ++entries_[id].refs;
+    }
+
+    // Returns whether that was the last reference and the id is now free
+    bool release(id_type id)
+    {
+        entry& e = entries_[id];
+        if (e.refs == pinned || --e.refs > 0)
+            return false;
+
+        unplace(id);
+        garbage_ += e.length;
+        e.length = 0;
+        free_.push_back(id);
+        return true;
+    }
+
+    id_type find(std::string_view str) const
+    {
+        return find(str, irc_hash(str));
+    }
+
+    // The view is invalidated by the next call to intern() or acquire()
+    std::string_view str(id_type id) const
+    {
+        const auto& e = entries_[id];
+        return std::string_view(data_.data() + e.offset, e.length);
+    }
+
+    std::size_t size() const { return entries_.size() - free_.size(); }
+
+    std::size_t memory_usage() const
+    {
+        return data_.capacity()
+            + entries_.capacity() * sizeof(entry)
+            + slots_.capacity() * sizeof(id_type)
+            + free_.capacity() * sizeof(id_type);
+    }
+
+private:
+    static constexpr std::uint32_t pinned = UINT32_MAX;
+
+    struct entry {
+        std::uint32_t offset;
+        std::uint32_t length;
+        std::uint32_t hash;
+        std::uint32_t refs;
+    };
+
+    id_type add(std::string_view str, std::uint32_t hash, std::uint32_t refs)
+    {
+        if (garbage_ > 4096 && garbage_ * 2 > data_.size())
+            compact();
+
+        const entry e{
+            static_cast<std::uint32_t>(data_.size()),
+            static_cast<std::uint32_t>(str.size()),
+            hash,
+            refs,
+        };
+        id_type id;
+        if (!free_.empty()) {
+            id = free_.back();
+            free_.pop_back();
+            entries_[id] = e;
+        } else {
+            id = static_cast<id_type>(entries_.size());
+            entries_.push_back(e);
+        }
+        data_.insert(std::end(data_), std::begin(str), std::end(str));
+
+        if (entries_.size() * 2 > slots_.size()) {
+            rehash(slots_.empty() ? 64 : slots_.size() * 2);
+        } else {
+            place(id);
+        }
+        return id;
+    }
+
+    id_type find(std::string_view str, std::uint32_t hash) const
+    {
+        if (slots_.empty())
+            return npos;
+
+        const std::size_t mask = slots_.size() - 1;
+        for (std::size_t i = hash & mask;; i = (i + 1) & mask) {
+            const id_type id = slots_[i];
+            if (id == npos)
+                return npos;
+            if (entries_[id].hash == hash && irc_equals(this->str(id), str))
+                return id;
+        }
+    }
+
+    void rehash(std::size_t slot_count)
+    {
+        slots_.assign(slot_count, npos);
+        for (std::size_t id = 0; id < entries_.size(); ++id) {
+            if (entries_[id].refs != 0)
+                place(static_cast<id_type>(id));
+        }
+    }
+
+    void place(id_type id)
+    {
+        const std::size_t mask = slots_.size() - 1;
+        std::size_t i = entries_[id].hash & mask;
+        while (slots_[i] != npos)
+            i = (i + 1) & mask;
+        slots_[i] = id;
+    }
+
+    // Takes id out of its slot and moves up the ids probed past it, so that
+    // lookups don't need tombstones
+    void unplace(id_type id)
+    {
+        const std::size_t mask = slots_.size() - 1;
+        std::size_t i = entries_[id].hash & mask;
+        while (slots_[i] != id)
+            i = (i + 1) & mask;
+
+        for (std::size_t j = (i + 1) & mask; slots_[j] != npos; j = (j + 1) & mask) {
+            const std::size_t home = entries_[slots_[j]].hash & mask;
+            // slots_[j] can fill the hole at i unless its home lies in (i, j]
+            if (((j - home) & mask) >= ((j - i) & mask)) {
+                slots_[i] = slots_[j];
+                i = j;
+            }
+        }
+        slots_[i] = npos;
+    }
+
+    // Drops the characters of released strings
+    void compact()
+    {
+        std::vector<char> data;
+        data.reserve(data_.size() - garbage_);
+        for (auto& e : entries_) {
+            if (e.refs == 0)
+                continue;
+            const auto offset = static_cast<std::uint32_t>(data.size());
+            data.insert(std::end(data), data_.data() + e.offset, data_.data() + e.offset + e.length);
+            e.offset = offset;
+        }
+        data_ = std::move(data);
+        garbage_ = 0;
+    }
+
+    std::vector<char> data_;
+    std::vector<entry> entries_;
+    std::vector<id_type> slots_;
+    // released ids, to be handed out again
+    std::vector<id_type> free_;
+    // characters in data_ that belong to released strings
+    std::size_t garbage_ = 0;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "alloc_accounting.hpp"
+#include "irc_bot.hpp"
+#include "net_stream.hpp"
+#include "test_fakes.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Keeps only the last message, in a string whose capacity is reused
+struct LastWriteIrc
+{
+    void write(std::string_view message) { last.assign(message); }
+    void flush_backlog() {}
+
+    std::string last = std::string(512, ' ');
+};
+
+struct NoHttpEngine
+{
+    struct request_type {
+        std::string url;
+        std::function<void(std::string)> callback;
+    };
+
+    void execute(request_type&&) {}
+    bool overloaded() const { return false; }
+};
+
+}
+
+TEST(AllocAccounting, test_counts_allocations_by_tag)
+{
+    ASSERT_TRUE(alloc_accounting_enabled());
+
+    const auto before = thread_alloc_counts(alloc_tag::http);
+    {
+        alloc_scope scope(alloc_tag::http);
+        auto p = std::make_unique<std::array<char, 100>>();
+        EXPECT_NE(nullptr, p);
+    }
+    const auto after = thread_alloc_counts(alloc_tag::http);
+
+    EXPECT_EQ(1, after.allocations - before.allocations);
+    EXPECT_EQ(100, after.bytes - before.bytes);
+}
+
+TEST(AllocAccounting, test_registered_metrics_count_all_threads)
+{
+    metrics_registry registry;
+    alloc_metrics counting(registry);
+    std::thread([] {
+        alloc_scope scope(alloc_tag::irc);
+        auto p = std::make_unique<std::array<char, 64>>();
+        EXPECT_NE(nullptr, p);
+    }).join();
+
+    EXPECT_NE(std::string::npos, registry.expose().find("allocated_bytes_total{tag=\"irc\"} 64\n"));
+}
+
+TEST(AllocAccounting, test_metrics_stop_counting_when_destroyed)
+{
+    metrics_registry registry;
+    {
+        alloc_metrics counting(registry);
+    }
+    {
+        alloc_scope scope(alloc_tag::irc);
+        auto p = std::make_unique<std::array<char, 64>>();
+        EXPECT_NE(nullptr, p);
+    }
+
+    EXPECT_NE(std::string::npos, registry.expose().find("allocated_bytes_total{tag=\"irc\"} 0\n"));
+}
+
+struct HotPath : public ::testing::Test
+{
+    static network_config make_config()
+    {
+        network_config config;
+        config.name = "net";
+        config.server = "irc.hostname.org";
+        config.nick = "borky";
+        config.channels.emplace_back(channel_config{ "#bots", {} });
+        return config;
+    }
+
+    HotPath()
+        : titles(16, 1h)
+        , shared{ http, titles, "key" }
+        , bot(irc, shared, make_config())
+    {
+    }
+
+    // Allocations made handling line, after handling it a few times
+    std::uint64_t allocations_once_warm(std::string_view line)
+    {
+        for (int i = 0; i < 3; ++i) {
+            bot.on_read(line);
+        }
+        const auto before = thread_alloc_counts().allocations;
+        for (int i = 0; i < 100; ++i) {
+            bot.on_read(line);
+        }
+        return thread_alloc_counts().allocations - before;
+    }
+
+    LastWriteIrc irc;
+    NoHttpEngine http;
+    title_cache titles;
+    bot_shared<NoHttpEngine> shared;
+    irc_bot<LastWriteIrc, NoHttpEngine> bot;
+};
+
+TEST_F(HotPath, test_ping_pong_does_not_allocate)
+{
+    EXPECT_EQ(0, allocations_once_warm("PING :irc.hostname.org"));
+    EXPECT_EQ("PONG :irc.hostname.org\r\n", irc.last);
+}
+
+TEST_F(HotPath, test_privmsg_without_link_does_not_allocate)
+{
+    EXPECT_EQ(0, allocations_once_warm(":someone!user@host.example.org PRIVMSG #bots :nothing to see here, move along"));
+}
+
+// net_stream on the test fakes, with the bot as its handler like
+// irc_connection in main.cpp
+struct StreamHotPath : public ::testing::Test
+{
+    struct connection
+    {
+        using irc_stream = net_stream<
+            boost::asio::io_context,
+            FakeStream,
+            FakeResolver,
+            ManualTimerEngine,
+            connection>;
+
+        connection(StreamHotPath& test)
+            : irc(test.io_context, test.resolver, test.stream, test.timer_engine, *this)
+            , bot(irc, test.shared, HotPath::make_config())
+        {
+        }
+
+        void on_connected() { bot.on_connected(); }
+        void on_error(boost::system::error_code) {}
+        void on_read(std::string_view line) { bot.on_read(line); }
+
+        irc_stream irc;
+        irc_bot<irc_stream, NoHttpEngine> bot;
+    };
+
+    StreamHotPath()
+        : executor(io_context)
+        , resolver(io_context)
+        , stream(io_context.get_executor())
+        , titles(16, 1h)
+        , shared{ http, titles, "key" }
+        , conn(*this)
+    {
+        conn.irc.connect("irc.hostname.org");
+        resolver.simulate_resolve();
+        executor.run();
+        SocketListener::instance()->pending_connects.at(0).callback({});
+        executor.run();
+        complete_writes();
+    }
+
+    void TearDown() override
+    {
+        SocketListener::instance()->reset();
+    }
+
+    // Completes every write, including those started by completing one
+    void complete_writes()
+    {
+        for (std::size_t i = 0; i < stream.writes.size(); ++i) {
+            auto callback = std::move(stream.writes[i].callback);
+            callback(boost::system::error_code(), stream.writes[i].data.size());
+        }
+        stream.writes.clear();
+        executor.run();
+    }
+
+    // Reads line from the stream and writes the reply
+    void round_trip(std::string_view line)
+    {
+        stream.push(line);
+        executor.run();
+        last_write = stream.writes.empty() ? std::string() : stream.writes.back().data;
+        complete_writes();
+    }
+
+    // Allocations by net_stream and the bot for a round trip of line,
+    // after enough of them to have used every string in the write queue
+    std::uint64_t allocations_once_warm(std::string_view line)
+    {
+        for (int i = 0; i < 16; ++i) {
+            round_trip(line);
+        }
+        const auto before = thread_alloc_counts(alloc_tag::irc).allocations + thread_alloc_counts(alloc_tag::bot).allocations;
+        for (int i = 0; i < 100; ++i) {
+            round_trip(line);
+        }
+        return thread_alloc_counts(alloc_tag::irc).allocations + thread_alloc_counts(alloc_tag::bot).allocations - before;
+    }
+
+    boost::asio::io_context io_context;
+    ManualExecutor executor;
+    ManualTimerEngine timer_engine;
+    FakeResolver resolver;
+    FakeStream stream;
+    NoHttpEngine http;
+    title_cache titles;
+    bot_shared<NoHttpEngine> shared;
+    connection conn;
+    std::string last_write;
+};
+
+TEST_F(StreamHotPath, test_ping_pong_through_net_stream_does_not_allocate)
+{
+    EXPECT_EQ(0, allocations_once_warm("PING :irc.hostname.org\r\n"));
+    EXPECT_EQ("PONG :irc.hostname.org\r\n", last_write);
+}
+
+TEST_F(StreamHotPath, test_privmsg_through_net_stream_does_not_allocate)
+{
+    EXPECT_EQ(0, allocations_once_warm(":someone!user@host.example.org PRIVMSG #bots :nothing to see here, move along\r\n"));
+}
@@ -0,0 +1,244 @@
+#include "channel_log.hpp"
+
+#include <gtest/gtest.h>
+
+#include <fmt/format.h>
+
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct ChannelLog : public ::testing::Test
+{
+    ChannelLog()
+    {
+        directory = ::testing::TempDir() + "channel_log_test";
+        std::filesystem::remove_all(directory);
+        options.directory = directory;
+        options.sync = false;
+        options.index_interval = 64;
+    }
+
+    ~ChannelLog()
+    {
+        std::filesystem::remove_all(directory);
+    }
+
+    // The texts of the records from `from` on
+    std::vector<std::string> texts(channel_log::clock::time_point from = {})
+    {
+        std::vector<std::string> result;
+        channel_log_reader reader(directory);
+        reader.scan(from, [&] (const channel_log_reader::record& r) {
+            result.emplace_back(r.text);
+            return true;
+        });
+        return result;
+    }
+
+    // Searches and waits for the hits
+    std::vector<channel_log::search_hit> search(channel_log& log, std::string_view channel, std::string_view query)
+    {
+        std::vector<channel_log::search_hit> result;
+        log.search(channel, query, 10, [&] (std::vector<channel_log::search_hit> hits) {
+            result = std::move(hits);
+            answered_on = std::this_thread::get_id();
+        });
+        log.flush();
+        return result;
+    }
+
+    std::string directory;
+    channel_log_options options;
+    std::thread::id answered_on;
+    const channel_log::clock::time_point start = channel_log::clock::time_point(1700000000s);
+};
+
+}
+
+TEST_F(ChannelLog, test_records_are_read_back_with_their_names)
+{
+    {
+        channel_log log(options);
+        log.append(log_kind::join, "#bots", "alice", {}, start);
+        log.append(log_kind::privmsg, "#bots", "alice", "hello there", start + 1s);
+        log.append(log_kind::nick, {}, "alice", "alice_", start + 2s);
+        log.flush();
+        EXPECT_EQ(3, log.appended());
+    }
+
+    channel_log_reader reader(directory);
+    std::vector<channel_log_reader::record> records;
+    reader.scan({}, [&] (const channel_log_reader::record& r) {
+        records.push_back(r);
+        return true;
+    });
+
+    ASSERT_EQ(3, records.size());
+    EXPECT_EQ(log_kind::join, records[0].kind);
+    EXPECT_EQ("#bots", records[0].channel);
+    EXPECT_EQ("alice", records[0].nick);
+    EXPECT_EQ(start, records[0].time);
+    EXPECT_EQ(log_kind::privmsg, records[1].kind);
+    EXPECT_EQ("hello there", records[1].text);
+    EXPECT_EQ(start + 1s, records[1].time);
+    EXPECT_EQ(log_kind::nick, records[2].kind);
+    EXPECT_EQ("", records[2].channel);
+    EXPECT_EQ("alice_", records[2].text);
+}
+
+TEST_F(ChannelLog, test_scan_starts_at_the_given_time)
+{
+    {
+        channel_log log(options);
+        for (int i = 0; i < 100; ++i) {
+            log.append(log_kind::privmsg, "#bots", "bob", std::to_string(i), start + std::chrono::seconds(i));
+        }
+    }
+
+    const auto from_50 = texts(start + 50s);
+    ASSERT_EQ(50, from_50.size());
+    EXPECT_EQ("50", from_50.front());
+    EXPECT_EQ("99", from_50.back());
+
+    EXPECT_EQ(100, texts(start - 1h).size());
+    EXPECT_EQ(0, texts(start + 1h).size());
+}
+
+TEST_F(ChannelLog, test_scan_stops_when_asked)
+{
+    {
+        channel_log log(options);
+        for (int i = 0; i < 10; ++i) {
+            log.append(log_kind::privmsg, "#bots", "bob", std::to_string(i), start);
+        }
+    }
+
+    channel_log_reader reader(directory);
+    int seen = 0;
+    reader.scan({}, [&] (const channel_log_reader::record&) { return ++seen < 3; });
+    EXPECT_EQ(3, seen);
+}
+
+TEST_F(ChannelLog, test_full_segments_roll_over)
+{
+    options.segment_bytes = 256;
+    {
+        channel_log log(options);
+        for (int i = 0; i < 40; ++i) {
+            log.append(log_kind::privmsg, "#bots", "bob", fmt::format("message {:02}", i), start + std::chrono::seconds(i));
+        }
+    }
+
+    channel_log_reader reader(directory);
+    EXPECT_GT(reader.segment_count(), 1);
+    const auto from_30 = texts(start + 30s);
+    ASSERT_EQ(10, from_30.size());
+    EXPECT_EQ("message 30", from_30.front());
+}
+
+TEST_F(ChannelLog, test_names_keep_their_ids_across_restarts)
+{
+    {
+        channel_log log(options);
+        log.append(log_kind::privmsg, "#bots", "alice", "first run", start);
+    }
+    {
+        channel_log log(options);
+        log.append(log_kind::privmsg, "#bots", "carol", "second run", start + 1s);
+        log.append(log_kind::privmsg, "#bots", "Alice", "same nick", start + 2s);
+    }
+
+    channel_log_reader reader(directory);
+    EXPECT_EQ(2, reader.segment_count());
+    std::vector<channel_log_reader::record> records;
+    reader.scan({}, [&] (const channel_log_reader::record& r) {
+        records.push_back(r);
+        return true;
+    });
+
+    ASSERT_EQ(3, records.size());
+    EXPECT_EQ(records[0].nick_id, records[2].nick_id);
+    EXPECT_EQ("alice", records[2].nick);
+    EXPECT_EQ("carol", records[1].nick);
+    EXPECT_EQ(records[0].nick_id, reader.find("ALICE"));
+}
+
+TEST_F(ChannelLog, test_times_never_go_backwards)
+{
+    {
+        channel_log log(options);
+        log.append(log_kind::privmsg, "#bots", "bob", "later", start + 10s);
+        log.append(log_kind::privmsg, "#bots", "bob", "clock stepped back", start);
+    }
+
+    channel_log_reader reader(directory);
+    std::vector<channel_log::clock::time_point> times;
+    reader.scan({}, [&] (const channel_log_reader::record& r) {
+        times.push_back(r.time);
+        return true;
+    });
+    ASSERT_EQ(2, times.size());
+    EXPECT_EQ(start + 10s, times[1]);
+}
+
+TEST_F(ChannelLog, test_records_are_dropped_when_too_much_is_waiting)
+{
+    options.max_pending = 100;
+    options.commit_interval = 1h;
+    channel_log log(options);
+
+    log.append(log_kind::privmsg, "#bots", "bob", "fits", start);
+    log.append(log_kind::privmsg, "#bots", "bob", std::string(100, 'x'), start);
+
+    EXPECT_EQ(1, log.appended());
+    EXPECT_EQ(1, log.dropped());
+    log.flush();
+    EXPECT_EQ(std::vector<std::string>{ "fits" }, texts());
+}
+
+TEST_F(ChannelLog, test_messages_are_searched_once_written)
+{
+    options.search = true;
+    {
+        channel_log log(options);
+        log.append(log_kind::privmsg, "#bots", "alice", "the build is broken", start);
+        log.append(log_kind::privmsg, "#other", "bob", "the build is broken here too", start + 1s);
+        log.append(log_kind::privmsg, "#bots", "carol", ".grep build broken", start + 2s);
+        log.append(log_kind::join, "#bots", "dave", {}, start + 3s);
+
+        const auto hits = search(log, "#BOTS", "Broken build");
+        ASSERT_EQ(1, hits.size());
+        EXPECT_NE(std::this_thread::get_id(), answered_on);
+        EXPECT_EQ(start, hits[0].time);
+        EXPECT_EQ("alice", log.name(hits[0].nick));
+        EXPECT_EQ("the build is broken", hits[0].text);
+        EXPECT_TRUE(search(log, "#nowhere", "build").empty());
+    }
+
+    // earlier runs are indexed when the log is opened again
+    channel_log log(options);
+    log.append(log_kind::privmsg, "#bots", "alice", "fixed the build", start + 4s);
+    const auto hits = search(log, "#bots", "build");
+    ASSERT_EQ(2, hits.size());
+    EXPECT_EQ("the build is broken", hits[0].text);
+    EXPECT_EQ("fixed the build", hits[1].text);
+}
+
+TEST_F(ChannelLog, test_record_cut_short_is_ignored)
+{
+    {
+        channel_log log(options);
+        log.append(log_kind::privmsg, "#bots", "bob", "whole", start);
+        log.append(log_kind::privmsg, "#bots", "bob", "cut short", start);
+    }
+    const std::string segment = log_format::segment_path(directory, 1);
+    std::filesystem::resize_file(segment, std::filesystem::file_size(segment) - 3);
+
+    EXPECT_EQ(std::vector<std::string>{ "whole" }, texts());
+}
@@ -0,0 +1,240 @@
+#include "channel_state.hpp"
+#include "string_interner.hpp"
+
+#include <gtest/gtest.h>
+
+#include <fmt/format.h>
+
+#include <string>
+
+TEST(StringInterner, test_equal_names_share_an_id)
+{
+    string_interner strings;
+
+    const auto a = strings.intern("Nick[1]");
+    const auto b = strings.intern("nick{1}");
+    const auto c = strings.intern("other");
+
+    EXPECT_EQ(a, b);
+    EXPECT_NE(a, c);
+    EXPECT_EQ(2, strings.size());
+    EXPECT_EQ("Nick[1]", strings.str(a));
+    EXPECT_EQ(a, strings.find("NICK[1]"));
+    EXPECT_EQ(string_interner::npos, strings.find("unknown"));
+}
+
+TEST(StringInterner, test_ids_are_dense_and_stable_across_growth)
+{
+    string_interner strings;
+    for (int i = 0; i < 10000; ++i) {
+        EXPECT_EQ(i, strings.intern("nick" + std::to_string(i)));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        EXPECT_EQ(i, strings.find("NICK" + std::to_string(i)));
+        EXPECT_EQ("nick" + std::to_string(i), strings.str(i));
+    }
+}
+
+TEST(StringInterner, test_released_ids_are_reused)
+{
+    string_interner strings;
+
+    const auto a = strings.acquire("a");
+    EXPECT_EQ(a, strings.acquire("A"));
+    const auto b = strings.acquire("b");
+
+    EXPECT_FALSE(strings.release(a));
+    EXPECT_TRUE(strings.release(a));
+    EXPECT_EQ(string_interner::npos, strings.find("a"));
+    EXPECT_EQ(1, strings.size());
+
+    EXPECT_EQ(a, strings.acquire("c"));
+    EXPECT_EQ("c", strings.str(a));
+    EXPECT_EQ(b, strings.find("b"));
+}
+
+TEST(StringInterner, test_interned_strings_are_never_released)
+{
+    string_interner strings;
+
+    const auto a = strings.acquire("a");
+    EXPECT_EQ(a, strings.intern("a"));
+    EXPECT_FALSE(strings.release(a));
+    EXPECT_EQ(a, strings.find("a"));
+}
+
+TEST(StringInterner, test_lookups_survive_releases)
+{
+    string_interner strings;
+    for (int i = 0; i < 10000; ++i) {
+        strings.acquire("nick" + std::to_string(i));
+    }
+    for (int i = 0; i < 10000; i += 2) {
+        EXPECT_TRUE(strings.release(strings.find("nick" + std::to_string(i))));
+    }
+
+    EXPECT_EQ(5000, strings.size());
+    for (int i = 0; i < 10000; ++i) {
+        const auto id = strings.find("nick" + std::to_string(i));
+        if (i % 2 == 0) {
+            EXPECT_EQ(string_interner::npos, id);
+        } else {
+            ASSERT_NE(string_interner::npos, id);
+            EXPECT_EQ("nick" + std::to_string(i), strings.str(id));
+        }
+    }
+}
+
+struct ChannelState : public ::testing::Test
+{
+    ChannelState()
+        : state(strings)
+    {
+        state.subscribe(events);
+        publish(":server 001 borky :Welcome");
+        publish(":borky!bot@bot.host JOIN #bots");
+        publish(":server 353 borky = #bots :borky @op +voice");
+        publish(":server 353 borky = #bots :plain");
+        publish(":server 366 borky #bots :End of /NAMES list.");
+    }
+
+    void publish(std::string_view line)
+    {
+        events.publish(*parse_irc_message(line));
+    }
+
+    std::size_t member_count(std::string_view channel)
+    {
+        auto* members = state.members(channel);
+        return members ? members->size() : 0;
+    }
+
+    string_interner strings;
+    channel_state state;
+    event_bus events;
+};
+
+TEST_F(ChannelState, test_names_reply_sets_members)
+{
+    EXPECT_EQ(4, member_count("#bots"));
+    EXPECT_TRUE(state.is_member("#bots", "borky"));
+    EXPECT_TRUE(state.is_member("#BOTS", "OP"));
+    EXPECT_TRUE(state.is_member("#bots", "voice"));
+    EXPECT_TRUE(state.is_member("#bots", "plain"));
+    EXPECT_FALSE(state.is_member("#bots", "@op"));
+}
+
+TEST_F(ChannelState, test_join_part_kick_quit)
+{
+    publish(":new!user@new.host JOIN #bots");
+    EXPECT_TRUE(state.is_member("#bots", "new"));
+    EXPECT_EQ("new.host", strings.str(state.host("new")));
+
+    publish(":new!user@new.host PART #bots :bye");
+    EXPECT_FALSE(state.is_member("#bots", "new"));
+
+    publish(":op!user@host KICK #bots voice :no");
+    EXPECT_FALSE(state.is_member("#bots", "voice"));
+
+    publish(":plain!user@host QUIT :gone");
+    EXPECT_FALSE(state.is_member("#bots", "plain"));
+
+    EXPECT_EQ(2, member_count("#bots"));
+}
+
+TEST_F(ChannelState, test_nick_change_moves_membership)
+{
+    publish(":plain!user@host NICK :fancy");
+
+    EXPECT_FALSE(state.is_member("#bots", "plain"));
+    EXPECT_TRUE(state.is_member("#bots", "fancy"));
+    EXPECT_EQ(4, member_count("#bots"));
+}
+
+TEST_F(ChannelState, test_own_part_and_kick_forget_the_channel)
+{
+    publish(":borky!bot@bot.host JOIN #other");
+    EXPECT_EQ(2, state.channel_count());
+
+    publish(":borky!bot@bot.host PART #bots");
+    EXPECT_EQ(nullptr, state.members("#bots"));
+
+    publish(":op!user@host KICK #other borky :out");
+    EXPECT_EQ(0, state.channel_count());
+}
+
+TEST_F(ChannelState, test_own_nick_change_is_tracked)
+{
+    publish(":borky!bot@bot.host NICK :borky_");
+    publish(":borky_!bot@bot.host JOIN #other");
+
+    EXPECT_EQ(2, state.channel_count());
+    EXPECT_TRUE(state.is_member("#other", "borky_"));
+}
+
+TEST_F(ChannelState, test_names_for_unknown_channel_are_ignored)
+{
+    publish(":server 353 borky = #elsewhere :someone");
+    publish(":server 366 borky #elsewhere :End of /NAMES list.");
+
+    EXPECT_EQ(nullptr, state.members("#elsewhere"));
+}
+
+TEST_F(ChannelState, test_userhost_in_names)
+{
+    publish(":borky!bot@bot.host JOIN #other");
+    publish(":server 353 borky @ #other :@op!o@op.host someone!s@some.host");
+    publish(":server 366 borky #other :End of /NAMES list.");
+
+    EXPECT_EQ(2, member_count("#other"));
+    EXPECT_EQ("some.host", strings.str(state.host("someone")));
+}
+
+TEST_F(ChannelState, test_large_channel_stays_small)
+{
+    publish(":borky!bot@bot.host JOIN #huge");
+    for (int block = 0; block < 50; ++block) {
+        std::string names;
+        for (int i = 0; i < 1000; ++i) {
+            names += fmt::format("nick{}_{} ", block, i);
+        }
+        publish(":server 353 borky = #huge :" + names);
+    }
+    publish(":server 366 borky #huge :End of /NAMES list.");
+
+    EXPECT_EQ(50000, member_count("#huge"));
+    EXPECT_TRUE(state.is_member("#huge", "NICK49_999"));
+    EXPECT_LT(state.memory_usage(), 4u * 1024 * 1024);
+}
+
+TEST_F(ChannelState, test_departed_nicks_are_forgotten)
+{
+    const auto baseline = strings.size();
+    for (int i = 0; i < 10000; ++i) {
+        const auto nick = fmt::format("visitor{}", i);
+        publish(fmt::format(":{0}!user@{0}.host JOIN #bots", nick));
+        publish(fmt::format(":{}!user@host PART #bots", nick));
+    }
+
+    EXPECT_EQ(baseline, strings.size());
+    EXPECT_LT(state.memory_usage(), 64u * 1024);
+    EXPECT_EQ(string_interner::npos, strings.find("visitor0.host"));
+}
+
+TEST_F(ChannelState, test_nick_change_moves_host_and_forgets_old_nick)
+{
+    publish(":new!user@new.host JOIN #bots");
+    publish(":new!user@new.host NICK :newer");
+
+    EXPECT_EQ(string_interner::npos, strings.find("new"));
+    EXPECT_EQ("new.host", strings.str(state.host("newer")));
+}
+
+TEST_F(ChannelState, test_nick_change_of_unknown_nick_is_ignored)
+{
+    const auto baseline = strings.size();
+    publish(":stranger!user@host NICK :stranger2");
+
+    EXPECT_EQ(baseline, strings.size());
+    EXPECT_EQ(string_interner::npos, strings.find("stranger2"));
+}
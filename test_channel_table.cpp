@@ -0,0 +1,102 @@
+#include "casemap.hpp"
+#include "channel_table.hpp"
+
+#include <gtest/gtest.h>
+
+using namespace std::chrono_literals;
+
+TEST(Casemap, test_rfc1459_casemapping)
+{
+    EXPECT_TRUE(irc_equals("#Bots", "#bots"));
+    EXPECT_TRUE(irc_equals("nick[]\\^", "NICK{}|~"));
+    EXPECT_FALSE(irc_equals("#bots", "#bots2"));
+    EXPECT_EQ(irc_hash("Nick[away]"), irc_hash("nick{AWAY}"));
+    EXPECT_EQ("nick{away}", irc_fold("NICK[Away]"));
+}
+
+TEST(ChannelTable, test_find_is_case_insensitive)
+{
+    channel_table channels({ { "#Bots", {} }, { "#C++", {} } });
+
+    ASSERT_NE(nullptr, channels.find("#bots"));
+    EXPECT_EQ("#Bots", channels.find("#BOTS")->name);
+    EXPECT_EQ("#C++", channels.find("#c++")->name);
+    EXPECT_EQ(nullptr, channels.find("#bot"));
+    EXPECT_EQ(nullptr, channels.find(""));
+}
+
+TEST(ChannelTable, test_find_in_empty_table)
+{
+    channel_table channels;
+    EXPECT_EQ(nullptr, channels.find("#bots"));
+}
+
+TEST(ChannelTable, test_replace_keeps_other_channels)
+{
+    channel_table channels;
+    for (int i = 0; i < 100; ++i) {
+        channels.insert({ "#channel" + std::to_string(i), {} });
+    }
+    channel_settings settings;
+    settings.youtube = false;
+    channel& replaced = channels.replace(*channels.find("#channel42"), "#other", settings);
+
+    EXPECT_EQ(100, channels.size());
+    EXPECT_EQ(&replaced, channels.find("#OTHER"));
+    EXPECT_FALSE(replaced.settings.youtube);
+    EXPECT_EQ(nullptr, channels.find("#channel42"));
+    for (int i = 0; i < 100; ++i) {
+        if (i != 42) {
+            EXPECT_NE(nullptr, channels.find("#channel" + std::to_string(i))) << i;
+        }
+    }
+}
+
+TEST(ChannelTable, test_many_channels)
+{
+    channel_table channels;
+    for (int i = 0; i < 100; ++i) {
+        channels.insert({ "#channel" + std::to_string(i), {} });
+    }
+
+    EXPECT_EQ(100, channels.size());
+    for (int i = 0; i < 100; ++i) {
+        auto* chan = channels.find("#CHANNEL" + std::to_string(i));
+        ASSERT_NE(nullptr, chan);
+        EXPECT_EQ("#channel" + std::to_string(i), chan->name);
+    }
+}
+
+TEST(ChannelTable, test_insert_existing_channel_replaces_settings)
+{
+    channel_table channels;
+    channels.insert({ "#bots", {} });
+
+    channel_settings settings;
+    settings.youtube = false;
+    channels.insert({ "#BOTS", settings });
+
+    EXPECT_EQ(1, channels.size());
+    EXPECT_FALSE(channels.find("#bots")->settings.youtube);
+}
+
+TEST(RateLimiter, test_refills_over_the_period)
+{
+    rate_limiter limiter(2, 1min);
+    const auto now = rate_limiter::clock::now();
+
+    EXPECT_TRUE(limiter.try_acquire(now));
+    EXPECT_TRUE(limiter.try_acquire(now));
+    EXPECT_FALSE(limiter.try_acquire(now));
+    EXPECT_FALSE(limiter.try_acquire(now + 29s));
+    EXPECT_TRUE(limiter.try_acquire(now + 31s));
+    EXPECT_FALSE(limiter.try_acquire(now + 31s));
+}
+
+TEST(RateLimiter, test_zero_limit_is_unlimited)
+{
+    rate_limiter limiter;
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(limiter.try_acquire());
+    }
+}
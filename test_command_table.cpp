@@ -0,0 +1,73 @@
+#include "command_table.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr auto commands = make_command_table(
+    ".hello", ".help", ".seen", ".last", ".grep", ".yt", ".weather", ".time",
+    ".uptime", ".version", ".ping", ".source", ".quote", ".addquote", ".tell", ".remind"
+);
+
+static_assert(commands.find(".hello") == 0);
+static_assert(commands.find(".remind") == commands.size() - 1);
+static_assert(commands.find(".nope") == decltype(commands)::npos);
+
+}
+
+TEST(CommandTable, test_every_command_is_found_at_its_index)
+{
+    for (std::size_t i = 0; i < commands.size(); ++i) {
+        EXPECT_EQ(i, commands.find(commands.name(i)));
+    }
+}
+
+TEST(CommandTable, test_unknown_commands_are_not_found)
+{
+    EXPECT_EQ(decltype(commands)::npos, commands.find(""));
+    EXPECT_EQ(decltype(commands)::npos, commands.find("hello"));
+    EXPECT_EQ(decltype(commands)::npos, commands.find(".hell"));
+    EXPECT_EQ(decltype(commands)::npos, commands.find(".helloo"));
+    EXPECT_EQ(decltype(commands)::npos, commands.find(".HELLO"));
+}
+
+TEST(CommandTable, test_split_command)
+{
+    EXPECT_EQ(std::make_pair(std::string_view(".seen"), std::string_view("nick")), split_command(".seen nick"));
+    EXPECT_EQ(std::make_pair(std::string_view(".seen"), std::string_view("nick")), split_command(".seen   nick"));
+    EXPECT_EQ(std::make_pair(std::string_view(".hello"), std::string_view()), split_command(".hello"));
+}
+
+TEST(CommandDispatcher, test_dispatch_calls_registered_handler_with_arguments)
+{
+    command_dispatcher<commands.size(), int> dispatcher(commands);
+
+    std::vector<std::pair<std::string, int>> calls;
+    dispatcher.on<commands.find(".seen")>([&] (std::string_view args, int value) {
+        calls.emplace_back(std::string(args), value);
+    });
+
+    EXPECT_TRUE(dispatcher.dispatch(".seen someone", 42));
+    ASSERT_EQ(1, calls.size());
+    EXPECT_EQ("someone", calls[0].first);
+    EXPECT_EQ(42, calls[0].second);
+}
+
+TEST(CommandDispatcher, test_unknown_or_unhandled_commands_are_not_dispatched)
+{
+    command_dispatcher<commands.size()> dispatcher(commands);
+
+    std::size_t call_count = 0;
+    dispatcher.on<commands.find(".hello")>([&] (std::string_view) { ++call_count; });
+
+    EXPECT_FALSE(dispatcher.dispatch(".seen someone"));
+    EXPECT_FALSE(dispatcher.dispatch(".unknown"));
+    EXPECT_FALSE(dispatcher.dispatch("hello .hello"));
+    EXPECT_EQ(0, call_count);
+
+    EXPECT_TRUE(dispatcher.dispatch(".hello"));
+    EXPECT_EQ(1, call_count);
+}
@@ -0,0 +1,182 @@
+#include "coro_stream.hpp"
+#include "self_signed_cert.hpp"
+
+#include <gtest/gtest.h>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+
+#include <thread>
+
+namespace {
+
+using tcp = boost::asio::ip::tcp;
+using ssl_stream = boost::asio::ssl::stream<tcp::socket>;
+
+tcp::endpoint loopback()
+{
+    return tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0);
+}
+
+// Runs the coroutine to completion and rethrows what it threw
+void run(boost::asio::io_context& io_context, boost::asio::awaitable<void> coroutine)
+{
+    std::exception_ptr error;
+    boost::asio::co_spawn(io_context, std::move(coroutine), [&error] (std::exception_ptr e) { error = e; });
+    io_context.run();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+boost::system::error_code error_of(boost::asio::io_context& io_context, boost::asio::awaitable<void> coroutine)
+{
+    try {
+        run(io_context, std::move(coroutine));
+    } catch (const boost::system::system_error& e) {
+        return e.code();
+    }
+    return {};
+}
+
+}
+
+TEST(CoroStream, test_read_lines_and_write_replies)
+{
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, loopback());
+    const auto port = std::to_string(acceptor.local_endpoint().port());
+
+    std::vector<std::string> replies;
+    std::thread server([&acceptor, &replies] {
+        tcp::socket socket(acceptor.get_executor());
+        acceptor.accept(socket);
+        boost::asio::write(socket, boost::asio::buffer(std::string_view("PING :1\r\n\r\nPING :2\r\n")));
+
+        boost::asio::streambuf buffer;
+        while (replies.size() < 2) {
+            boost::asio::read_until(socket, buffer, "\n");
+            std::istream is(&buffer);
+            std::string line;
+            std::getline(is, line, '\r');
+            is.ignore();
+            replies.push_back(line);
+        }
+    });
+
+    tcp::socket socket(io_context);
+    coro_stream<tcp::socket> irc(socket);
+    std::vector<std::string> lines;
+
+    run(io_context, [&] () -> boost::asio::awaitable<void> {
+        co_await irc.connect("127.0.0.1", port);
+        for (int i = 0; i < 2; ++i) {
+            std::string_view line = co_await irc.read_line();
+            lines.emplace_back(line);
+            co_await irc.write("PONG " + std::string(line.substr(5)) + "\r\n");
+        }
+    }());
+    server.join();
+
+    EXPECT_EQ((std::vector<std::string>{ "PING :1", "PING :2" }), lines);
+    EXPECT_EQ((std::vector<std::string>{ "PONG :1", "PONG :2" }), replies);
+    EXPECT_EQ(0, irc.handler_memory_misses());
+}
+
+TEST(CoroStream, test_tls_connect_and_read)
+{
+    boost::asio::io_context io_context;
+    boost::asio::ssl::context server_context(boost::asio::ssl::context::tls_server);
+    use_self_signed_certificate(server_context);
+    tcp::acceptor acceptor(io_context, loopback());
+    const auto port = std::to_string(acceptor.local_endpoint().port());
+
+    std::thread server([&acceptor, &server_context] {
+        boost::asio::io_context server_io;
+        ssl_stream stream(server_io, server_context);
+        acceptor.accept(stream.lowest_layer());
+        stream.handshake(ssl_stream::server);
+        boost::asio::write(stream, boost::asio::buffer(std::string_view(":server 001 borky :hi\r\n")));
+        boost::system::error_code ec;
+        char c;
+        boost::asio::read(stream, boost::asio::buffer(&c, 1), ec);
+    });
+
+    boost::asio::ssl::context client_context(boost::asio::ssl::context::tls_client);
+    ssl_stream stream(io_context, client_context);
+    coro_stream<ssl_stream> irc(stream);
+    std::string line;
+
+    run(io_context, [&] () -> boost::asio::awaitable<void> {
+        co_await irc.connect("127.0.0.1", port);
+        line = co_await irc.read_line();
+        irc.close();
+    }());
+    server.join();
+
+    EXPECT_EQ(":server 001 borky :hi", line);
+}
+
+TEST(CoroStream, test_connect_times_out_when_handshake_stalls)
+{
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, loopback());
+    const auto port = std::to_string(acceptor.local_endpoint().port());
+    // accepted by the kernel, but nobody answers the handshake
+
+    boost::asio::ssl::context client_context(boost::asio::ssl::context::tls_client);
+    ssl_stream stream(io_context, client_context);
+    coro_stream<ssl_stream> irc(stream);
+
+    const auto ec = error_of(io_context, [&] () -> boost::asio::awaitable<void> {
+        co_await irc.connect("127.0.0.1", port, std::chrono::milliseconds(100));
+    }());
+
+    EXPECT_EQ(boost::asio::error::timed_out, ec);
+}
+
+TEST(CoroStream, test_connect_error_is_thrown)
+{
+    boost::asio::io_context io_context;
+    std::string port;
+    {
+        tcp::acceptor acceptor(io_context, loopback());
+        port = std::to_string(acceptor.local_endpoint().port());
+    }
+
+    tcp::socket socket(io_context);
+    coro_stream<tcp::socket> irc(socket);
+
+    const auto ec = error_of(io_context, [&] () -> boost::asio::awaitable<void> {
+        co_await irc.connect("127.0.0.1", port);
+    }());
+
+    EXPECT_EQ(boost::asio::error::connection_refused, ec);
+}
+
+TEST(CoroStream, test_read_error_is_thrown)
+{
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, loopback());
+    const auto port = std::to_string(acceptor.local_endpoint().port());
+
+    std::thread server([&acceptor] {
+        tcp::socket socket(acceptor.get_executor());
+        acceptor.accept(socket);
+        boost::asio::write(socket, boost::asio::buffer(std::string_view("partial")));
+    });
+
+    tcp::socket socket(io_context);
+    coro_stream<tcp::socket> irc(socket);
+
+    const auto ec = error_of(io_context, [&] () -> boost::asio::awaitable<void> {
+        co_await irc.connect("127.0.0.1", port);
+        co_await irc.read_line();
+    }());
+    server.join();
+
+    EXPECT_EQ(boost::asio::error::eof, ec);
+}
+
+#endif
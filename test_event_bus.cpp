@@ -0,0 +1,108 @@
+#include "event_bus.hpp"
+#include "irc_message.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+TEST(IrcMessage, test_parse_privmsg)
+{
+    auto msg = parse_irc_message(":nick!user@host.org PRIVMSG #channel :hello there");
+    ASSERT_TRUE(msg);
+
+    EXPECT_EQ("nick!user@host.org", msg->prefix);
+    EXPECT_EQ("nick", msg->nick());
+    EXPECT_EQ("host.org", msg->host());
+    EXPECT_EQ("PRIVMSG", msg->command);
+    ASSERT_EQ(2, msg->param_count);
+    EXPECT_EQ("#channel", msg->param(0));
+    EXPECT_EQ("hello there", msg->text());
+}
+
+TEST(IrcMessage, test_parse_without_prefix)
+{
+    auto msg = parse_irc_message("PING :irc.hostname.org");
+    ASSERT_TRUE(msg);
+
+    EXPECT_EQ("", msg->prefix);
+    EXPECT_EQ("PING", msg->command);
+    EXPECT_EQ("irc.hostname.org", msg->text());
+}
+
+TEST(IrcMessage, test_parse_tags_and_middle_params)
+{
+    auto msg = parse_irc_message("@time=2020-01-01T00:00:00Z :server 353 borky = #bots :borky @op +voice");
+    ASSERT_TRUE(msg);
+
+    EXPECT_EQ("time=2020-01-01T00:00:00Z", msg->tags);
+    EXPECT_EQ("server", msg->nick());
+    EXPECT_EQ("353", msg->command);
+    ASSERT_EQ(4, msg->param_count);
+    EXPECT_EQ("borky", msg->param(0));
+    EXPECT_EQ("=", msg->param(1));
+    EXPECT_EQ("#bots", msg->param(2));
+    EXPECT_EQ("borky @op +voice", msg->param(3));
+    EXPECT_EQ("", msg->param(4));
+}
+
+TEST(IrcMessage, test_parse_empty_line_fails)
+{
+    EXPECT_FALSE(parse_irc_message(""));
+    EXPECT_FALSE(parse_irc_message(":prefix.only"));
+}
+
+TEST(EventBus, test_command_ids)
+{
+    EXPECT_EQ(1, event_bus::command_id("001"));
+    EXPECT_EQ(353, event_bus::command_id("353"));
+    EXPECT_EQ(event_bus::other, event_bus::command_id("FOO"));
+    EXPECT_EQ(event_bus::other, event_bus::command_id("01"));
+    EXPECT_NE(event_bus::command_id("PING"), event_bus::command_id("PONG"));
+    EXPECT_LT(event_bus::command_id("PRIVMSG"), event_bus::other);
+}
+
+TEST(EventBus, test_publish_only_reaches_subscribers_of_the_command)
+{
+    event_bus events;
+    std::vector<std::string> calls;
+
+    events.subscribe("PING", [&] (const irc_message& msg) {
+        calls.emplace_back("ping " + std::string(msg.text()));
+    });
+    events.subscribe("001", [&] (const irc_message&) {
+        calls.emplace_back("welcome");
+    });
+    events.subscribe_other([&] (const irc_message& msg) {
+        calls.emplace_back("other " + std::string(msg.command));
+    });
+
+    events.publish(*parse_irc_message("PING :token"));
+    events.publish(*parse_irc_message(":server 001 borky :Welcome"));
+    events.publish(*parse_irc_message(":server 002 borky :Your host"));
+    events.publish(*parse_irc_message(":server FOO bar"));
+
+    ASSERT_EQ(3, calls.size());
+    EXPECT_EQ("ping token", calls[0]);
+    EXPECT_EQ("welcome", calls[1]);
+    EXPECT_EQ("other FOO", calls[2]);
+}
+
+TEST(EventBus, test_subscribers_are_called_in_subscription_order)
+{
+    event_bus events;
+    std::vector<int> calls;
+
+    events.subscribe("PRIVMSG", [&] (const irc_message&) { calls.push_back(1); });
+    events.subscribe("PRIVMSG", [&] (const irc_message&) { calls.push_back(2); });
+
+    events.publish(*parse_irc_message(":a!b@c PRIVMSG #bots :hi"));
+
+    EXPECT_EQ((std::vector<int>{1, 2}), calls);
+}
+
+TEST(EventBus, test_subscribe_to_unknown_command_throws)
+{
+    event_bus events;
+    EXPECT_THROW(events.subscribe("FOO", [] (const irc_message&) {}), std::invalid_argument);
+}
@@ -0,0 +1,566 @@
+#ifndef TEST_FAKES_HPP
+#define TEST_FAKES_HPP
+
+// Stand-ins for the resolver, sockets, streams and timers that net_stream
+// runs on, driven by hand: the tests and replay_bench decide when a name
+// resolves, a connect or handshake completes, data arrives or time passes.
+
+#include "alloc_accounting.hpp"
+
+#include <utility> // before asio, its awaitable.hpp uses std::exchange
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl/stream_base.hpp>
+#include <boost/asio/ts/io_context.hpp>
+
+#include <fmt/format.h>
+#include <fmt/chrono.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <map>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ManualExecutor
+{
+public:
+    ManualExecutor(boost::asio::io_context& context)
+        : context_(context)
+    {}
+
+    void run()
+    {
+        context_.run();
+        context_.restart();
+    }
+
+private:
+    boost::asio::io_context& context_;
+};
+
+class FakeTcpSocket;
+
+struct fake_tcp {
+    using endpoint = boost::asio::ip::tcp::endpoint;
+    using socket = FakeTcpSocket;
+};
+
+class FakeResolver
+{
+public:
+    using results_type = boost::asio::ip::tcp::resolver::results_type;
+    using error_code = boost::system::error_code;
+    using resolve_callback = std::function<void (const error_code&, results_type)>;
+
+    FakeResolver(boost::asio::io_context& ioctx)
+        : io_context(ioctx)
+    {}
+
+    struct resolve_request{
+        std::string name;
+        std::string port;
+        resolve_callback callback;
+        bool active;
+        bool canceled;
+    };
+
+    void async_resolve(
+        std::string name,
+        std::string port,
+        resolve_callback callback)
+    {
+        requests.emplace_back(
+            resolve_request{
+                std::move(name),
+                std::move(port),
+                std::move(callback),
+                true,
+                false,
+            }
+        );
+    }
+
+    void cancel()
+    {
+        std::for_each(
+            std::begin(requests), std::end(requests),
+            [] (auto& request) {
+                request.canceled = true;
+            }
+        );
+    }
+
+    void simulate_resolve()
+    {
+        simulate_resolve({
+            boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("10.0.0.2"), 6667),
+        });
+    }
+
+    void simulate_resolve(std::vector<boost::asio::ip::tcp::endpoint> eps)
+    {
+        if (requests.empty())
+            throw std::logic_error("Resolver requests is empty");
+
+        auto request = std::move(requests[0]);
+        requests.erase(requests.begin());
+
+        auto results = results_type::create(eps.begin(), eps.end(), "irc.hostname.org", "6667");
+
+        boost::asio::post(
+            io_context,
+            [request, results] { request.callback(boost::system::error_code(), results); }
+        );
+    }
+
+    void simulate_error()
+    {
+        if (requests.empty())
+            throw std::logic_error("Resolver requests is empty");
+
+        auto request = std::move(requests[0]);
+        requests.erase(requests.begin());
+
+        boost::asio::post(
+            io_context,
+            [request = std::move(request)] {
+                request.callback(boost::asio::error::fault, {});
+            }
+        );
+    }
+
+    boost::asio::io_context& io_context;
+    std::vector<resolve_request> requests;
+};
+
+class SocketListener
+{
+public:
+    using connect_callback = std::function<void(boost::system::error_code)>;
+
+    static SocketListener* instance()
+    {
+        static SocketListener listener;
+        return &listener;
+    }
+
+    void reset()
+    {
+        pending_connects.clear();
+        options.clear();
+    }
+
+    struct socket_option {
+        int level;
+        int name;
+        int value;
+    };
+    std::vector<socket_option> options;
+
+    struct pending_connect
+    {
+        boost::asio::ip::tcp::endpoint endpoint;
+        connect_callback callback;
+    };
+    std::vector<pending_connect> pending_connects;
+};
+
+template <typename Executor>
+class boost::asio::basic_socket<fake_tcp, Executor>
+{
+public:
+    using protocol_type = fake_tcp;
+    using native_handle_type = int;
+    using connect_callback = std::function<void(boost::system::error_code)>;
+
+    basic_socket(const Executor& executor)
+        : executor_(executor)
+    {
+    }
+
+    bool is_open()
+    {
+        return true;
+    }
+
+    void close(boost::system::error_code&)
+    {
+    }
+
+    template <typename Protocol>
+    void open(const Protocol&, boost::system::error_code&)
+    {
+    }
+
+    template <typename Option>
+    void set_option(const Option& option, boost::system::error_code&)
+    {
+        const auto protocol = boost::asio::ip::tcp::v4();
+        SocketListener::instance()->options.push_back({
+            option.level(protocol),
+            option.name(protocol),
+            *static_cast<const int*>(option.data(protocol)),
+        });
+    }
+
+    const Executor& get_executor() const
+    {
+        return executor_;
+    }
+
+    void async_connect(boost::asio::ip::tcp::endpoint endpoint, connect_callback&& callback)
+    {
+        fmt::print("{}\n", __func__);
+
+        SocketListener::instance()->pending_connects.emplace_back(
+            SocketListener::pending_connect{
+                endpoint,
+                callback
+            }
+        );
+    }
+
+private:
+    Executor executor_;
+};
+
+class FakeTcpSocket : public boost::asio::basic_stream_socket<fake_tcp, boost::asio::io_context::executor_type>
+{
+public:
+    using connect_callback = std::function<void (boost::system::error_code)>;
+
+    FakeTcpSocket(const boost::asio::io_context::executor_type& exec)
+        : boost::asio::basic_stream_socket<fake_tcp, boost::asio::io_context::executor_type>(exec)
+    {}
+
+    void simulate_error()
+    {
+        if (pending_connects.empty()) {
+            throw std::logic_error("simulate_error with no pending connect requests");
+        }
+
+        auto& request = pending_connects.front();
+        request.callback(boost::asio::error::connection_refused);
+        pending_connects.erase(pending_connects.begin());
+    }
+
+    struct connect_request {
+        boost::asio::ip::tcp::endpoint endpoint;
+        connect_callback callback;
+    };
+    std::vector<connect_request> pending_connects;
+};
+
+// A plaintext stream
+class FakeStream
+{
+public:
+    using executor_type = boost::asio::io_context::executor_type;
+
+    FakeStream(const boost::asio::io_context::executor_type& exec)
+        : executor(exec)
+        , socket(exec)
+    {}
+
+    auto& lowest_layer() { return socket; }
+
+    // Handlers bound to another executor, like a strand, are dispatched to
+    // it like a real stream would
+    using read_callback = std::function<void(boost::system::error_code, std::size_t)>;
+    template <typename Handler>
+    void async_read_some(const boost::asio::mutable_buffer& buffers, Handler&& handler)
+    {
+        // the fake's own bookkeeping isn't the caller's
+        alloc_scope tag(alloc_tag::untagged);
+        auto handler_executor = boost::asio::get_associated_executor(handler, executor);
+        if (buffers.size() == 0) {
+            // async_read_until does this when the buffer already holds a line
+            boost::asio::post(handler_executor, std::bind(std::forward<Handler>(handler), boost::system::error_code(), 0));
+            return;
+        }
+        pending_reads.emplace_back(
+            pending_read{
+                buffers,
+                [handler_executor, handler = std::forward<Handler>(handler)] (boost::system::error_code ec, std::size_t n) mutable {
+                    if constexpr (std::is_same_v<decltype(handler_executor), executor_type>) {
+                        handler(ec, n);
+                    } else {
+                        boost::asio::dispatch(handler_executor, std::bind(std::move(handler), ec, n));
+                    }
+                },
+            }
+        );
+    }
+
+    using write_callback = std::function<void(boost::system::error_code, std::size_t)>;
+    struct write_call {
+        std::string data;
+        write_callback callback;
+        // The caller's buffer, which a real stream keeps reading from until
+        // the callback is called
+        boost::asio::const_buffer buffer;
+
+        std::string_view pending() const
+        {
+            return std::string_view(static_cast<const char*>(buffer.data()), buffer.size());
+        }
+    };
+    std::vector<write_call> writes;
+    template <typename Handler>
+    void async_write_some(const boost::asio::const_buffer& buffer, Handler&& handler)
+    {
+        alloc_scope tag(alloc_tag::untagged);
+        writes.emplace_back(
+            write_call{
+                std::string((char*)buffer.data(), buffer.size()),
+                write_callback(std::forward<Handler>(handler)),
+                buffer,
+            }
+        );
+    }
+
+    void push(std::string_view msg)
+    {
+        if (pending_reads.empty()) {
+            throw std::logic_error("push() with no pending read requests");
+        }
+
+        auto& read_request = pending_reads.front();
+
+        if (read_request.buffers.size() < msg.size()) {
+            throw std::runtime_error("Destination buffer smaller than message size");
+        }
+
+        std::size_t to_write = std::min(msg.size(), read_request.buffers.size());
+        std::memcpy(read_request.buffers.data(), msg.data(), to_write);
+        read_request.callback(boost::system::error_code(), to_write);
+
+        pending_reads.pop_front();
+    }
+
+    void push(boost::system::error_code ec)
+    {
+        if (pending_reads.empty()) {
+            throw std::logic_error("push() with no pending read requests");
+        }
+
+        auto& read_request = pending_reads.front();
+        read_request.callback(ec, 0);
+
+        pending_reads.pop_front();
+    }
+
+    boost::asio::io_context::executor_type executor;
+    FakeTcpSocket socket;
+
+    struct pending_read {
+        boost::asio::mutable_buffer buffers;
+        read_callback callback;
+    };
+    std::list<pending_read> pending_reads;
+};
+
+class FakeSslStream : public FakeStream
+{
+public:
+    static constexpr auto client = boost::asio::ssl::stream_base::client;
+
+    using FakeStream::FakeStream;
+
+    using handshake_callback = std::function<void(boost::system::error_code)>;
+    void async_handshake(boost::asio::ssl::stream_base::handshake_type type, handshake_callback&& callback)
+    {
+        if (type != boost::asio::ssl::stream_base::client) {
+            throw std::logic_error("Expected handshake type \"client\"");
+        }
+        pending_handshakes.emplace_back(std::move(callback));
+    }
+
+    void simulate_handshake()
+    {
+        if (pending_handshakes.empty()) {
+            throw std::logic_error("simulate_handshake with no pending handshake requests");
+        }
+
+        auto& handshake = pending_handshakes.front();
+        boost::asio::post(
+            executor,
+            [handshake = std::move(handshake)] { handshake(boost::system::error_code()); }
+        );
+        pending_handshakes.erase(pending_handshakes.begin());
+    }
+
+    void simulate_handshake_error()
+    {
+        if (pending_handshakes.empty()) {
+            throw std::logic_error("simulate_error with no pending connect requests");
+        }
+
+        auto& handshake = pending_handshakes.front();
+        boost::asio::post(
+            executor,
+            [handshake = std::move(handshake)] { handshake(boost::asio::error::fault); }
+        );
+        pending_handshakes.erase(pending_handshakes.begin());
+    }
+
+    std::vector<handshake_callback> pending_handshakes;
+};
+
+class FakeTimer;
+
+class ManualTimerEngine
+{
+public:
+    static constexpr bool debug = true;
+
+    using timer_type = FakeTimer;
+
+    using timer_callback = std::function<void()>;
+    using duration = std::chrono::milliseconds;
+    using timer_id = std::size_t;
+
+    FakeTimer create_timer();
+
+    timer_id add_timer(duration wait_time, timer_callback callback)
+    {
+        auto id = next_timer_id++;
+        timers.insert(std::pair(current_time_ + wait_time, timer{id, callback}));;
+        if constexpr (debug)
+            fmt::print("{}({}, ...) = {}\n", __func__, wait_time, id);
+        return id;
+    }
+
+    void remove_timer(timer_id id)
+    {
+        if constexpr (debug)
+            fmt::print("{}({})\n", __func__, id);
+        auto timer = std::find_if(
+            std::begin(timers), std::end(timers),
+            [id] (const auto& timer) {
+                return timer.second.id == id;
+            }
+        );
+        if (timer != std::end(timers)) {
+            auto work = timer->second.callback;
+            timers.erase(timer);
+
+        }
+    }
+
+    void advance_time(duration t, ManualExecutor& executor)
+    {
+        if constexpr (debug)
+            fmt::print(">>>>>\n");
+
+        if constexpr (debug)
+            fmt::print("{}({})\n", __func__, t);
+
+        auto end_time = current_time_ + t;
+
+        while (true) {
+            if constexpr (debug)
+                fmt::print("current time: {}\n", current_time_);
+            executor.run();
+
+            if (timers.empty()) {
+                if constexpr (debug)
+                    fmt::print("no more timers\n");
+                break;
+            }
+
+            auto& [next_timer, timer] = *timers.begin();
+            if constexpr (debug)
+                fmt::print("next timer is {} at {}\n", timer.id, next_timer);
+            if (next_timer > end_time) {
+                if constexpr (debug)
+                    fmt::print("next timer is past end time\n");
+                break;
+            }
+
+            if constexpr (debug)
+                fmt::print("Running callback for timer {}\n", timer.id);
+            // taken out first, the callback may cancel or re-arm timers
+            auto node = timers.extract(timers.begin());
+            current_time_ = node.key();
+            node.mapped().callback();
+            executor.run();
+        }
+
+        current_time_ = end_time;
+        fmt::print("current time: {}\n", current_time_);
+
+        if constexpr (debug)
+            fmt::print("<<<<<\n");
+
+    }
+
+private:
+    timer_id next_timer_id = 0;
+    struct timer {
+        timer_id id;
+        timer_callback callback;
+    };
+    std::multimap<duration, timer> timers;
+    duration current_time_;
+};
+
+class FakeTimer
+{
+public:
+    using duration = std::chrono::milliseconds;
+
+    FakeTimer(ManualTimerEngine& engine)
+        : timer_engine(engine)
+    {}
+
+    void expires_after(duration t)
+    {
+        wait = t;
+    }
+
+    void async_wait(std::function<void (const boost::system::error_code&)> work)
+    {
+        id = timer_engine.add_timer(wait, [work] {
+            fmt::print("internal callback\n");
+            work(boost::system::error_code());
+        });
+        fmt::print("{} is waiting\n", *id);
+        cancel_callback = [work] {
+            fmt::print("cancel callback\n");
+            work(boost::asio::error::operation_aborted);
+        };
+    }
+
+    void cancel()
+    {
+        if (id) {
+            fmt::print("{} is canceled\n", *id);
+            timer_engine.remove_timer(*id);
+            if (cancel_callback) {
+                cancel_callback();
+                cancel_callback = nullptr;
+            }
+        }
+    }
+
+private:
+    ManualTimerEngine& timer_engine;
+    std::optional<std::size_t> id;
+    duration wait;
+    std::function<void ()> cancel_callback;
+};
+
+inline FakeTimer ManualTimerEngine::create_timer()
+{
+    return FakeTimer(*this);
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include "handler_memory.hpp"
+#include "net_stream.hpp"
+
+#include <gtest/gtest.h>
+
+#include <boost/asio.hpp>
+
+#include <thread>
+
+namespace {
+
+using tcp = boost::asio::ip::tcp;
+
+class SteadyTimerEngine
+{
+public:
+    using timer_type = boost::asio::steady_timer;
+
+    explicit SteadyTimerEngine(boost::asio::io_context& io_context)
+        : io_context_(io_context)
+    {}
+
+    timer_type create_timer() { return timer_type(io_context_); }
+
+private:
+    boost::asio::io_context& io_context_;
+};
+
+}
+
+TEST(HandlerMemory, test_slot_is_reused)
+{
+    handler_memory<64> memory;
+
+    void* first = memory.allocate(32);
+    memory.deallocate(first);
+    void* second = memory.allocate(64);
+    memory.deallocate(second);
+
+    EXPECT_EQ(first, second);
+    EXPECT_EQ(0, memory.misses());
+}
+
+TEST(HandlerMemory, test_falls_back_to_heap_when_taken_or_too_large)
+{
+    handler_memory<64> memory;
+
+    void* slot = memory.allocate(16);
+    void* taken = memory.allocate(16);
+    void* large = memory.allocate(128);
+
+    EXPECT_NE(slot, taken);
+    EXPECT_NE(slot, large);
+    EXPECT_EQ(2, memory.misses());
+
+    memory.deallocate(taken);
+    memory.deallocate(large);
+    memory.deallocate(slot);
+    EXPECT_EQ(slot, memory.allocate(16));
+}
+
+TEST(HandlerMemory, test_handler_allocator_is_associated)
+{
+    handler_memory<> memory;
+    auto handler = bind_memory(memory, [] {});
+
+    auto allocator = boost::asio::get_associated_allocator(handler);
+    EXPECT_EQ(handler_allocator<int>(memory), handler_allocator<int>(allocator));
+}
+
+// Lines are read and answered over a loopback connection without any
+// handler allocation going to the heap
+TEST(HandlerMemory, test_net_stream_read_write_loop_uses_recycled_memory)
+{
+    constexpr int line_count = 200;
+
+    boost::asio::io_context io_context;
+    tcp::acceptor acceptor(io_context, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0));
+    const auto port = std::to_string(acceptor.local_endpoint().port());
+
+    int answered = 0;
+    std::thread server([&acceptor, &answered] {
+        tcp::socket socket(acceptor.get_executor());
+        acceptor.accept(socket);
+
+        std::string lines;
+        for (int i = 0; i < line_count; ++i) {
+            lines += "PING :" + std::to_string(i) + "\r\n";
+        }
+        boost::asio::write(socket, boost::asio::buffer(lines));
+
+        boost::asio::streambuf buffer;
+        boost::system::error_code ec;
+        while (answered < line_count && boost::asio::read_until(socket, buffer, "\n", ec)) {
+            std::string line;
+            std::istream is(&buffer);
+            std::getline(is, line);
+            if (line.rfind("PONG :", 0) == 0)
+                ++answered;
+        }
+    });
+
+    tcp::resolver resolver(io_context);
+    tcp::socket stream(io_context);
+    SteadyTimerEngine timer_engine(io_context);
+    net_stream<boost::asio::io_context, tcp::socket, tcp::resolver, SteadyTimerEngine> irc(
+        io_context, resolver, stream, timer_engine);
+
+    irc.on_read([&irc] (std::string_view line) {
+        if (line.substr(0, 5) == "PING ") {
+            std::string reply("PONG ");
+            reply += line.substr(5);
+            reply += "\r\n";
+            irc.write(reply);
+        }
+    });
+    irc.on_error([&io_context] (boost::system::error_code) { io_context.stop(); });
+    irc.connect("127.0.0.1", port);
+
+    io_context.run();
+    server.join();
+
+    EXPECT_EQ(line_count, answered);
+    EXPECT_EQ(0, irc.handler_memory_misses());
+}
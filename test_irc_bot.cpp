@@ -0,0 +1,463 @@
+#include "irc_bot.hpp"
+
+#include <gtest/gtest.h>
+
+#include <utility> // before asio, its awaitable.hpp uses std::exchange
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+struct FakeIrc
+{
+    void write(std::string_view message)
+    {
+        writes.emplace_back(message);
+    }
+
+    void flush_backlog()
+    {
+        ++backlog_flushes;
+    }
+
+    std::vector<std::string> writes;
+    std::size_t backlog_flushes = 0;
+};
+
+// Runs the bot on a strand, like net_stream does in main
+struct StrandIrc
+{
+    explicit StrandIrc(boost::asio::io_context& io_context)
+        : strand(boost::asio::make_strand(io_context))
+    {
+    }
+
+    void write(std::string_view message)
+    {
+        EXPECT_TRUE(strand.running_in_this_thread());
+        writes.emplace_back(message);
+    }
+
+    void flush_backlog() {}
+
+    template <typename F>
+    void post(F&& f)
+    {
+        boost::asio::post(strand, std::forward<F>(f));
+    }
+
+    boost::asio::strand<boost::asio::io_context::executor_type> strand;
+    std::vector<std::string> writes;
+};
+
+struct FakeHttpEngine
+{
+    struct request_type {
+        std::string url;
+        std::function<void(std::string)> callback;
+    };
+
+    void execute(request_type&& request)
+    {
+        requests.emplace_back(std::move(request));
+    }
+
+    bool overloaded() const { return overloaded_; }
+
+    std::vector<request_type> requests;
+    bool overloaded_ = false;
+};
+
+}
+
+struct Bot : public ::testing::Test
+{
+    static network_config make_config()
+    {
+        network_config config;
+        config.name = "net";
+        config.server = "irc.hostname.org";
+        config.nick = "borky";
+        config.channels.emplace_back(channel_config{ "#bots", {} });
+
+        channel_settings quiet;
+        quiet.greet = false;
+        quiet.youtube = false;
+        quiet.seen = false;
+        quiet.rate_limit = 1;
+        config.channels.emplace_back(channel_config{ "#Quiet", quiet });
+        return config;
+    }
+
+    Bot()
+        : titles(16, 1h)
+        , shared{ http, titles, "key" }
+        , bot(irc, shared, make_config())
+    {
+    }
+
+    FakeIrc irc;
+    FakeHttpEngine http;
+    title_cache titles;
+    bot_shared<FakeHttpEngine> shared;
+    irc_bot<FakeIrc, FakeHttpEngine> bot;
+};
+
+TEST_F(Bot, test_registers_on_connect)
+{
+    bot.on_connected();
+
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ("NICK borky\r\nUSER borky remotehost remoteserver :Forkey Bot\r\n", irc.writes[0]);
+}
+
+TEST_F(Bot, test_answers_ping)
+{
+    bot.on_read("PING :irc.hostname.org");
+
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ("PONG :irc.hostname.org\r\n", irc.writes[0]);
+}
+
+TEST_F(Bot, test_joins_channels_once_after_mode)
+{
+    bot.on_read(":borky MODE borky :+i");
+    bot.on_read(":borky MODE borky :+w");
+
+    EXPECT_EQ(1, irc.backlog_flushes);
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ(
+        "JOIN #bots\r\nPRIVMSG #bots :C++ is a \x02great\x02 language\r\nJOIN #Quiet\r\n",
+        irc.writes[0]);
+}
+
+TEST_F(Bot, test_joins_again_after_reconnect)
+{
+    bot.on_read(":borky MODE borky :+i");
+    bot.on_connected();
+    bot.on_read(":borky MODE borky :+i");
+
+    ASSERT_EQ(3, irc.writes.size());
+    EXPECT_EQ(0, irc.writes[2].find("JOIN #bots\r\n"));
+}
+
+TEST_F(Bot, test_hello_command)
+{
+    bot.on_read(":someone!user@host PRIVMSG #bots :.hello");
+
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ("PRIVMSG #bots :hi someone\r\n", irc.writes[0]);
+}
+
+TEST_F(Bot, test_youtube_link_is_looked_up_and_cached)
+{
+    bot.on_read(":someone!user@host PRIVMSG #bots :look https://youtu.be/dQw4w9WgXcQ");
+
+    ASSERT_EQ(1, http.requests.size());
+    EXPECT_NE(std::string::npos, http.requests[0].url.find("id=dQw4w9WgXcQ&"));
+    EXPECT_NE(std::string::npos, http.requests[0].url.find("key=key"));
+
+    http.requests[0].callback("title");
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ("PRIVMSG #bots :title\r\n", irc.writes[0]);
+
+    bot.on_read(":other!user@host PRIVMSG #bots :https://youtu.be/dQw4w9WgXcQ again");
+
+    EXPECT_EQ(1, http.requests.size());
+    ASSERT_EQ(2, irc.writes.size());
+    EXPECT_EQ("PRIVMSG #bots :title\r\n", irc.writes[1]);
+}
+
+TEST_F(Bot, test_youtube_lookups_use_the_configured_api)
+{
+    shared.youtube_api = "http://127.0.0.1:8080";
+    bot.on_read(":someone!user@host PRIVMSG #bots :look https://youtu.be/dQw4w9WgXcQ");
+
+    ASSERT_EQ(1, http.requests.size());
+    EXPECT_EQ(0, http.requests[0].url.find("http://127.0.0.1:8080/videos?id=dQw4w9WgXcQ&"));
+}
+
+TEST(BotThreads, test_http_callbacks_are_handled_on_the_bots_executor)
+{
+    boost::asio::io_context io_context;
+    StrandIrc irc(io_context);
+    FakeHttpEngine http;
+    title_cache titles(16, 1h);
+    bot_shared<FakeHttpEngine> shared{ http, titles, "key" };
+    irc_bot<StrandIrc, FakeHttpEngine> bot(irc, shared, Bot::make_config());
+
+    irc.post([&] { bot.on_read(":someone!user@host PRIVMSG #bots :https://youtu.be/dQw4w9WgXcQ"); });
+    io_context.run();
+    io_context.restart();
+    ASSERT_EQ(1, http.requests.size());
+
+    // like CurlEngine, from outside the connection's strand
+    std::thread([&] { http.requests[0].callback("title"); }).join();
+    EXPECT_EQ(0, irc.writes.size());
+    EXPECT_FALSE(titles.find("dQw4w9WgXcQ"));
+
+    io_context.run();
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ("PRIVMSG #bots :title\r\n", irc.writes[0]);
+    EXPECT_TRUE(titles.find("dQw4w9WgXcQ"));
+}
+
+TEST(TitleCache, test_entries_expire)
+{
+    title_cache titles(16, 1h);
+    const auto now = title_cache::clock::now();
+
+    titles.insert("id", "title", now);
+    EXPECT_EQ("title", titles.find("id", now + 1h - 1s));
+    EXPECT_EQ(std::nullopt, titles.find("id", now + 1h));
+    EXPECT_EQ(0, titles.size());
+}
+
+TEST(TitleCache, test_least_recently_used_entry_is_evicted)
+{
+    title_cache titles(2, 1h);
+
+    titles.insert("a", "1");
+    titles.insert("b", "2");
+    EXPECT_TRUE(titles.find("a"));
+    titles.insert("c", "3");
+
+    EXPECT_TRUE(titles.find("a"));
+    EXPECT_FALSE(titles.find("b"));
+    EXPECT_TRUE(titles.find("c"));
+}
+
+TEST(TitleCache, test_sweep_drops_expired_entries)
+{
+    title_cache titles(16, 1h);
+    const auto now = title_cache::clock::now();
+
+    titles.insert("a", "1", now);
+    titles.insert("b", "2", now + 30min);
+
+    EXPECT_EQ(1, titles.sweep(now + 1h));
+    EXPECT_EQ(1, titles.size());
+}
+
+TEST_F(Bot, test_replies_go_to_the_channel_the_message_was_sent_to)
+{
+    bot.on_read(":someone!user@host PRIVMSG #quiet :.hello");
+
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ("PRIVMSG #quiet :hi someone\r\n", irc.writes[0]);
+}
+
+TEST_F(Bot, test_private_messages_are_answered_to_the_sender)
+{
+    bot.on_read(":someone!user@host PRIVMSG borky :.hello");
+    bot.on_read(":someone!user@host PRIVMSG borky :https://youtu.be/dQw4w9WgXcQ");
+
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ("PRIVMSG someone :hi someone\r\n", irc.writes[0]);
+
+    ASSERT_EQ(1, http.requests.size());
+    http.requests[0].callback("title");
+    ASSERT_EQ(2, irc.writes.size());
+    EXPECT_EQ("PRIVMSG someone :title\r\n", irc.writes[1]);
+}
+
+TEST_F(Bot, test_messages_to_unknown_channels_are_ignored)
+{
+    bot.on_read(":someone!user@host PRIVMSG #elsewhere :.hello");
+    EXPECT_EQ(0, irc.writes.size());
+}
+
+TEST_F(Bot, test_channel_settings_disable_features)
+{
+    bot.on_read(":someone!user@host PRIVMSG #QUIET :https://youtu.be/dQw4w9WgXcQ");
+    EXPECT_EQ(0, http.requests.size());
+}
+
+TEST_F(Bot, test_channel_rate_limit)
+{
+    bot.on_read(":someone!user@host PRIVMSG #quiet :.hello");
+    bot.on_read(":someone!user@host PRIVMSG #quiet :.hello");
+    bot.on_read(":someone!user@host PRIVMSG #bots :.hello");
+
+    ASSERT_EQ(2, irc.writes.size());
+    EXPECT_EQ("PRIVMSG #quiet :hi someone\r\n", irc.writes[0]);
+    EXPECT_EQ("PRIVMSG #bots :hi someone\r\n", irc.writes[1]);
+}
+
+TEST_F(Bot, test_query_rate_limit_is_per_sender)
+{
+    auto config = make_config();
+    config.query_settings.rate_limit = 1;
+    irc_bot<FakeIrc, FakeHttpEngine> limited(irc, shared, config);
+
+    limited.on_read(":spammer!user@host PRIVMSG borky :.hello");
+    limited.on_read(":spammer!user@host PRIVMSG borky :.hello");
+    limited.on_read(":SPAMMER!user@host PRIVMSG borky :.hello");
+    limited.on_read(":someone!user@host PRIVMSG borky :.hello");
+
+    ASSERT_EQ(2, irc.writes.size());
+    EXPECT_EQ("PRIVMSG spammer :hi spammer\r\n", irc.writes[0]);
+    EXPECT_EQ("PRIVMSG someone :hi someone\r\n", irc.writes[1]);
+}
+
+TEST_F(Bot, test_query_flooder_stays_limited_when_senders_are_evicted)
+{
+    auto config = make_config();
+    config.query_settings.rate_limit = 1;
+    irc_bot<FakeIrc, FakeHttpEngine> limited(irc, shared, config);
+
+    for (int i = 0; i < 2000; ++i) {
+        limited.on_read(":spammer!user@host PRIVMSG borky :.hello");
+        limited.on_read(fmt::format(":user{}!user@host PRIVMSG borky :.hello", i));
+    }
+
+    EXPECT_EQ(2001, irc.writes.size());
+    EXPECT_EQ(1, std::count(irc.writes.begin(), irc.writes.end(), "PRIVMSG spammer :hi spammer\r\n"));
+}
+
+TEST_F(Bot, test_overloaded_bot_only_keeps_the_connection_going)
+{
+    bot.set_overloaded(true);
+    bot.on_read(":someone!user@host PRIVMSG #bots :.hello https://youtu.be/dQw4w9WgXcQ");
+    bot.on_read("PING :irc.hostname.org");
+
+    EXPECT_EQ(0, http.requests.size());
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ("PONG :irc.hostname.org\r\n", irc.writes[0]);
+}
+
+TEST_F(Bot, test_quit_is_sent_and_later_commands_are_ignored)
+{
+    bot.quit("Shutting down");
+    bot.on_read(":someone!user@host PRIVMSG #bots :.hello https://youtu.be/dQw4w9WgXcQ");
+    bot.on_read("PING :irc.hostname.org");
+
+    EXPECT_EQ(0, http.requests.size());
+    ASSERT_EQ(2, irc.writes.size());
+    EXPECT_EQ("QUIT :Shutting down\r\n", irc.writes[0]);
+    EXPECT_EQ("PONG :irc.hostname.org\r\n", irc.writes[1]);
+}
+
+TEST_F(Bot, test_channel_events_are_logged)
+{
+    channel_log_options options;
+    options.directory = ::testing::TempDir() + "irc_bot_log_test";
+    options.sync = false;
+    std::filesystem::remove_all(options.directory);
+    {
+        channel_log log(options);
+        bot.set_log(&log);
+        bot.on_read(":someone!user@host JOIN #bots");
+        bot.on_read(":someone!user@host PRIVMSG #bots :hi all");
+        bot.on_read(":someone!user@host PRIVMSG borky :a query");
+        bot.on_read(":someone!user@host PRIVMSG #elsewhere :not ours");
+        bot.on_read(":op!user@host KICK #bots someone :behave");
+        bot.on_read(":someone!user@host QUIT");
+        bot.set_log(nullptr);
+    }
+
+    std::vector<std::string> records;
+    channel_log_reader reader(options.directory);
+    reader.scan({}, [&] (const channel_log_reader::record& r) {
+        records.push_back(fmt::format("{} {} {} {}", static_cast<int>(r.kind), r.channel, r.nick, r.text));
+        return true;
+    });
+    std::filesystem::remove_all(options.directory);
+
+    EXPECT_EQ((std::vector<std::string>{
+        "2 #bots someone ",
+        "0 #bots someone hi all",
+        "4 #bots someone behave",
+        "5  someone ",
+    }), records);
+}
+
+TEST_F(Bot, test_grep_answers_with_the_last_matching_messages)
+{
+    channel_log_options options;
+    options.directory = ::testing::TempDir() + "irc_bot_grep_test";
+    options.sync = false;
+    options.search = true;
+    std::filesystem::remove_all(options.directory);
+    {
+        channel_log log(options);
+        bot.set_log(&log);
+        const auto time = channel_log::clock::time_point(std::chrono::seconds(1700000000));
+        log.append(log_kind::privmsg, "#bots", "alice", "the build is broken", time);
+        log.append(log_kind::privmsg, "#bots", "bob", "build fixed", time + 1min);
+        log.flush();
+
+        bot.on_read(":someone!user@host PRIVMSG #bots :.grep build");
+        bot.on_read(":someone!user@host PRIVMSG #bots :.grep nothing");
+        bot.on_read(":someone!user@host PRIVMSG borky :.grep build");
+        // the searches are answered by then
+        log.flush();
+        bot.set_log(nullptr);
+    }
+    std::filesystem::remove_all(options.directory);
+
+    ASSERT_EQ(3, irc.writes.size());
+    EXPECT_EQ("PRIVMSG #bots :[2023-11-14 22:13] <alice> the build is broken\r\n", irc.writes[0]);
+    EXPECT_EQ("PRIVMSG #bots :[2023-11-14 22:14] <bob> build fixed\r\n", irc.writes[1]);
+    EXPECT_EQ("PRIVMSG #bots :no matches\r\n", irc.writes[2]);
+}
+
+TEST_F(Bot, test_seen_answers_with_the_last_event_of_a_nick)
+{
+    seen_table seen;
+    bot.set_seen(&seen);
+    bot.on_read(":alice!user@host JOIN #bots");
+    bot.on_read(":alice!user@host PRIVMSG #bots :see you");
+    bot.on_read(":alice!user@host PRIVMSG #elsewhere :not noted");
+    bot.on_read(":bob!user@host PART #bots :later");
+    bot.on_read(":carol!user@host QUIT");
+
+    // at a fixed time, for the reply
+    const auto time = seen_table::clock::time_point(std::chrono::seconds(1700000000));
+    seen.update(seen_event::message, "alice", "#bots", "see you", time);
+    EXPECT_EQ(seen_event::part, seen.find("bob")->event);
+    EXPECT_EQ(seen_event::quit, seen.find("carol")->event);
+
+    bot.on_read(":someone!user@host PRIVMSG #bots :.seen ALICE");
+    bot.on_read(":someone!user@host PRIVMSG borky :.seen dave");
+    bot.on_read(":someone!user@host PRIVMSG #bots :.seen");
+
+    ASSERT_EQ(2, irc.writes.size());
+    EXPECT_EQ("PRIVMSG #bots :alice was last seen 2023-11-14 22:13 UTC in #bots saying: see you\r\n", irc.writes[0]);
+    EXPECT_EQ("PRIVMSG someone :I haven't seen dave\r\n", irc.writes[1]);
+}
+
+TEST_F(Bot, test_seen_can_be_turned_off_per_channel)
+{
+    seen_table seen;
+    bot.set_seen(&seen);
+    bot.on_read(":alice!user@host PRIVMSG #bots :hello");
+
+    bot.on_read(":someone!user@host PRIVMSG #quiet :.seen alice");
+    EXPECT_EQ(0, irc.writes.size());
+
+    bot.on_read(":someone!user@host PRIVMSG #bots :.seen alice");
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ(0, irc.writes[0].find("PRIVMSG #bots :alice was last seen "));
+}
+
+TEST_F(Bot, test_overloaded_http_engine_only_serves_cached_titles)
+{
+    titles.insert("cachedvideo", "cached");
+    http.overloaded_ = true;
+
+    bot.on_read(":someone!user@host PRIVMSG #bots :https://youtu.be/dQw4w9WgXcQ https://youtu.be/cachedvideo");
+
+    EXPECT_EQ(0, http.requests.size());
+    ASSERT_EQ(1, irc.writes.size());
+    EXPECT_EQ("PRIVMSG #bots :cached\r\n", irc.writes[0]);
+}
@@ -1,499 +1,305 @@
 #include "net_stream.hpp"
+#include "test_fakes.hpp"
 
 #include <gtest/gtest.h>
 
-#include <boost/asio/ssl/stream_base.hpp>
-#include <boost/asio/ts/io_context.hpp>
-
 #include <fmt/format.h>
-#include <fmt/chrono.h>
 
 #include <numeric>
 #include <list>
 
 using namespace std::chrono_literals;
 
-class ManualExecutor
+struct Fixture : public ::testing::Test
 {
-public:
-    ManualExecutor(boost::asio::io_context& context)
-        : context_(context)
-    {}
-
-    void run()
+    Fixture()
+        : executor(io_context)
+        , timer_engine()
+        , resolver(io_context)
+        , stream(io_context.get_executor())
+        , irc(io_context, resolver, stream, timer_engine)
     {
-        context_.run();
-        context_.restart();
+        irc.on_error([this] (auto) {
+            fmt::print("fixture on_error");
+            ++error_call_count;
+        });
     }
 
-private:
-    boost::asio::io_context& context_;
-};
-
-struct fake_tcp {
-    using endpoint = boost::asio::ip::tcp::endpoint;
-};
-
-class FakeResolver
-{
-public:
-    using results_type = boost::asio::ip::tcp::resolver::results_type;
-    using error_code = boost::system::error_code;
-    using resolve_callback = std::function<void (const error_code&, results_type)>;
-
-    FakeResolver(boost::asio::io_context& ioctx)
-        : io_context(ioctx)
-    {}
-
-    struct resolve_request{
-        std::string name;
-        std::string port;
-        resolve_callback callback;
-        bool active;
-        bool canceled;
-    };
-
-    void async_resolve(
-        std::string name,
-        std::string port,
-        resolve_callback callback)
+    void TearDown() override
     {
-        requests.emplace_back(
-            resolve_request{
-                std::move(name),
-                std::move(port),
-                std::move(callback),
-                true,
-                false,
-            }
-        );
+        SocketListener::instance()->reset();
     }
 
-    void cancel()
+    void run_executor()
     {
-        std::for_each(
-            std::begin(requests), std::end(requests),
-            [] (auto& request) {
-                request.canceled = true;
-            }
-        );
+        io_context.run();
+        io_context.restart();
     }
 
-    void simulate_resolve()
+    void advance_time(std::chrono::milliseconds t)
     {
-        if (requests.empty())
-            throw std::logic_error("Resolver requests is empty");
-
-        auto request = std::move(requests[0]);
-        requests.erase(requests.begin());
-
-        std::initializer_list<boost::asio::ip::tcp::endpoint> eps = {
-            boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address("10.0.0.2"), 6667),
-        };
-        auto results = results_type::create(eps.begin(), eps.end(), "irc.hostname.org", "6667");
-
-        boost::asio::post(
-            io_context,
-            [request, results] { request.callback(boost::system::error_code(), results); }
-        );
+        timer_engine.advance_time(t, executor);
     }
 
-    void simulate_error()
-    {
-        if (requests.empty())
-            throw std::logic_error("Resolver requests is empty");
-
-        auto request = std::move(requests[0]);
-        requests.erase(requests.begin());
-
-        boost::asio::post(
-            io_context,
-            [request = std::move(request)] {
-                request.callback(boost::asio::error::fault, {});
-            }
-        );
-    }
+    boost::asio::io_context io_context;
+    ManualExecutor executor;
+    ManualTimerEngine timer_engine;
+    FakeResolver resolver;
+    FakeSslStream stream;
+
+    net_stream<boost::asio::io_context, FakeSslStream, FakeResolver, ManualTimerEngine> irc;
 
-    boost::asio::io_context& io_context;
-    std::vector<resolve_request> requests;
+    std::size_t error_call_count = 0;
 };
 
-class SocketListener
+TEST_F(Fixture, test_connect_starts_name_resolution)
 {
-public:
-    using connect_callback = std::function<void(boost::system::error_code)>;
-
-    static SocketListener* instance()
-    {
-        static SocketListener listener;
-        return &listener;
-    }
-
-    void reset()
-    {
-        pending_connects.clear();
-    }
+    irc.connect("irc.hostname.org");
 
-    struct pending_connect
-    {
-        boost::asio::ip::tcp::endpoint endpoint;
-        connect_callback callback;
-    };
-    std::vector<pending_connect> pending_connects;
-};
+    ASSERT_EQ(1, resolver.requests.size());
+    EXPECT_EQ("irc.hostname.org", resolver.requests[0].name);
+    EXPECT_EQ("6667", resolver.requests[0].port);
+}
 
-template <typename Executor>
-class boost::asio::basic_socket<fake_tcp, Executor>
+TEST_F(Fixture, test_resolution_failure_calls_error_callback)
 {
-public:
-    using native_handle_type = int;
-    using connect_callback = std::function<void(boost::system::error_code)>;
-
-    basic_socket<fake_tcp, Executor>(const Executor& executor)
-        : executor_(executor)
-    {
-    }
+    irc.connect("irc.hostname.org");
 
-    bool is_open()
-    {
-        return true;
-    }
+    ASSERT_EQ(0, error_call_count);
 
-    void close(boost::system::error_code&)
-    {
-    }
+    resolver.simulate_error();
+    executor.run();
 
-    const Executor& get_executor() const
-    {
-        return executor_;
-    }
+    EXPECT_EQ(1, error_call_count);
 
-    void async_connect(boost::asio::ip::tcp::endpoint endpoint, connect_callback&& callback)
-    {
-        fmt::print("{}\n", __func__);
-
-        SocketListener::instance()->pending_connects.emplace_back(
-            SocketListener::pending_connect{
-                endpoint,
-                callback
-            }
-        );
-    }
+    advance_time(10s);
+    executor.run();
 
-private:
-    const Executor& executor_;
-};
+    EXPECT_EQ(1, error_call_count);
+}
 
-class FakeTcpSocket : public boost::asio::basic_stream_socket<fake_tcp, boost::asio::io_context::executor_type>
+TEST_F(Fixture, test_resolution_timeout_calls_error_callback)
 {
-public:
-    using connect_callback = std::function<void (boost::system::error_code)>;
+    irc.connect("irc.hostname.org");
 
-    FakeTcpSocket(const boost::asio::io_context::executor_type& exec)
-        : boost::asio::basic_stream_socket<fake_tcp, boost::asio::io_context::executor_type>(exec)
-    {}
+    advance_time(10s - 1ms);
+    EXPECT_EQ(0, error_call_count);
 
-    void simulate_error()
-    {
-        if (pending_connects.empty()) {
-            throw std::logic_error("simulate_error with no pending connect requests");
-        }
+    advance_time(1ms);
+    EXPECT_EQ(1, error_call_count);
+    EXPECT_EQ(true, resolver.requests[0].canceled);
+}
 
-        auto& request = pending_connects.front();
-        request.callback(boost::asio::error::connection_refused);
-        pending_connects.erase(pending_connects.begin());
+struct TcpConnect : public Fixture
+{
+    TcpConnect()
+        : Fixture()
+    {
+        irc.connect("irc.hostname.org");
+        resolver.simulate_resolve();
+        executor.run();
     }
-
-    struct connect_request {
-        boost::asio::ip::tcp::endpoint endpoint;
-        connect_callback callback;
-    };
-    std::vector<connect_request> pending_connects;
 };
 
-class FakeSslStream
+TEST_F(TcpConnect, test_name_resolution_success_connects_to_host)
 {
-public:
-    using executor_type = boost::asio::io_context::executor_type;
-    static constexpr auto client = boost::asio::ssl::stream_base::client;
-
-    FakeSslStream(const boost::asio::io_context::executor_type& exec)
-        : executor(exec)
-        , socket(exec)
-    {}
+    ASSERT_EQ(1, SocketListener::instance()->pending_connects.size());
+    ASSERT_EQ(0, error_call_count);
+}
 
-    auto& lowest_layer() { return socket; }
+TEST_F(TcpConnect, test_connect_to_host_times_out_calls_error_callback)
+{
+    advance_time(10s - 1ms);
+    ASSERT_EQ(0, error_call_count);
 
-    using handshake_callback = std::function<void(boost::system::error_code)>;
-    void async_handshake(boost::asio::ssl::stream_base::handshake_type type, handshake_callback&& callback)
-    {
-        if (type != boost::asio::ssl::stream_base::client) {
-            throw std::logic_error("Expected handshake type \"client\"");
-        }
-        pending_handshakes.emplace_back(std::move(callback));
-    }
+    advance_time(1ms);
+    ASSERT_EQ(1, error_call_count);
+}
 
-    using read_callback = std::function<void(boost::system::error_code, std::size_t)>;
-    void async_read_some(const boost::asio::mutable_buffer& buffers, read_callback&& callback)
-    {
-        pending_reads.emplace_back(
-            pending_read{
-                buffers,
-                std::move(callback),
-            }
-        );
-    }
+TEST_F(TcpConnect, test_connect_to_host_error_calls_error_callback)
+{
+    boost::system::error_code ec = boost::asio::error::connection_refused;
+    SocketListener::instance()->pending_connects.at(0).callback(ec);
+    executor.run();
+    ASSERT_EQ(1, error_call_count);
+}
 
-    using write_callback = std::function<void(boost::system::error_code, std::size_t)>;
-    struct write_call {
-        std::string data;
-        write_callback callback;
-    };
-    std::vector<write_call> writes;
-    void async_write_some(const boost::asio::const_buffer& buffer, write_callback&& callback)
-    {
-        writes.emplace_back(
-            write_call{
-                std::string((char*)buffer.data(), buffer.size()),
-                std::move(callback),
-            }
-        );
-    }
+TEST_F(TcpConnect, test_connect_to_host_error_stops_connect_timer)
+{
+    boost::system::error_code ec = boost::asio::error::connection_refused;
+    SocketListener::instance()->pending_connects.at(0).callback(ec);
+    executor.run();
+    advance_time(10s);
+    ASSERT_EQ(1, error_call_count);
+}
 
-    void push(std::string_view msg)
+struct ParallelConnect : public Fixture
+{
+    static boost::asio::ip::tcp::endpoint endpoint(const char* address)
     {
-        if (pending_reads.empty()) {
-            throw std::logic_error("push() with no pending read requests");
-        }
-
-        auto& read_request = pending_reads.front();
-
-        if (read_request.buffers.size() < msg.size()) {
-            throw std::runtime_error("Destination buffer smaller than message size");
-        }
-
-        std::size_t to_write = std::min(msg.size(), read_request.buffers.size());
-        std::memcpy(read_request.buffers.data(), msg.data(), to_write);
-        read_request.callback(boost::system::error_code(), to_write);
-
-        pending_reads.pop_front();
+        return boost::asio::ip::tcp::endpoint(boost::asio::ip::make_address(address), 6667);
     }
 
-    void push(boost::system::error_code ec)
+    ParallelConnect()
+        : Fixture()
     {
-        if (pending_reads.empty()) {
-            throw std::logic_error("push() with no pending read requests");
-        }
-
-        auto& read_request = pending_reads.front();
-        read_request.callback(ec, 0);
-
-        pending_reads.pop_front();
+        irc.connect("irc.hostname.org");
+        resolver.simulate_resolve({
+            endpoint("2001:db8::1"),
+            endpoint("2001:db8::2"),
+            endpoint("10.0.0.1"),
+            endpoint("10.0.0.2"),
+        });
+        executor.run();
     }
 
-    void simulate_handshake()
+    std::vector<SocketListener::pending_connect>& connects()
     {
-        if (pending_handshakes.empty()) {
-            throw std::logic_error("simulate_handshake with no pending handshake requests");
-        }
-
-        auto& handshake = pending_handshakes.front();
-        boost::asio::post(
-            executor,
-            [handshake = std::move(handshake)] { handshake(boost::system::error_code()); }
-        );
-        pending_handshakes.erase(pending_handshakes.begin());
+        return SocketListener::instance()->pending_connects;
     }
 
-    void simulate_handshake_error()
+    void complete(std::size_t i, boost::system::error_code ec = {})
     {
-        if (pending_handshakes.empty()) {
-            throw std::logic_error("simulate_error with no pending connect requests");
-        }
-
-        auto& handshake = pending_handshakes.front();
-        boost::asio::post(
-            executor,
-            [handshake = std::move(handshake)] { handshake(boost::asio::error::fault); }
-        );
-        pending_handshakes.erase(pending_handshakes.begin());
+        connects().at(i).callback(ec);
+        executor.run();
     }
+};
 
-    std::vector<handshake_callback> pending_handshakes;
+TEST_F(ParallelConnect, test_first_attempt_starts_immediately)
+{
+    ASSERT_EQ(1, connects().size());
+    EXPECT_EQ(endpoint("2001:db8::1"), connects()[0].endpoint);
+}
 
-    boost::asio::io_context::executor_type executor;
-    FakeTcpSocket socket;
+TEST_F(ParallelConnect, test_attempts_are_staggered_and_alternate_families)
+{
+    advance_time(250ms - 1ms);
+    ASSERT_EQ(1, connects().size());
 
-    struct pending_read {
-        const boost::asio::mutable_buffer& buffers;
-        read_callback callback;
-    };
-    std::list<pending_read> pending_reads;
+    advance_time(1ms);
+    ASSERT_EQ(2, connects().size());
+    EXPECT_EQ(endpoint("10.0.0.1"), connects()[1].endpoint);
 
-private:
+    advance_time(500ms);
+    ASSERT_EQ(4, connects().size());
+    EXPECT_EQ(endpoint("2001:db8::2"), connects()[2].endpoint);
+    EXPECT_EQ(endpoint("10.0.0.2"), connects()[3].endpoint);
+}
 
-};
+TEST_F(ParallelConnect, test_failed_attempt_starts_next_without_delay)
+{
+    complete(0, boost::asio::error::connection_refused);
 
-class FakeTimer;
+    ASSERT_EQ(2, connects().size());
+    EXPECT_EQ(endpoint("10.0.0.1"), connects()[1].endpoint);
+    EXPECT_EQ(0, error_call_count);
+}
 
-class ManualTimerEngine
+TEST_F(ParallelConnect, test_first_connected_socket_wins)
 {
-public:
-    static constexpr bool debug = true;
+    advance_time(250ms);
+    complete(1);
 
-    using timer_type = FakeTimer;
+    EXPECT_EQ(1, stream.pending_handshakes.size());
 
-    using timer_callback = std::function<void()>;
-    using duration = std::chrono::milliseconds;
-    using timer_id = std::size_t;
+    // no more attempts, and the losing attempt is ignored
+    advance_time(1s);
+    EXPECT_EQ(2, connects().size());
+    complete(0);
+    EXPECT_EQ(1, stream.pending_handshakes.size());
+    EXPECT_EQ(0, error_call_count);
+}
 
-    FakeTimer create_timer();
+TEST_F(ParallelConnect, test_error_only_after_all_attempts_fail)
+{
+    advance_time(1s);
+    ASSERT_EQ(4, connects().size());
 
-    timer_id add_timer(duration wait_time, timer_callback callback)
-    {
-        auto id = next_timer_id++;
-        timers.insert(std::pair(current_time_ + wait_time, timer{id, callback}));;
-        if constexpr (debug)
-            fmt::print("{}({}, ...) = {}\n", __func__, wait_time, id);
-        return id;
+    for (std::size_t i = 0; i < 3; ++i) {
+        complete(i, boost::asio::error::connection_refused);
+        EXPECT_EQ(0, error_call_count);
     }
 
-    void remove_timer(timer_id id)
-    {
-        if constexpr (debug)
-            fmt::print("{}({})\n", __func__, id);
-        auto timer = std::find_if(
-            std::begin(timers), std::end(timers),
-            [id] (const auto& timer) {
-                return timer.second.id == id;
-            }
-        );
-        if (timer != std::end(timers)) {
-            auto work = timer->second.callback;
-            timers.erase(timer);
-
-        }
-    }
+    complete(3, boost::asio::error::connection_refused);
+    EXPECT_EQ(1, error_call_count);
 
-    void advance_time(duration t, ManualExecutor& executor)
-    {
-        if constexpr (debug)
-            fmt::print(">>>>>\n");
-
-        if constexpr (debug)
-            fmt::print("{}({})\n", __func__, t);
-
-        auto end_time = current_time_ + t;
-
-        while (true) {
-            if constexpr (debug)
-                fmt::print("current time: {}\n", current_time_);
-            executor.run();
-
-            if (timers.empty()) {
-                if constexpr (debug)
-                    fmt::print("no more timers\n");
-                break;
-            }
-
-            auto& [next_timer, timer] = *timers.begin();
-            if constexpr (debug)
-                fmt::print("next timer is {} at {}\n", timer.id, next_timer);
-            if (next_timer > end_time) {
-                if constexpr (debug)
-                    fmt::print("next timer is past end time\n");
-                break;
-            }
-
-            fmt::format("Running callback for timer {}\n", timer.id);
-            timer.callback();
-            executor.run();
-
-            timers.erase(timers.begin());
-        }
+    advance_time(10s);
+    EXPECT_EQ(1, error_call_count);
+}
 
-        current_time_ = end_time;
-        fmt::print("current time: {}\n", current_time_);
+TEST_F(ParallelConnect, test_timeout_stops_further_attempts)
+{
+    advance_time(10s);
+    EXPECT_EQ(1, error_call_count);
+    EXPECT_EQ(4, connects().size());
 
-        if constexpr (debug)
-            fmt::print("<<<<<\n");
+    complete(0);
+    EXPECT_EQ(0, stream.pending_handshakes.size());
+}
 
-    }
+TEST_F(Fixture, test_connect_resolves_given_port)
+{
+    irc.connect("irc.hostname.org", "6697");
 
-private:
-    timer_id next_timer_id = 0;
-    struct timer {
-        timer_id id;
-        timer_callback callback;
-    };
-    std::multimap<duration, timer> timers;
-    duration current_time_;
-};
+    ASSERT_EQ(1, resolver.requests.size());
+    EXPECT_EQ("6697", resolver.requests[0].port);
+}
 
-class FakeTimer
+TEST_F(TcpConnect, test_no_delay_is_set_by_default)
 {
-public:
-    using duration = std::chrono::milliseconds;
+    const auto& options = SocketListener::instance()->options;
+    ASSERT_EQ(1, options.size());
+    EXPECT_EQ(IPPROTO_TCP, options[0].level);
+    EXPECT_EQ(TCP_NODELAY, options[0].name);
+    EXPECT_EQ(1, options[0].value);
+}
 
-    FakeTimer(ManualTimerEngine& engine)
-        : timer_engine(engine)
-    {}
+TEST_F(Fixture, test_socket_options_are_set_before_connecting)
+{
+    socket_options options;
+    options.no_delay = false;
+    options.keepalive = keepalive_settings{30s, 5s, 3};
+    options.receive_buffer_size = 65536;
+    options.send_buffer_size = 32768;
+    irc.set_socket_options(options);
 
-    void expires_after(duration t)
-    {
-        wait = t;
-    }
+    irc.connect("irc.hostname.org");
+    resolver.simulate_resolve();
+    executor.run();
 
-    void async_wait(std::function<void (const boost::system::error_code&)> work)
-    {
-        id = timer_engine.add_timer(wait, [work] {
-            fmt::print("internal callback\n");
-            work(boost::system::error_code());
+    const auto has_option = [] (int level, int name, int value) {
+        const auto& set = SocketListener::instance()->options;
+        return std::any_of(std::begin(set), std::end(set), [&] (const auto& option) {
+            return option.level == level && option.name == name && option.value == value;
         });
-        fmt::print("{} is waiting\n", *id);
-        cancel_callback = [work] {
-            fmt::print("cancel callback\n");
-            work(boost::asio::error::operation_aborted);
-        };
-    }
-
-    void cancel()
-    {
-        if (id) {
-            fmt::print("{} is canceled\n", *id);
-            timer_engine.remove_timer(*id);
-            if (cancel_callback) {
-                cancel_callback();
-                cancel_callback = nullptr;
-            }
-        }
-    }
-
-private:
-    ManualTimerEngine& timer_engine;
-    std::optional<std::size_t> id;
-    duration wait;
-    std::function<void ()> cancel_callback;
-};
-
-FakeTimer ManualTimerEngine::create_timer()
-{
-    return FakeTimer(*this);
+    };
+    EXPECT_TRUE(has_option(IPPROTO_TCP, TCP_NODELAY, 0));
+    EXPECT_TRUE(has_option(SOL_SOCKET, SO_KEEPALIVE, 1));
+    EXPECT_TRUE(has_option(IPPROTO_TCP, TCP_KEEPIDLE, 30));
+    EXPECT_TRUE(has_option(IPPROTO_TCP, TCP_KEEPINTVL, 5));
+    EXPECT_TRUE(has_option(IPPROTO_TCP, TCP_KEEPCNT, 3));
+    EXPECT_TRUE(has_option(SOL_SOCKET, SO_RCVBUF, 65536));
+    EXPECT_TRUE(has_option(SOL_SOCKET, SO_SNDBUF, 32768));
+    EXPECT_EQ(1, SocketListener::instance()->pending_connects.size());
 }
 
-struct Fixture : public ::testing::Test
+static_assert(is_tls_stream<FakeSslStream>::value);
+static_assert(!is_tls_stream<FakeStream>::value);
+
+struct Plaintext : public ::testing::Test
 {
-    Fixture()
+    Plaintext()
         : executor(io_context)
-        , timer_engine()
         , resolver(io_context)
         , stream(io_context.get_executor())
         , irc(io_context, resolver, stream, timer_engine)
     {
-        irc.on_error([this] (auto) {
-            fmt::print("fixture on_error");
-            ++error_call_count;
-        });
+        irc.on_connected([this] { ++connected_call_count; });
+        irc.connect("irc.hostname.org");
+        resolver.simulate_resolve();
+        executor.run();
+        SocketListener::instance()->pending_connects.at(0).callback({});
+        executor.run();
     }
 
     void TearDown() override
@@ -501,107 +307,91 @@ struct Fixture : public ::testing::Test
         SocketListener::instance()->reset();
     }
 
-    void run_executor()
-    {
-        io_context.run();
-        io_context.restart();
-    }
-
-    void advance_time(std::chrono::milliseconds t)
-    {
-        timer_engine.advance_time(t, executor);
-    }
-
     boost::asio::io_context io_context;
     ManualExecutor executor;
     ManualTimerEngine timer_engine;
     FakeResolver resolver;
-    FakeSslStream stream;
+    FakeStream stream;
 
-    net_stream<boost::asio::io_context, FakeSslStream, FakeResolver, ManualTimerEngine> irc;
+    net_stream<boost::asio::io_context, FakeStream, FakeResolver, ManualTimerEngine> irc;
 
-    std::size_t error_call_count = 0;
+    std::size_t connected_call_count = 0;
 };
 
-TEST_F(Fixture, test_connect_starts_name_resolution)
+TEST_F(Plaintext, test_reads_without_handshake_once_connected)
 {
-    irc.connect("irc.hostname.org");
+    EXPECT_TRUE(irc.is_connected());
+    EXPECT_EQ(1, connected_call_count);
+    ASSERT_EQ(1, stream.pending_reads.size());
 
-    ASSERT_EQ(1, resolver.requests.size());
-    EXPECT_EQ("irc.hostname.org", resolver.requests[0].name);
-    EXPECT_EQ("6667", resolver.requests[0].port);
+    std::string line;
+    irc.on_read([&line] (std::string_view str) { line = str; });
+    stream.push("PING :x\r\n");
+    executor.run();
+    EXPECT_EQ("PING :x", line);
 }
 
-TEST_F(Fixture, test_resolution_failure_calls_error_callback)
+TEST_F(Plaintext, test_no_timeout_once_connected)
 {
-    irc.connect("irc.hostname.org");
-
-    ASSERT_EQ(0, error_call_count);
-
-    resolver.simulate_error();
-    executor.run();
-
-    EXPECT_EQ(1, error_call_count);
-
-    advance_time(10s);
-    executor.run();
-
-    EXPECT_EQ(1, error_call_count);
+    timer_engine.advance_time(10s, executor);
+    EXPECT_TRUE(irc.is_connected());
 }
 
-TEST_F(Fixture, test_resolution_timeout_calls_error_callback)
+struct RecordingHandler
 {
-    irc.connect("irc.hostname.org");
+    void on_read(std::string_view line) { lines.emplace_back(line); }
+    void on_connected() { ++connected; }
+    void on_error(boost::system::error_code ec) { errors.push_back(ec); }
 
-    advance_time(10s - 1ms);
-    EXPECT_EQ(0, error_call_count);
-
-    advance_time(1ms);
-    EXPECT_EQ(1, error_call_count);
-    EXPECT_EQ(true, resolver.requests[0].canceled);
-}
+    std::vector<std::string> lines;
+    std::size_t connected = 0;
+    std::vector<boost::system::error_code> errors;
+};
 
-struct TcpConnect : public Fixture
+struct StaticHandler : public ::testing::Test
 {
-    TcpConnect()
-        : Fixture()
+    StaticHandler()
+        : executor(io_context)
+        , resolver(io_context)
+        , stream(io_context.get_executor())
+        , irc(io_context, resolver, stream, timer_engine, handler)
     {
         irc.connect("irc.hostname.org");
         resolver.simulate_resolve();
         executor.run();
+        SocketListener::instance()->pending_connects.at(0).callback({});
+        executor.run();
+        stream.simulate_handshake();
+        executor.run();
     }
-};
 
-TEST_F(TcpConnect, test_name_resolution_success_connects_to_host)
-{
-    ASSERT_EQ(1, SocketListener::instance()->pending_connects.size());
-    ASSERT_EQ(0, error_call_count);
-}
+    void TearDown() override
+    {
+        SocketListener::instance()->reset();
+    }
 
-TEST_F(TcpConnect, test_connect_to_host_times_out_calls_error_callback)
-{
-    advance_time(10s - 1ms);
-    ASSERT_EQ(0, error_call_count);
+    boost::asio::io_context io_context;
+    ManualExecutor executor;
+    ManualTimerEngine timer_engine;
+    FakeResolver resolver;
+    FakeSslStream stream;
+    RecordingHandler handler;
 
-    advance_time(1ms);
-    ASSERT_EQ(1, error_call_count);
-}
+    net_stream<boost::asio::io_context, FakeSslStream, FakeResolver, ManualTimerEngine, RecordingHandler> irc;
+};
 
-TEST_F(TcpConnect, test_connect_to_host_error_calls_error_callback)
+TEST_F(StaticHandler, test_events_are_delivered_to_handler)
 {
-    boost::system::error_code ec = boost::asio::error::connection_refused;
-    SocketListener::instance()->pending_connects.at(0).callback(ec);
+    EXPECT_EQ(1, handler.connected);
+
+    stream.push("asdf\r\nfoo\r\n");
     executor.run();
-    ASSERT_EQ(1, error_call_count);
-}
+    EXPECT_EQ((std::vector<std::string>{ "asdf", "foo" }), handler.lines);
 
-TEST_F(TcpConnect, test_connect_to_host_error_stops_connect_timer)
-{
-    boost::system::error_code ec = boost::asio::error::connection_refused;
-    SocketListener::instance()->pending_connects.at(0).callback(ec);
+    stream.push(boost::asio::error::eof);
     executor.run();
-    advance_time(10s);
-    ASSERT_EQ(1, error_call_count);
+    ASSERT_EQ(1, handler.errors.size());
+    EXPECT_EQ(boost::asio::error::eof, handler.errors[0]);
 }
 
 struct Handshake : public TcpConnect
@@ -764,6 +554,26 @@ TEST_F(Connected, test_non_consecutive_writes)
     EXPECT_EQ("line 2\r\n", stream.writes[1].data);
 }
 
+TEST_F(Connected, test_message_being_written_stays_valid_while_queue_grows)
+{
+    // short enough to be stored inside the std::string
+    irc.write("PONG :x\r\n");
+    for (int i = 0; i < 32; ++i) {
+        irc.write(fmt::format("PRIVMSG #bots :{}\r\n", i));
+    }
+    executor.run();
+
+    ASSERT_EQ(1, stream.writes.size());
+    EXPECT_EQ("PONG :x\r\n", stream.writes[0].pending());
+
+    auto callback = std::move(stream.writes[0].callback);
+    callback(boost::system::error_code(), stream.writes[0].data.size());
+    executor.run();
+
+    ASSERT_EQ(2, stream.writes.size());
+    EXPECT_EQ("PRIVMSG #bots :0\r\n", stream.writes[1].pending());
+}
+
 TEST_F(Connected, test_consecutive_write_to_stream_is_buffered)
 {
     irc.write("line 1\r\n");
@@ -823,3 +633,442 @@ TEST_F(Connected, test_no_more_writes_after_both_strings_have_finished_writing)
 
     ASSERT_EQ(2, stream.writes.size());
 }
+
+TEST_F(Connected, test_full_queue_drops_oldest_message_not_being_written)
+{
+    irc.set_queue_limits({ 2, overflow_policy::drop_oldest });
+    irc.write("line 1\r\n");
+    irc.write("line 2\r\n");
+    irc.write("line 3\r\n");
+    executor.run();
+    ASSERT_EQ(1, stream.writes.size());
+
+    stream.writes[0].callback(boost::system::error_code(), 0);
+    ASSERT_EQ(2, stream.writes.size());
+    EXPECT_EQ("line 3\r\n", stream.writes[1].data);
+    EXPECT_EQ(1, irc.queue_stats().dropped_oldest);
+}
+
+TEST_F(Connected, test_full_queue_rejects_with_callback)
+{
+    std::vector<std::string> rejected;
+    irc.set_queue_limits({ 2, overflow_policy::reject });
+    irc.on_rejected([&] (std::string_view message) { rejected.emplace_back(message); });
+
+    irc.write("line 1\r\n");
+    irc.write("line 2\r\n");
+    irc.write("line 3\r\n");
+    executor.run();
+
+    ASSERT_EQ(1, rejected.size());
+    EXPECT_EQ("line 3\r\n", rejected[0]);
+    EXPECT_EQ(1, irc.queue_stats().rejected);
+}
+
+TEST_F(Connected, test_duplicates_are_coalesced_unless_being_written)
+{
+    irc.set_queue_limits({ 0, overflow_policy::coalesce });
+    irc.write("PONG :a\r\n");
+    irc.write("PONG :a\r\n");
+    irc.write("PONG :a\r\n");
+    executor.run();
+
+    stream.writes[0].callback(boost::system::error_code(), 0);
+    ASSERT_EQ(2, stream.writes.size());
+    stream.writes[1].callback(boost::system::error_code(), 0);
+    EXPECT_EQ(2, stream.writes.size());
+    EXPECT_EQ(1, irc.queue_stats().coalesced);
+}
+
+TEST_F(Connected, test_overload_is_signalled_when_full_and_when_drained)
+{
+    std::vector<bool> signals;
+    irc.set_queue_limits({ 2, overflow_policy::drop_newest });
+    irc.on_overload([&] (bool overloaded) { signals.push_back(overloaded); });
+
+    irc.write("line 1\r\n");
+    irc.write("line 2\r\n");
+    irc.write("line 3\r\n");
+    executor.run();
+    EXPECT_EQ(std::vector<bool>{ true }, signals);
+    EXPECT_TRUE(irc.overloaded());
+    EXPECT_EQ(1, irc.queue_stats().dropped_newest);
+
+    stream.writes[0].callback(boost::system::error_code(), 0);
+    executor.run();
+    EXPECT_EQ((std::vector<bool>{ true, false }), signals);
+    EXPECT_FALSE(irc.overloaded());
+    EXPECT_EQ(1, irc.queue_stats().overloads);
+    EXPECT_EQ(2, irc.queue_stats().peak);
+}
+
+TEST_F(Connected, test_metrics_count_lines_bytes_and_queue_depth)
+{
+    metrics_registry registry;
+    stream_metrics metrics{
+        &registry.add_counter("lines", ""),
+        &registry.add_counter("bytes_in", ""),
+        &registry.add_counter("bytes_out", ""),
+        &registry.add_gauge("write_queue", ""),
+    };
+    irc.set_metrics(metrics);
+    irc.on_read([] (std::string_view) {});
+
+    stream.push("asdf\r\nfoo\r\n");
+    executor.run();
+    EXPECT_EQ(2, metrics.lines_read->value());
+    EXPECT_EQ(11, metrics.bytes_in->value());
+
+    irc.write("line 1\r\n");
+    irc.write("line 2\r\n");
+    executor.run();
+    EXPECT_EQ(2, metrics.write_queue->value());
+
+    stream.writes[0].callback(boost::system::error_code(), 8);
+    EXPECT_EQ(1, metrics.write_queue->value());
+    EXPECT_EQ(8, metrics.bytes_out->value());
+}
+
+TEST_F(Connected, test_reply_written_from_read_handler_joins_the_trace)
+{
+    metrics_registry registry;
+    tracer traces(registry);
+    irc.set_tracer(&traces);
+    irc.on_read([this] (std::string_view) { irc.write("PONG :a\r\n"); });
+
+    stream.push("PING :a\r\n");
+    executor.run();
+    ASSERT_EQ(1, stream.writes.size());
+    EXPECT_NE(std::string::npos, registry.expose().find("trace_total_seconds_count 0\n"));
+
+    stream.writes[0].callback(boost::system::error_code(), 9);
+    const auto text = registry.expose();
+    EXPECT_NE(std::string::npos, text.find("trace_total_seconds_count 1\n"));
+    EXPECT_NE(std::string::npos, text.find("trace_stage_seconds_count{stage=\"write_queue\"} 1\n"));
+}
+
+struct StrandFixture : public ::testing::Test
+{
+    using strand = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+    StrandFixture()
+        : executor(io_context)
+        , strand_executor(boost::asio::make_strand(io_context))
+        , resolver(io_context)
+        , stream(io_context.get_executor())
+        , irc(strand_executor, resolver, stream, timer_engine)
+    {
+        irc.on_error([this] (auto) { ++error_call_count; });
+        irc.connect("irc.hostname.org");
+        resolver.simulate_resolve();
+        executor.run();
+        SocketListener::instance()->pending_connects[0].callback(boost::system::error_code());
+        executor.run();
+        stream.simulate_handshake();
+        executor.run();
+    }
+
+    void TearDown() override
+    {
+        SocketListener::instance()->reset();
+    }
+
+    boost::asio::io_context io_context;
+    ManualExecutor executor;
+    strand strand_executor;
+    ManualTimerEngine timer_engine;
+    FakeResolver resolver;
+    FakeSslStream stream;
+
+    net_stream<strand, FakeSslStream, FakeResolver, ManualTimerEngine> irc;
+
+    std::size_t error_call_count = 0;
+};
+
+TEST_F(StrandFixture, test_read_callback_runs_on_strand)
+{
+    bool on_strand = false;
+    irc.on_read([&] (std::string_view) {
+        on_strand = strand_executor.running_in_this_thread();
+    });
+
+    stream.push("asdf\r\n");
+    executor.run();
+
+    EXPECT_TRUE(on_strand);
+}
+
+TEST_F(StrandFixture, test_write_from_outside_strand_is_posted_to_strand)
+{
+    irc.write("line 1\r\n");
+    EXPECT_EQ(0, stream.writes.size());
+
+    executor.run();
+    ASSERT_EQ(1, stream.writes.size());
+    EXPECT_EQ("line 1\r\n", stream.writes[0].data);
+}
+
+TEST_F(StrandFixture, test_write_from_inside_strand_is_not_deferred)
+{
+    boost::asio::post(strand_executor, [this] {
+        irc.write("line 1\r\n");
+        EXPECT_EQ(1, stream.writes.size());
+    });
+    executor.run();
+
+    EXPECT_EQ(1, stream.writes.size());
+    EXPECT_EQ(0, error_call_count);
+}
+
+struct Reconnect : public Connected
+{
+    Reconnect()
+        : Connected()
+        , second_stream(io_context.get_executor())
+    {
+        policy.initial_delay = 1s;
+        policy.max_delay = 4s;
+        policy.jitter = 0;
+        irc.enable_reconnect(policy);
+        irc.on_connected([this] { ++connect_count; });
+    }
+
+    void drop_connection()
+    {
+        stream.push(boost::asio::error::eof);
+        executor.run();
+    }
+
+    std::size_t connect_attempts()
+    {
+        return SocketListener::instance()->pending_connects.size();
+    }
+
+    void complete_connect(FakeSslStream& s)
+    {
+        SocketListener::instance()->pending_connects.back().callback(boost::system::error_code());
+        executor.run();
+        s.simulate_handshake();
+        executor.run();
+    }
+
+    reconnect_policy policy;
+    FakeSslStream second_stream;
+    std::size_t connect_count = 0;
+};
+
+TEST_F(Reconnect, test_reconnects_after_initial_delay_using_resolved_endpoints)
+{
+    const auto attempts = connect_attempts();
+    drop_connection();
+    EXPECT_EQ(1, error_call_count);
+
+    advance_time(1s - 1ms);
+    EXPECT_EQ(attempts, connect_attempts());
+
+    advance_time(1ms);
+    EXPECT_EQ(attempts + 1, connect_attempts());
+    EXPECT_EQ(0, resolver.requests.size());
+    EXPECT_EQ(1, error_call_count);
+}
+
+TEST_F(Reconnect, test_failed_attempts_back_off_and_resolve_again)
+{
+    drop_connection();
+    advance_time(1s);
+
+    SocketListener::instance()->pending_connects.back().callback(boost::asio::error::connection_refused);
+    executor.run();
+    EXPECT_EQ(2, error_call_count);
+
+    advance_time(2s - 1ms);
+    EXPECT_EQ(0, resolver.requests.size());
+
+    advance_time(1ms);
+    ASSERT_EQ(1, resolver.requests.size());
+    EXPECT_EQ("irc.hostname.org", resolver.requests[0].name);
+
+    resolver.simulate_error();
+    executor.run();
+    EXPECT_EQ(3, error_call_count);
+
+    advance_time(4s - 1ms);
+    EXPECT_EQ(0, resolver.requests.size());
+    advance_time(1ms);
+    EXPECT_EQ(1, resolver.requests.size());
+}
+
+TEST_F(Reconnect, test_successful_reconnect_calls_on_connected_and_resets_backoff)
+{
+    drop_connection();
+    advance_time(1s);
+    complete_connect(stream);
+
+    EXPECT_EQ(1, connect_count);
+    EXPECT_TRUE(irc.is_connected());
+    ASSERT_EQ(1, stream.pending_reads.size());
+
+    const auto attempts = connect_attempts();
+    drop_connection();
+    advance_time(1s);
+    EXPECT_EQ(attempts + 1, connect_attempts());
+}
+
+TEST_F(Reconnect, test_endpoints_are_resolved_again_once_stale)
+{
+    policy.endpoint_ttl = 0s;
+    irc.enable_reconnect(policy);
+
+    drop_connection();
+    advance_time(1s);
+
+    EXPECT_EQ(1, resolver.requests.size());
+}
+
+TEST_F(Reconnect, test_stream_factory_provides_stream_for_reconnect)
+{
+    std::size_t factory_calls = 0;
+    irc.enable_reconnect(policy, [&] () -> FakeSslStream& {
+        ++factory_calls;
+        return second_stream;
+    });
+
+    drop_connection();
+    EXPECT_EQ(0, factory_calls);
+
+    advance_time(1s);
+    EXPECT_EQ(1, factory_calls);
+
+    SocketListener::instance()->pending_connects.back().callback(boost::system::error_code());
+    executor.run();
+    EXPECT_EQ(0, stream.pending_handshakes.size());
+    EXPECT_EQ(1, second_stream.pending_handshakes.size());
+}
+
+TEST_F(Reconnect, test_messages_written_while_disconnected_are_sent_after_reconnect)
+{
+    drop_connection();
+    irc.write("queued\r\n");
+    EXPECT_EQ(0, stream.writes.size());
+
+    advance_time(1s);
+    complete_connect(stream);
+
+    ASSERT_EQ(1, stream.writes.size());
+    EXPECT_EQ("queued\r\n", stream.writes[0].data);
+}
+
+TEST_F(Reconnect, test_backlog_is_held_until_flushed)
+{
+    policy.hold_backlog = true;
+    irc.enable_reconnect(policy);
+    irc.on_connected([this] { irc.write("register\r\n"); });
+
+    drop_connection();
+    irc.write("queued\r\n");
+
+    advance_time(1s);
+    complete_connect(stream);
+
+    ASSERT_EQ(1, stream.writes.size());
+    EXPECT_EQ("register\r\n", stream.writes[0].data);
+
+    stream.writes[0].callback(boost::system::error_code(), 0);
+    irc.flush_backlog();
+    ASSERT_EQ(2, stream.writes.size());
+    EXPECT_EQ("queued\r\n", stream.writes[1].data);
+}
+
+TEST_F(Reconnect, test_unsent_message_is_written_again_after_reconnect)
+{
+    irc.write("line 1\r\n");
+    ASSERT_EQ(1, stream.writes.size());
+
+    drop_connection();
+
+    // the write of the closed connection completes late
+    stream.writes[0].callback(boost::asio::error::operation_aborted, 0);
+    executor.run();
+    EXPECT_EQ(1, error_call_count);
+
+    advance_time(1s);
+    complete_connect(stream);
+
+    ASSERT_EQ(2, stream.writes.size());
+    EXPECT_EQ("line 1\r\n", stream.writes[1].data);
+}
+
+struct Close : public Reconnect
+{
+    void close()
+    {
+        irc.close(5s, [this] { ++closed_count; });
+        executor.run();
+    }
+
+    std::size_t closed_count = 0;
+};
+
+TEST_F(Close, test_queued_messages_are_written_until_the_server_closes)
+{
+    irc.write("PRIVMSG #bots :reply\r\n");
+    irc.write("QUIT :bye\r\n");
+    close();
+
+    ASSERT_EQ(1, stream.writes.size());
+    stream.writes[0].callback(boost::system::error_code(), 0);
+    ASSERT_EQ(2, stream.writes.size());
+    EXPECT_EQ("QUIT :bye\r\n", stream.writes[1].data);
+    EXPECT_EQ(0, closed_count);
+
+    stream.writes[1].callback(boost::system::error_code(), 0);
+    drop_connection();
+
+    EXPECT_EQ(1, closed_count);
+    EXPECT_EQ(0, error_call_count);
+    EXPECT_FALSE(irc.is_connected());
+}
+
+TEST_F(Close, test_closes_when_the_server_does_not_in_time)
+{
+    close();
+
+    advance_time(5s - 1ms);
+    EXPECT_EQ(0, closed_count);
+    EXPECT_TRUE(irc.is_connected());
+
+    advance_time(1ms);
+    executor.run();
+    EXPECT_EQ(1, closed_count);
+    EXPECT_FALSE(irc.is_connected());
+}
+
+TEST_F(Close, test_does_not_reconnect)
+{
+    const auto attempts = connect_attempts();
+    close();
+    drop_connection();
+
+    advance_time(10s);
+    EXPECT_EQ(attempts, connect_attempts());
+    EXPECT_EQ(1, closed_count);
+}
+
+TEST_F(Close, test_closes_at_once_while_disconnected_and_drops_the_backlog)
+{
+    gauge queue_depth;
+    irc.set_metrics({ nullptr, nullptr, nullptr, &queue_depth });
+    const auto attempts = connect_attempts();
+    drop_connection();
+    irc.write("queued\r\n");
+    EXPECT_EQ(1, queue_depth.value());
+    close();
+
+    EXPECT_EQ(1, closed_count);
+    EXPECT_EQ(0, queue_depth.value());
+    irc.write("late\r\n");
+
+    advance_time(10s);
+    EXPECT_EQ(attempts, connect_attempts());
+    EXPECT_EQ(0, stream.writes.size());
+}
@@ -0,0 +1,130 @@
+#include "backpressure.hpp"
+#include "message_queue.hpp"
+
+#include <gtest/gtest.h>
+
+TEST(MessageQueue, test_first_in_first_out)
+{
+    message_queue queue;
+    queue.push("a");
+    queue.push("b");
+
+    ASSERT_EQ(2, queue.size());
+    EXPECT_EQ("a", queue.front());
+    queue.pop();
+    EXPECT_EQ("b", queue.front());
+    queue.pop();
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(MessageQueue, test_keeps_order_when_growing_after_wrapping)
+{
+    message_queue queue;
+    for (int i = 0; i < 6; ++i) {
+        queue.push(std::to_string(i));
+    }
+    for (int i = 0; i < 4; ++i) {
+        queue.pop();
+    }
+    for (int i = 6; i < 30; ++i) {
+        queue.push(std::to_string(i));
+    }
+
+    for (int i = 4; i < 30; ++i) {
+        ASSERT_EQ(std::to_string(i), queue.front());
+        queue.pop();
+    }
+    EXPECT_TRUE(queue.empty());
+}
+
+TEST(MessageQueue, test_front_stays_in_place_when_growing)
+{
+    message_queue queue;
+    queue.push("PONG :x\r\n");
+    const char* front = queue.front().data();
+
+    for (int i = 0; i < 32; ++i) {
+        queue.push(std::to_string(i));
+    }
+    queue.erase(1);
+
+    EXPECT_EQ(front, queue.front().data());
+    EXPECT_EQ("PONG :x\r\n", std::string_view(front));
+}
+
+TEST(MessageQueue, test_popped_strings_are_reused)
+{
+    message_queue queue;
+    const std::string long_message(200, 'x');
+    for (int i = 0; i < 8; ++i) {
+        queue.push(long_message);
+    }
+    for (int i = 0; i < 8; ++i) {
+        queue.pop();
+    }
+
+    // the same slots come around again with their capacity intact
+    for (int i = 0; i < 8; ++i) {
+        queue.push("short");
+        EXPECT_GE(queue.front().capacity(), long_message.size());
+        queue.pop();
+    }
+}
+
+TEST(MessageQueue, test_erase_keeps_order)
+{
+    message_queue queue;
+    for (int i = 0; i < 4; ++i) {
+        queue.push(std::to_string(i));
+    }
+
+    queue.erase(1);
+    ASSERT_EQ(3, queue.size());
+    EXPECT_FALSE(queue.contains("1"));
+    EXPECT_EQ("0", queue[0]);
+    EXPECT_EQ("2", queue[1]);
+    EXPECT_EQ("3", queue[2]);
+}
+
+TEST(MessageQueue, test_contains_from_position)
+{
+    message_queue queue;
+    queue.push("a");
+    queue.push("b");
+
+    EXPECT_TRUE(queue.contains("a"));
+    EXPECT_FALSE(queue.contains("a", 1));
+    EXPECT_TRUE(queue.contains("b", 1));
+}
+
+TEST(QueueGuard, test_unbounded_queue_always_pushes)
+{
+    queue_guard guard;
+    EXPECT_EQ(queue_guard::admission::push, guard.admit(1000, [] { return true; }));
+    EXPECT_FALSE(guard.update(1000));
+}
+
+TEST(QueueGuard, test_full_queue_applies_policy)
+{
+    const auto never = [] { return false; };
+    EXPECT_EQ(queue_guard::admission::push, queue_guard({ 2, overflow_policy::reject }).admit(1, never));
+    EXPECT_EQ(queue_guard::admission::reject, queue_guard({ 2, overflow_policy::reject }).admit(2, never));
+    EXPECT_EQ(queue_guard::admission::drop_oldest, queue_guard({ 2, overflow_policy::drop_oldest }).admit(2, never));
+    EXPECT_EQ(queue_guard::admission::drop_newest, queue_guard({ 2, overflow_policy::drop_newest }).admit(2, never));
+    EXPECT_EQ(queue_guard::admission::drop_newest, queue_guard({ 2, overflow_policy::coalesce }).admit(2, never));
+    EXPECT_EQ(queue_guard::admission::coalesce, queue_guard({ 2, overflow_policy::coalesce }).admit(0, [] { return true; }));
+}
+
+TEST(QueueGuard, test_overload_clears_at_half_capacity)
+{
+    queue_guard guard({ 4, overflow_policy::drop_newest });
+
+    EXPECT_FALSE(guard.update(3));
+    EXPECT_TRUE(guard.update(4));
+    EXPECT_TRUE(guard.overloaded());
+    EXPECT_FALSE(guard.update(3));
+    EXPECT_TRUE(guard.update(2));
+    EXPECT_FALSE(guard.overloaded());
+    EXPECT_EQ(1, guard.counters().overloads);
+    EXPECT_EQ(4, guard.counters().peak);
+}
@@ -0,0 +1,142 @@
+#include "metrics.hpp"
+#include "metrics_server.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+TEST(Metrics, test_counter_adds_up_all_threads)
+{
+    counter lines;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < 1000; ++j) {
+                lines.add();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(4000, lines.value());
+}
+
+TEST(Metrics, test_histogram_buckets_double)
+{
+    EXPECT_EQ(0, histogram::bucket_of(0));
+    EXPECT_EQ(0, histogram::bucket_of(1023));
+    EXPECT_EQ(1, histogram::bucket_of(1024));
+    EXPECT_EQ(1, histogram::bucket_of(2047));
+    EXPECT_EQ(2, histogram::bucket_of(2048));
+    EXPECT_EQ(histogram::buckets - 1, histogram::bucket_of(std::uint64_t(1) << 60));
+}
+
+TEST(Metrics, test_histogram_snapshot)
+{
+    histogram latency;
+    latency.observe(500ns);
+    latency.observe(1500ns);
+    latency.observe(-1ns);
+
+    const auto snapshot = latency.read();
+    EXPECT_EQ(3, snapshot.count);
+    EXPECT_EQ(2000, snapshot.sum_ns);
+    EXPECT_EQ(2, snapshot.counts[0]);
+    EXPECT_EQ(1, snapshot.counts[1]);
+}
+
+TEST(Metrics, test_exposition_groups_labelled_series)
+{
+    metrics_registry registry;
+    registry.add_counter("lines_total", "Lines read", "network=\"a\"").add(2);
+    registry.add_gauge("depth", "Queue depth").set(-3);
+    registry.add_counter("lines_total", "Lines read", "network=\"b\"").add(5);
+
+    EXPECT_EQ(
+        "# HELP lines_total Lines read\n"
+        "# TYPE lines_total counter\n"
+        "lines_total{network=\"a\"} 2\n"
+        "lines_total{network=\"b\"} 5\n"
+        "# HELP depth Queue depth\n"
+        "# TYPE depth gauge\n"
+        "depth -3\n",
+        registry.expose());
+}
+
+TEST(Metrics, test_histogram_exposition_is_cumulative_in_seconds)
+{
+    metrics_registry registry;
+    auto& latency = registry.add_histogram("latency_seconds", "Latency", "network=\"a\"");
+    latency.observe(100ns);
+    latency.observe(1500ns);
+    latency.observe(1h);
+
+    const auto text = registry.expose();
+    EXPECT_NE(std::string::npos, text.find("# TYPE latency_seconds histogram\n"));
+    EXPECT_NE(std::string::npos, text.find("latency_seconds_bucket{network=\"a\",le=\"1.024e-06\"} 1\n"));
+    EXPECT_NE(std::string::npos, text.find("latency_seconds_bucket{network=\"a\",le=\"2.048e-06\"} 2\n"));
+    EXPECT_NE(std::string::npos, text.find("latency_seconds_bucket{network=\"a\",le=\"+Inf\"} 3\n"));
+    EXPECT_NE(std::string::npos, text.find("latency_seconds_count{network=\"a\"} 3\n"));
+}
+
+TEST(MetricsServer, test_serves_exposition_over_http)
+{
+    metrics_registry registry;
+    registry.add_counter("lines_total", "Lines read").add(7);
+
+    boost::asio::io_context io_context;
+    using tcp = boost::asio::ip::tcp;
+    metrics_server<tcp> server(io_context.get_executor(), tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), registry);
+    server.start();
+
+    tcp::socket client(io_context);
+    client.connect(server.local_endpoint());
+    const std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+    boost::asio::write(client, boost::asio::buffer(request));
+
+    std::string response;
+    boost::asio::async_read(client, boost::asio::dynamic_buffer(response), [&] (boost::system::error_code, std::size_t) {
+        server.stop();
+    });
+    io_context.run();
+
+    EXPECT_EQ(0, response.find("HTTP/1.0 200 OK\r\n"));
+    EXPECT_NE(std::string::npos, response.find("Content-Type: text/plain; version=0.0.4\r\n"));
+    EXPECT_NE(std::string::npos, response.find("\r\n\r\n# HELP lines_total Lines read\n"));
+    EXPECT_NE(std::string::npos, response.find("lines_total 7\n"));
+}
+
+TEST(MetricsServer, test_closes_connections_without_a_request)
+{
+    metrics_registry registry;
+
+    boost::asio::io_context io_context;
+    using tcp = boost::asio::ip::tcp;
+    metrics_server<tcp> server(io_context.get_executor(), tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0), registry);
+    server.set_request_timeout(20ms);
+    server.start();
+
+    tcp::socket client(io_context);
+    client.connect(server.local_endpoint());
+    const std::string partial = "GET /metrics HTTP/1.0\r\n";
+    boost::asio::write(client, boost::asio::buffer(partial));
+
+    std::string response;
+    boost::system::error_code read_error;
+    boost::asio::async_read(client, boost::asio::dynamic_buffer(response), [&] (boost::system::error_code ec, std::size_t) {
+        read_error = ec;
+        server.stop();
+    });
+    const auto started = std::chrono::steady_clock::now();
+    io_context.run();
+
+    EXPECT_EQ(boost::asio::error::eof, read_error);
+    EXPECT_TRUE(response.empty());
+    EXPECT_LT(std::chrono::steady_clock::now() - started, 2s);
+}
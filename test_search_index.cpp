@@ -0,0 +1,92 @@
+#include "search_index.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+// Indexes texts in channel 0 at offsets 0, 1, 2, ...
+void add_texts(search_index& index, const std::vector<std::string>& texts, std::uint32_t channel = 0)
+{
+    std::vector<search_index::entry> entries;
+    for (const auto& text : texts) {
+        entries.push_back(search_index::entry{ { 1, index.size() + entries.size() }, channel, text });
+    }
+    index.add(entries);
+}
+
+std::vector<std::uint64_t> offsets(const std::vector<search_index::location>& locations)
+{
+    std::vector<std::uint64_t> result;
+    for (const auto& where : locations) {
+        result.push_back(where.offset);
+    }
+    return result;
+}
+
+}
+
+TEST(SearchIndex, test_words_are_split_and_short_ones_skipped)
+{
+    std::vector<std::string> words;
+    search_index::for_each_word("Hello, world! a b2 c++ ünïcode " + std::string(40, 'x'), [&] (std::string_view word) {
+        words.emplace_back(word);
+    });
+    EXPECT_EQ((std::vector<std::string>{ "Hello", "world", "b2", "ünïcode", std::string(32, 'x') }), words);
+}
+
+TEST(SearchIndex, test_every_word_must_match_in_any_case)
+{
+    search_index index;
+    add_texts(index, { "the build is broken", "build fixed", "Broken BUILD again", "unrelated" });
+
+    EXPECT_EQ((std::vector<std::uint64_t>{ 0, 2 }), offsets(index.search(0, "build broken", 10)));
+    EXPECT_EQ((std::vector<std::uint64_t>{ 0, 1, 2 }), offsets(index.search(0, "BUILD", 10)));
+    EXPECT_TRUE(index.search(0, "build missing", 10).empty());
+    EXPECT_TRUE(index.search(0, "", 10).empty());
+    EXPECT_TRUE(index.search(0, "a", 10).empty());
+}
+
+TEST(SearchIndex, test_only_the_channel_asked_for_is_searched)
+{
+    search_index index;
+    add_texts(index, { "hello from one" }, 1);
+    add_texts(index, { "hello from two" }, 2);
+
+    EXPECT_EQ((std::vector<std::uint64_t>{ 1 }), offsets(index.search(2, "hello", 10)));
+    EXPECT_TRUE(index.search(3, "hello", 10).empty());
+}
+
+TEST(SearchIndex, test_the_last_matches_are_returned_oldest_first)
+{
+    search_index index;
+    add_texts(index, { "spam", "spam", "ham", "spam", "spam spam" });
+
+    EXPECT_EQ((std::vector<std::uint64_t>{ 3, 4 }), offsets(index.search(0, "spam", 2)));
+    EXPECT_TRUE(index.search(0, "spam", 0).empty());
+}
+
+TEST(SearchIndex, test_long_lists_are_intersected)
+{
+    // long enough for several skip entries and multi-byte deltas
+    std::vector<std::string> texts;
+    std::vector<std::uint64_t> expected;
+    for (std::uint64_t i = 0; i < 50000; ++i) {
+        std::string text = "common";
+        if (i % 7 == 0)
+            text += " seven";
+        if (i % 1000 == 3)
+            text += " rare";
+        if (i % 7 == 0 && i % 1000 == 3)
+            expected.push_back(i);
+        texts.push_back(text);
+    }
+    search_index index;
+    add_texts(index, texts);
+
+    EXPECT_EQ(expected, offsets(index.search(0, "rare common seven", expected.size())));
+    EXPECT_EQ((std::vector<std::uint64_t>{ 49994 }), offsets(index.search(0, "seven", 1)));
+    EXPECT_EQ(50000, index.size());
+}
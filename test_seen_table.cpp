@@ -0,0 +1,99 @@
+#include "seen_table.hpp"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+const seen_table::clock::time_point start = seen_table::clock::time_point(1700000000s);
+
+}
+
+TEST(SeenTable, test_last_event_is_found_under_casemapping)
+{
+    seen_table table;
+    table.update(seen_event::join, "Alice[m]", "#bots", {}, start);
+    table.update(seen_event::message, "alice{M}", "#Bots", "hello", start + 1s);
+
+    const auto seen = table.find("ALICE[M]");
+    ASSERT_TRUE(seen);
+    EXPECT_EQ(seen_event::message, seen->event);
+    EXPECT_EQ(start + 1s, seen->time);
+    EXPECT_EQ("alice{M}", seen->nick);
+    EXPECT_EQ("#Bots", seen->channel);
+    EXPECT_EQ("hello", seen->excerpt);
+    EXPECT_FALSE(table.find("bob"));
+    EXPECT_FALSE(table.find(""));
+}
+
+TEST(SeenTable, test_long_texts_are_cut_between_characters)
+{
+    seen_table table;
+    // a two byte character across the cut
+    const std::string text = std::string(seen_table::max_excerpt - 1, 'x') + "é and more";
+    table.update(seen_event::message, "alice", "#bots", text, start);
+    table.update(seen_event::message, std::string(seen_table::max_nick + 1, 'n'), "#bots", "too long", start);
+    table.update(seen_event::message, "bob", "#" + std::string(seen_table::max_channel, 'c'), "hi", start);
+
+    EXPECT_EQ(std::string(seen_table::max_excerpt - 1, 'x'), table.find("alice")->excerpt);
+    EXPECT_FALSE(table.find(std::string(seen_table::max_nick + 1, 'n')));
+    EXPECT_EQ("", table.find("bob")->channel);
+}
+
+TEST(SeenTable, test_full_table_replaces_the_nick_seen_longest_ago)
+{
+    // 16 slots, all probed by every nick
+    seen_table table(16);
+    for (int i = 0; i < 16; ++i) {
+        table.update(seen_event::join, "nick" + std::to_string(i), "#bots", {}, start + std::chrono::seconds(i == 5 ? -1 : i));
+    }
+    table.update(seen_event::join, "newcomer", "#bots", {}, start + 1h);
+
+    EXPECT_TRUE(table.find("newcomer"));
+    EXPECT_FALSE(table.find("nick5"));
+    for (int i = 0; i < 16; ++i) {
+        EXPECT_EQ(i != 5, table.find("nick" + std::to_string(i)).has_value());
+    }
+}
+
+TEST(SeenTable, test_saved_table_is_loaded)
+{
+    const std::string path = ::testing::TempDir() + "seen_table_test";
+    {
+        seen_table table(64);
+        table.update(seen_event::quit, "alice", {}, "bye", start);
+        table.update(seen_event::part, "bob", "#bots", {}, start + 1s);
+        table.save(path);
+    }
+
+    // of another capacity
+    seen_table table(1024);
+    table.load(path);
+    std::filesystem::remove(path);
+
+    ASSERT_TRUE(table.find("alice"));
+    EXPECT_EQ(seen_event::quit, table.find("alice")->event);
+    EXPECT_EQ("bye", table.find("alice")->excerpt);
+    ASSERT_TRUE(table.find("bob"));
+    EXPECT_EQ(start + 1s, table.find("bob")->time);
+    EXPECT_EQ("#bots", table.find("bob")->channel);
+}
+
+TEST(SeenTable, test_missing_file_is_an_empty_table_and_others_are_rejected)
+{
+    const std::string path = ::testing::TempDir() + "seen_table_not_a_table";
+    std::filesystem::remove(path);
+
+    seen_table table;
+    table.load(path);
+    EXPECT_FALSE(table.find("alice"));
+
+    std::ofstream(path) << "not a seen table, but long enough to have a header";
+    EXPECT_THROW(table.load(path), std::runtime_error);
+    std::filesystem::remove(path);
+}
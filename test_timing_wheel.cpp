@@ -0,0 +1,223 @@
+#include "timing_wheel.hpp"
+#include "wheel_timer_engine.hpp"
+
+#include <gtest/gtest.h>
+
+#include <boost/asio.hpp>
+
+#include <random>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+// Records the tick at which each timer fired
+struct Recorder
+{
+    timing_wheel<> wheel;
+    std::vector<std::pair<int, timing_wheel<>::tick_type>> fired;
+
+    timing_wheel<>::handle add(int id, timing_wheel<>::tick_type delay)
+    {
+        return wheel.schedule(delay, [this, id] { fired.emplace_back(id, wheel.now()); });
+    }
+};
+
+}
+
+TEST(TimingWheel, test_fires_after_delay)
+{
+    Recorder r;
+    r.add(1, 5);
+
+    r.wheel.advance(4);
+    EXPECT_TRUE(r.fired.empty());
+
+    r.wheel.advance(1);
+    ASSERT_EQ(1, r.fired.size());
+    EXPECT_EQ(5, r.fired[0].second);
+    EXPECT_TRUE(r.wheel.empty());
+}
+
+TEST(TimingWheel, test_zero_delay_fires_on_next_tick)
+{
+    Recorder r;
+    r.add(1, 0);
+    r.wheel.advance(1);
+    EXPECT_EQ(1, r.fired.size());
+}
+
+TEST(TimingWheel, test_timers_on_higher_levels_fire_on_time)
+{
+    Recorder r;
+    const std::vector<timing_wheel<>::tick_type> delays = {
+        63, 64, 65, 127, 200, 4095, 4096, 4097, 100000, 262144, 300000,
+    };
+    for (std::size_t i = 0; i < delays.size(); ++i) {
+        r.add(static_cast<int>(i), delays[i]);
+    }
+
+    r.wheel.advance(300000);
+
+    ASSERT_EQ(delays.size(), r.fired.size());
+    for (std::size_t i = 0; i < delays.size(); ++i) {
+        EXPECT_EQ(static_cast<int>(i), r.fired[i].first);
+        EXPECT_EQ(delays[i], r.fired[i].second);
+    }
+}
+
+TEST(TimingWheel, test_random_delays_from_random_start_times)
+{
+    Recorder r;
+    std::minstd_rand random(42);
+    std::vector<timing_wheel<>::tick_type> expected(500);
+
+    for (int i = 0; i < 500; ++i) {
+        r.wheel.advance(random() % 1000);
+        const auto delay = 1 + random() % 70000;
+        expected[i] = r.wheel.now() + delay;
+        r.add(i, delay);
+    }
+    r.wheel.advance(80000);
+
+    ASSERT_EQ(500, r.fired.size());
+    for (const auto& [id, at] : r.fired) {
+        EXPECT_EQ(expected[id], at) << "timer " << id;
+    }
+}
+
+TEST(TimingWheel, test_beyond_range_fires_on_time)
+{
+    Recorder r;
+    const timing_wheel<>::tick_type far = (1u << 24) + 1000;
+    r.add(1, far);
+
+    r.wheel.advance(far - 1);
+    EXPECT_TRUE(r.fired.empty());
+    r.wheel.advance(1);
+    ASSERT_EQ(1, r.fired.size());
+    EXPECT_EQ(far, r.fired[0].second);
+}
+
+TEST(TimingWheel, test_cancel_returns_callback_once)
+{
+    Recorder r;
+    auto h = r.add(1, 10);
+
+    EXPECT_TRUE(r.wheel.pending(h));
+    EXPECT_TRUE(static_cast<bool>(r.wheel.cancel(h)));
+    EXPECT_FALSE(r.wheel.pending(h));
+    EXPECT_FALSE(static_cast<bool>(r.wheel.cancel(h)));
+
+    r.wheel.advance(20);
+    EXPECT_TRUE(r.fired.empty());
+}
+
+TEST(TimingWheel, test_stale_handle_does_not_cancel_reused_slot)
+{
+    Recorder r;
+    auto old = r.add(1, 1);
+    r.wheel.advance(1);
+
+    r.add(2, 1);
+    EXPECT_FALSE(static_cast<bool>(r.wheel.cancel(old)));
+    r.wheel.advance(1);
+    EXPECT_EQ(2, r.fired.size());
+}
+
+TEST(TimingWheel, test_callback_may_cancel_timer_in_same_slot)
+{
+    timing_wheel<> wheel;
+    timing_wheel<>::handle second;
+    int fired = 0;
+
+    wheel.schedule(3, [&] { ++fired; wheel.cancel(second); });
+    second = wheel.schedule(3, [&] { ++fired; });
+    wheel.advance(3);
+
+    EXPECT_EQ(1, fired);
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimingWheel, test_callback_may_reschedule)
+{
+    timing_wheel<> wheel;
+    std::vector<timing_wheel<>::tick_type> fired;
+    std::function<void ()> repeat = [&] {
+        fired.push_back(wheel.now());
+        if (fired.size() < 3)
+            wheel.schedule(100, repeat);
+    };
+    wheel.schedule(100, repeat);
+
+    wheel.advance(1000);
+    EXPECT_EQ((std::vector<timing_wheel<>::tick_type>{ 100, 200, 300 }), fired);
+}
+
+TEST(WheelTimerEngine, test_timers_fire_in_order_and_cancel_aborts)
+{
+    boost::asio::io_context io_context;
+    wheel_timer_engine engine(io_context, 1ms);
+
+    std::vector<std::string> events;
+    auto late = engine.create_timer();
+    auto early = engine.create_timer();
+    auto cancelled = engine.create_timer();
+
+    late.expires_after(30ms);
+    late.async_wait([&] (const boost::system::error_code& ec) { events.push_back("late " + ec.message()); });
+    early.expires_after(5ms);
+    early.async_wait([&] (const boost::system::error_code& ec) { events.push_back(ec ? "early error" : "early"); });
+    cancelled.expires_after(10ms);
+    cancelled.async_wait([&] (const boost::system::error_code& ec) {
+        events.push_back(ec == boost::asio::error::operation_aborted ? "aborted" : "cancelled fired");
+    });
+    cancelled.cancel();
+
+    const auto start = std::chrono::steady_clock::now();
+    io_context.run();
+
+    ASSERT_EQ(3, events.size());
+    EXPECT_EQ("aborted", events[0]);
+    EXPECT_EQ("early", events[1]);
+    EXPECT_EQ("late Success", events[2]);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 30ms);
+    EXPECT_EQ(0, engine.size());
+}
+
+TEST(WheelTimerEngine, test_expires_after_cancels_pending_wait)
+{
+    boost::asio::io_context io_context;
+    wheel_timer_engine engine(io_context, 1ms);
+    auto timer = engine.create_timer();
+
+    std::vector<bool> aborted;
+    const auto record = [&] (const boost::system::error_code& ec) {
+        aborted.push_back(ec == boost::asio::error::operation_aborted);
+    };
+    timer.expires_after(5ms);
+    timer.async_wait(record);
+    timer.expires_after(5ms);
+    timer.async_wait(record);
+    io_context.run();
+
+    EXPECT_EQ((std::vector<bool>{ true, false }), aborted);
+}
+
+TEST(WheelTimerEngine, test_handler_runs_on_associated_executor)
+{
+    boost::asio::io_context io_context;
+    auto strand = boost::asio::make_strand(io_context);
+    wheel_timer_engine engine(io_context, 1ms);
+    auto timer = engine.create_timer();
+
+    bool on_strand = false;
+    timer.expires_after(1ms);
+    timer.async_wait(boost::asio::bind_executor(strand, [&] (const boost::system::error_code&) {
+        on_strand = strand.running_in_this_thread();
+    }));
+    io_context.run();
+
+    EXPECT_TRUE(on_strand);
+}
@@ -0,0 +1,102 @@
+#include "self_signed_cert.hpp"
+#include "tls_session.hpp"
+
+#include <gtest/gtest.h>
+
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+
+#include <thread>
+
+namespace {
+
+using tcp = boost::asio::ip::tcp;
+using ssl_stream = boost::asio::ssl::stream<tcp::socket>;
+
+// Accepts connections, sends a line after the handshake and waits for the
+// client to hang up
+class LoopbackTlsServer
+{
+public:
+    explicit LoopbackTlsServer(std::size_t connections)
+        : context_(boost::asio::ssl::context::tls_server)
+        , acceptor_(io_context_, tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 0))
+    {
+        use_self_signed_certificate(context_);
+        static const unsigned char session_id_context[] = "test";
+        SSL_CTX_set_session_id_context(context_.native_handle(), session_id_context, sizeof(session_id_context));
+
+        thread_ = std::thread([this, connections] {
+            for (std::size_t i = 0; i < connections; ++i) {
+                ssl_stream stream(io_context_, context_);
+                acceptor_.accept(stream.lowest_layer());
+                boost::system::error_code ec;
+                stream.handshake(ssl_stream::server, ec);
+                if (ec)
+                    continue;
+                boost::asio::write(stream, boost::asio::buffer(std::string_view("hello\r\n")), ec);
+                char c;
+                boost::asio::read(stream, boost::asio::buffer(&c, 1), ec);
+            }
+        });
+    }
+
+    ~LoopbackTlsServer()
+    {
+        thread_.join();
+    }
+
+    tcp::endpoint endpoint() const { return acceptor_.local_endpoint(); }
+
+private:
+    boost::asio::io_context io_context_;
+    boost::asio::ssl::context context_;
+    tcp::acceptor acceptor_;
+    std::thread thread_;
+};
+
+// Connects, offering the saved session if there is one, reads the server's
+// line and saves the session. Returns whether the session was resumed.
+bool connect_once(boost::asio::ssl::context& context, tcp::endpoint endpoint, tls_session& session)
+{
+    boost::asio::io_context io_context;
+    ssl_stream stream(io_context, context);
+    stream.lowest_layer().connect(endpoint);
+
+    session.offer(stream.native_handle());
+    stream.handshake(ssl_stream::client);
+
+    boost::asio::streambuf buffer;
+    boost::asio::read_until(stream, buffer, "\n");
+
+    const bool resumed = tls_session::reused(stream.native_handle());
+    session.save(stream.native_handle());
+    return resumed;
+}
+
+}
+
+static_assert(has_ssl_handle<ssl_stream>::value);
+static_assert(!has_ssl_handle<tcp::socket>::value);
+
+TEST(TlsSession, test_second_connection_resumes_the_session)
+{
+    LoopbackTlsServer server(2);
+    boost::asio::ssl::context context(boost::asio::ssl::context::tls_client);
+    tls_session session;
+
+    EXPECT_FALSE(connect_once(context, server.endpoint(), session));
+    EXPECT_FALSE(session.empty());
+    EXPECT_TRUE(connect_once(context, server.endpoint(), session));
+}
+
+TEST(TlsSession, test_without_a_saved_session_the_handshake_is_full)
+{
+    LoopbackTlsServer server(2);
+    boost::asio::ssl::context context(boost::asio::ssl::context::tls_client);
+    tls_session session;
+
+    EXPECT_FALSE(connect_once(context, server.endpoint(), session));
+    session.reset();
+    EXPECT_FALSE(connect_once(context, server.endpoint(), session));
+}
@@ -0,0 +1,122 @@
+#include "trace.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+namespace {
+
+bool exposes(const metrics_registry& registry, const std::string& sample)
+{
+    return registry.expose().find(sample) != std::string::npos;
+}
+
+}
+
+TEST(Trace, test_trace_is_recorded_when_last_reference_is_released)
+{
+    metrics_registry registry;
+    tracer traces(registry);
+
+    const trace_id id = traces.begin("PRIVMSG #bots :link");
+    ASSERT_NE(0, id);
+    traces.add_ref(id);
+    traces.stamp(id, trace_stage::handled);
+    traces.release(id);
+    EXPECT_TRUE(exposes(registry, "trace_total_seconds_count 0\n"));
+
+    traces.stamp(id, trace_stage::write_queued);
+    traces.stamp(id, trace_stage::written);
+    traces.release(id);
+    EXPECT_TRUE(exposes(registry, "trace_total_seconds_count 1\n"));
+    EXPECT_TRUE(exposes(registry, "trace_stage_seconds_count{stage=\"dispatch\"} 1\n"));
+    EXPECT_TRUE(exposes(registry, "trace_stage_seconds_count{stage=\"write_queue\"} 1\n"));
+    EXPECT_TRUE(exposes(registry, "trace_stage_seconds_count{stage=\"http\"} 0\n"));
+}
+
+TEST(Trace, test_scope_makes_trace_current)
+{
+    EXPECT_EQ(0, current_trace());
+    {
+        trace_scope outer(3);
+        {
+            trace_scope inner(5);
+            EXPECT_EQ(5, current_trace());
+        }
+        EXPECT_EQ(3, current_trace());
+    }
+    EXPECT_EQ(0, current_trace());
+}
+
+TEST(Trace, test_lines_are_not_traced_while_slot_is_busy)
+{
+    metrics_registry registry;
+    tracer traces(registry);
+
+    const trace_id first = traces.begin("a");
+    for (std::size_t i = 1; i < tracer::slots; ++i) {
+        traces.release(traces.begin("b"));
+    }
+
+    EXPECT_EQ(0, traces.begin("c"));
+    EXPECT_TRUE(exposes(registry, "traces_dropped_total 1\n"));
+
+    traces.release(first);
+    EXPECT_NE(0, traces.begin("d"));
+}
+
+TEST(Trace, test_slow_traces_are_sampled)
+{
+    const std::string path = ::testing::TempDir() + "trace_samples.log";
+    std::remove(path.c_str());
+
+    metrics_registry registry;
+    tracer_options options;
+    options.slow = 0ms;
+    options.sample_path = path;
+    {
+        tracer traces(registry, options);
+        const trace_id id = traces.begin("PING :server");
+        traces.stamp(id, trace_stage::handled);
+        traces.release(id);
+    }
+
+    std::ifstream file(path);
+    std::string line;
+    ASSERT_TRUE(std::getline(file, line));
+    EXPECT_NE(std::string::npos, line.find(" dispatch_ms="));
+    EXPECT_NE(std::string::npos, line.find(" line=PING :server"));
+}
+
+TEST(Trace, test_samples_are_written_by_the_sample_writer)
+{
+    const std::string path = ::testing::TempDir() + "trace_samples_posted.log";
+    std::remove(path.c_str());
+
+    metrics_registry registry;
+    tracer_options options;
+    options.slow = 0ms;
+    options.sample_path = path;
+    tracer traces(registry, options);
+    std::vector<std::function<void ()>> writes;
+    traces.write_samples_with([&] (std::function<void ()> write) { writes.push_back(std::move(write)); });
+
+    const trace_id id = traces.begin("PING :server");
+    traces.stamp(id, trace_stage::handled);
+    traces.release(id);
+
+    ASSERT_EQ(1u, writes.size());
+    std::string line;
+    EXPECT_FALSE(std::getline(std::ifstream(path), line));
+
+    writes.front()();
+    std::ifstream file(path);
+    ASSERT_TRUE(std::getline(file, line));
+    EXPECT_NE(std::string::npos, line.find(" line=PING :server"));
+}
@@ -0,0 +1,207 @@
+#ifndef TIMING_WHEEL_HPP
+#define TIMING_WHEEL_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Hierarchical timing wheel (Varghese & Lauck): four levels of 64 slots,
+// level n holding timers that expire within 64^(n+1) ticks. A timer is
+// linked into the slot of its expiry tick, and moved down a level when the
+// wheel below wraps around. Scheduling and cancelling are O(1); advancing
+// is O(1) per tick plus the timers that fire or move down.
+//
+// Time is counted in ticks and only moves by calling advance(), the caller
+// decides how long a tick is. Timers further out than the wheel's range
+// (2^24 ticks) wait in the last level and are placed again when they come
+// around.
+template <typename Callback = std::function<void ()>>
+class timing_wheel
+{
+public:
+    using tick_type = std::uint64_t;
+
+    // Identifies a scheduled timer. Stays safe to cancel after the timer
+    // fired, the slot is then reused by a later timer with another
+    // generation.
+    struct handle
+    {
+        std::uint32_t index = npos;
+        std::uint32_t generation = 0;
+    };
+
+    // Fires callback once delay ticks have passed, at least one
+    handle schedule(tick_type delay, Callback callback)
+    {
+        const std::uint32_t index = allocate();
+        node& n = nodes_[index];
+        n.expires = now_ + std::max<tick_type>(delay, 1);
+        n.callback = std::move(callback);
+        link(index);
+        ++size_;
+        return handle{ index, n.generation };
+    }
+
+    // Returns the callback of a timer that had not fired yet, so that the
+    // caller can notify it; returns an empty callback otherwise.
+    Callback cancel(handle h)
+    {
+        if (!pending(h))
+            return Callback();
+
+        Callback callback = std::move(nodes_[h.index].callback);
+        unlink(h.index);
+        release(h.index);
+        --size_;
+        return callback;
+    }
+
+    bool pending(handle h) const
+    {
+        return h.index < nodes_.size()
+            && nodes_[h.index].generation == h.generation
+            && nodes_[h.index].slot != npos;
+    }
+
+    // Moves time forward, firing the timers that expire on the way in
+    // order of their expiry. Callbacks may schedule and cancel timers.
+    void advance(tick_type ticks)
+    {
+        for (tick_type i = 0; i < ticks; ++i) {
+            tick();
+        }
+    }
+
+    tick_type now() const { return now_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+private:
+    static constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+    static constexpr unsigned slot_bits = 6;
+    static constexpr unsigned slots = 1u << slot_bits;
+    static constexpr unsigned levels = 4;
+    static constexpr tick_type range = tick_type(1) << (slot_bits * levels);
+
+    struct node
+    {
+        tick_type expires = 0;
+        Callback callback;
+        std::uint32_t prev = npos;
+        std::uint32_t next = npos;
+        // index into heads_, npos when not scheduled
+        std::uint32_t slot = npos;
+        std::uint32_t generation = 0;
+    };
+
+    static std::size_t slot_of(tick_type expires, unsigned level)
+    {
+        return level * slots + ((expires >> (level * slot_bits)) & (slots - 1));
+    }
+
+    void tick()
+    {
+        ++now_;
+
+        // move the timers of the next slot of each wrapped level down
+        for (unsigned level = 1; level < levels; ++level) {
+            if ((now_ >> ((level - 1) * slot_bits)) & (slots - 1))
+                break;
+            const std::size_t slot = slot_of(now_, level);
+            std::uint32_t index = heads_[slot];
+            heads_[slot] = npos;
+            tails_[slot] = npos;
+            while (index != npos) {
+                const std::uint32_t next = nodes_[index].next;
+                link(index);
+                index = next;
+            }
+        }
+
+        const std::size_t slot = slot_of(now_, 0);
+        while (heads_[slot] != npos) {
+            const std::uint32_t index = heads_[slot];
+            Callback callback = std::move(nodes_[index].callback);
+            unlink(index);
+            release(index);
+            --size_;
+            callback();
+        }
+    }
+
+    // Puts a node in the slot for its expiry, relative to now. A node due
+    // now only happens while moving down, and goes to the slot about to fire.
+    void link(std::uint32_t index)
+    {
+        node& n = nodes_[index];
+        const tick_type delta = n.expires - now_;
+
+        std::size_t slot;
+        if (delta >= range) {
+            slot = slot_of(now_ + range - 1, levels - 1);
+        } else {
+            unsigned level = 0;
+            while (delta >= (tick_type(1) << ((level + 1) * slot_bits)))
+                ++level;
+            slot = slot_of(n.expires, level);
+        }
+
+        // appended, so timers due at the same tick fire in scheduling order
+        n.slot = static_cast<std::uint32_t>(slot);
+        n.prev = tails_[slot];
+        n.next = npos;
+        if (n.prev != npos) {
+            nodes_[n.prev].next = index;
+        } else {
+            heads_[slot] = index;
+        }
+        tails_[slot] = index;
+    }
+
+    void unlink(std::uint32_t index)
+    {
+        node& n = nodes_[index];
+        if (n.prev != npos) {
+            nodes_[n.prev].next = n.next;
+        } else {
+            heads_[n.slot] = n.next;
+        }
+        if (n.next != npos) {
+            nodes_[n.next].prev = n.prev;
+        } else {
+            tails_[n.slot] = n.prev;
+        }
+        n.slot = npos;
+    }
+
+    std::uint32_t allocate()
+    {
+        if (free_ != npos) {
+            const std::uint32_t index = free_;
+            free_ = nodes_[index].next;
+            return index;
+        }
+        nodes_.emplace_back();
+        return static_cast<std::uint32_t>(nodes_.size() - 1);
+    }
+
+    void release(std::uint32_t index)
+    {
+        node& n = nodes_[index];
+        ++n.generation;
+        n.next = free_;
+        free_ = index;
+    }
+
+    std::vector<node> nodes_;
+    std::vector<std::uint32_t> heads_ = std::vector<std::uint32_t>(levels * slots, npos);
+    std::vector<std::uint32_t> tails_ = std::vector<std::uint32_t>(levels * slots, npos);
+    std::uint32_t free_ = npos;
+    tick_type now_ = 0;
+    std::size_t size_ = 0;
+};
+
+#endif
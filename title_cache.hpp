@@ -0,0 +1,99 @@
+#ifndef TITLE_CACHE_HPP
+#define TITLE_CACHE_HPP
+
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Least recently used cache of video titles, shared by every network the bot
+// is connected to. Entries expire after a fixed time to live.
+class title_cache
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    title_cache(std::size_t capacity, clock::duration ttl)
+        : capacity_(capacity)
+        , ttl_(ttl)
+    {
+    }
+
+    std::optional<std::string> find(std::string_view id, clock::time_point now = clock::now())
+    {
+        std::lock_guard lg{mutex_};
+
+        auto it = index_.find(std::string(id));
+        if (it == std::end(index_))
+            return std::nullopt;
+
+        if (it->second->expires <= now) {
+            entries_.erase(it->second);
+            index_.erase(it);
+            return std::nullopt;
+        }
+
+        entries_.splice(std::begin(entries_), entries_, it->second);
+        return it->second->title;
+    }
+
+    void insert(std::string_view id, std::string title, clock::time_point now = clock::now())
+    {
+        std::lock_guard lg{mutex_};
+
+        if (auto it = index_.find(std::string(id)); it != std::end(index_)) {
+            entries_.erase(it->second);
+            index_.erase(it);
+        }
+
+        entries_.emplace_front(entry{std::string(id), std::move(title), now + ttl_});
+        index_.emplace(entries_.front().id, std::begin(entries_));
+
+        while (entries_.size() > capacity_) {
+            index_.erase(entries_.back().id);
+            entries_.pop_back();
+        }
+    }
+
+    // Drops expired entries, returns the number of entries dropped
+    std::size_t sweep(clock::time_point now = clock::now())
+    {
+        std::lock_guard lg{mutex_};
+
+        std::size_t dropped = 0;
+        for (auto it = std::begin(entries_); it != std::end(entries_);) {
+            if (it->expires <= now) {
+                index_.erase(it->id);
+                it = entries_.erase(it);
+                ++dropped;
+            } else {
+                ++it;
+            }
+        }
+        return dropped;
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard lg{mutex_};
+        return entries_.size();
+    }
+
+private:
+    struct entry {
+        std::string id;
+        std::string title;
+        clock::time_point expires;
+    };
+
+    const std::size_t capacity_;
+    const clock::duration ttl_;
+    mutable std::mutex mutex_;
+    std::list<entry> entries_;
+    std::unordered_map<std::string, std::list<entry>::iterator> index_;
+};
+
+#endif
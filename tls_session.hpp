@@ -0,0 +1,76 @@
+#ifndef TLS_SESSION_HPP
+#define TLS_SESSION_HPP
+
+#include <openssl/ssl.h>
+
+#include <type_traits>
+#include <utility>
+
+// Streams like boost::asio::ssl::stream whose native_handle() is an SSL*
+template <typename Stream, typename = void>
+struct has_ssl_handle : std::false_type {};
+
+template <typename Stream>
+struct has_ssl_handle<
+    Stream,
+    std::enable_if_t<std::is_same_v<decltype(std::declval<Stream&>().native_handle()), SSL*>>
+> : std::true_type {};
+
+// The session of the last connection to a server, offered to the server on
+// the next connection so that the handshake can be abbreviated.
+class tls_session
+{
+public:
+    tls_session() = default;
+    tls_session(const tls_session&) = delete;
+    tls_session& operator=(const tls_session&) = delete;
+
+    ~tls_session()
+    {
+        reset();
+    }
+
+    // With TLS 1.3 the session ticket arrives after the handshake, so this
+    // is called again when the connection closes.
+    void save(SSL* ssl)
+    {
+        SSL_SESSION* current = SSL_get_session(ssl);
+        if (!current || !SSL_SESSION_is_resumable(current))
+            return;
+
+        // A copy, OpenSSL marks the connection's own session as not
+        // resumable when the connection is freed without a clean shutdown
+        SSL_SESSION* session = SSL_SESSION_dup(current);
+        if (!session)
+            return;
+
+        reset();
+        session_ = session;
+    }
+
+    // Returns true if a session was offered
+    bool offer(SSL* ssl) const
+    {
+        return session_ && SSL_set_session(ssl, session_) == 1;
+    }
+
+    static bool reused(SSL* ssl)
+    {
+        return SSL_session_reused(ssl) == 1;
+    }
+
+    bool empty() const { return session_ == nullptr; }
+
+    void reset()
+    {
+        if (session_) {
+            SSL_SESSION_free(session_);
+            session_ = nullptr;
+        }
+    }
+
+private:
+    SSL_SESSION* session_ = nullptr;
+};
+
+#endif
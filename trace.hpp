@@ -0,0 +1,274 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include "metrics.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+// Points in the life of a line read from a server, in the order they
+// normally happen. Not every trace has all of them; a line that isn't
+// a link is only read and handled.
+enum class trace_stage : std::uint8_t
+{
+    read,          // net_stream read the line
+    handled,       // the handler returned
+    http_queued,   // CurlEngine::execute
+    http_started,  // CurlEngine took the request from its queue
+    http_done,     // the HTTP response came in
+    callback,      // the request's callback runs on the io_context
+    write_queued,  // a reply was queued by net_stream::write
+    written,       // the reply's write completed
+    count
+};
+
+// Identifies a trace in its tracer, 0 is none
+using trace_id = std::uint32_t;
+
+namespace trace_detail {
+inline thread_local trace_id current = 0;
+}
+
+// The trace of the line being handled on this thread, 0 if there is none
+inline trace_id current_trace() { return trace_detail::current; }
+
+// Makes a trace current for the rest of the scope, so that work started
+// from it (an HTTP request, a reply) joins the trace
+class trace_scope
+{
+public:
+    explicit trace_scope(trace_id id)
+        : previous_(trace_detail::current)
+    {
+        trace_detail::current = id;
+    }
+
+    ~trace_scope() { trace_detail::current = previous_; }
+
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+
+private:
+    trace_id previous_;
+};
+
+struct tracer_options
+{
+    // traces taking longer are written to the sample file
+    std::chrono::milliseconds slow{ 2000 };
+    // empty for no sampling
+    std::string sample_path;
+    // at most this many slow traces are sampled per second
+    unsigned samples_per_second = 1;
+};
+
+// Follows lines from the socket read to the write of the reply. A trace is
+// a fixed slot holding a timestamp per stage; stamping is a clock read and
+// a store. Whatever holds on to a trace across an asynchronous hop takes a
+// reference, and the last release records the time between stages in
+// histograms (trace_stage_seconds) and samples it to a file if it was slow.
+//
+// Slots are handed out round robin. When the next slot is still in use the
+// line isn't traced, which is counted in traces_dropped_total. Every
+// function may be called from any thread; the stamps of one trace are
+// ordered by the asynchronous hops between them.
+class tracer
+{
+public:
+    static constexpr std::size_t slots = 1024;
+
+    explicit tracer(metrics_registry& metrics, tracer_options options = {})
+        : options_(std::move(options))
+        , slots_(std::make_unique<slot[]>(slots))
+        , total_(metrics.add_histogram("trace_total_seconds", "Time from reading a line to its last stage"))
+        , dropped_(metrics.add_counter("traces_dropped_total", "Lines not traced because no trace slot was free"))
+    {
+        for (std::size_t i = 0; i < spans.size(); ++i) {
+            span_times_[i] = &metrics.add_histogram(
+                "trace_stage_seconds",
+                "Time spent between two stages of a trace",
+                fmt::format("stage=\"{}\"", spans[i].name));
+        }
+        if (!options_.sample_path.empty()) {
+            sample_file_ = std::fopen(options_.sample_path.c_str(), "a");
+            if (!sample_file_)
+                fmt::print("Unable to open trace samples {}\n", options_.sample_path);
+        }
+    }
+
+    ~tracer()
+    {
+        if (sample_file_)
+            std::fclose(sample_file_);
+    }
+
+    tracer(const tracer&) = delete;
+    tracer& operator=(const tracer&) = delete;
+
+    // Runs the writes to the sample file somewhere other than the thread
+    // that finished the trace, like a disk thread. Without one they are
+    // written inline. Set it before tracing starts; the tracer must outlive
+    // the writes it hands out.
+    void write_samples_with(std::function<void (std::function<void ()>)> post)
+    {
+        post_sample_ = std::move(post);
+    }
+
+    // Starts a trace of a line that has just been read, holding one
+    // reference. Returns 0 if no slot is free.
+    trace_id begin(std::string_view line)
+    {
+        const std::size_t index = next_.fetch_add(1, std::memory_order_relaxed) % slots;
+        slot& s = slots_[index];
+        std::uint32_t expected = free_slot;
+        if (!s.refs.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+            dropped_.add();
+            return 0;
+        }
+
+        s.stamps.fill(0);
+        s.stamps[stage_index(trace_stage::read)] = now();
+        s.length = static_cast<std::uint8_t>(std::min(line.size(), s.line.size()));
+        std::memcpy(s.line.data(), line.data(), s.length);
+        return static_cast<trace_id>(index + 1);
+    }
+
+    void stamp(trace_id id, trace_stage stage)
+    {
+        if (id)
+            get(id).stamps[stage_index(stage)] = now();
+    }
+
+    void add_ref(trace_id id)
+    {
+        if (id)
+            get(id).refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release(trace_id id)
+    {
+        if (!id)
+            return;
+        slot& s = get(id);
+        if (s.refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            finish(s, id);
+            s.refs.store(free_slot, std::memory_order_release);
+        }
+    }
+
+private:
+    static constexpr std::uint32_t free_slot = ~std::uint32_t(0);
+
+    struct slot
+    {
+        std::atomic<std::uint32_t> refs{ free_slot };
+        // nanoseconds on the steady clock, 0 if the stage didn't happen
+        std::array<std::int64_t, std::size_t(trace_stage::count)> stamps{};
+        // start of the line, for samples
+        std::array<char, 96> line{};
+        std::uint8_t length = 0;
+    };
+
+    struct span
+    {
+        std::string_view name;
+        trace_stage from;
+        trace_stage to;
+    };
+
+    static constexpr std::array<span, 5> spans = {{
+        { "dispatch", trace_stage::read, trace_stage::handled },
+        { "http_queue", trace_stage::http_queued, trace_stage::http_started },
+        { "http", trace_stage::http_started, trace_stage::http_done },
+        { "callback_post", trace_stage::http_done, trace_stage::callback },
+        { "write_queue", trace_stage::write_queued, trace_stage::written },
+    }};
+
+    static constexpr std::size_t stage_index(trace_stage stage) { return static_cast<std::size_t>(stage); }
+
+    static std::int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    slot& get(trace_id id) { return slots_[id - 1]; }
+
+    void finish(const slot& s, trace_id id)
+    {
+        const auto stamp = [&] (trace_stage stage) { return s.stamps[stage_index(stage)]; };
+
+        std::array<std::int64_t, spans.size()> durations{};
+        for (std::size_t i = 0; i < spans.size(); ++i) {
+            if (stamp(spans[i].from) && stamp(spans[i].to)) {
+                durations[i] = stamp(spans[i].to) - stamp(spans[i].from);
+                span_times_[i]->observe(std::chrono::nanoseconds(durations[i]));
+            }
+        }
+
+        const std::int64_t total = *std::max_element(s.stamps.begin(), s.stamps.end()) - stamp(trace_stage::read);
+        total_.observe(std::chrono::nanoseconds(total));
+
+        if (sample_file_ && std::chrono::nanoseconds(total) >= options_.slow)
+            sample(s, id, total, durations);
+    }
+
+    void sample(const slot& s, trace_id id, std::int64_t total, const std::array<std::int64_t, spans.size()>& durations)
+    {
+        std::lock_guard lock(sample_mutex_);
+
+        const auto second = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        if (second != sample_second_) {
+            sample_second_ = second;
+            samples_this_second_ = 0;
+        }
+        if (samples_this_second_ >= options_.samples_per_second)
+            return;
+        ++samples_this_second_;
+
+        std::string out = fmt::format("{} trace={} total_ms={:.3f}", second, id, total / 1e6);
+        for (std::size_t i = 0; i < spans.size(); ++i) {
+            if (durations[i])
+                out += fmt::format(" {}_ms={:.3f}", spans[i].name, durations[i] / 1e6);
+        }
+        out += fmt::format(" line={}\n", std::string_view(s.line.data(), s.length));
+        if (post_sample_)
+            post_sample_([this, out = std::move(out)] { write_sample(out); });
+        else
+            write_sample(out);
+    }
+
+    void write_sample(const std::string& out)
+    {
+        std::fputs(out.c_str(), sample_file_);
+        std::fflush(sample_file_);
+    }
+
+    const tracer_options options_;
+    std::unique_ptr<slot[]> slots_;
+    std::atomic<std::size_t> next_{ 0 };
+
+    histogram& total_;
+    counter& dropped_;
+    std::array<histogram*, spans.size()> span_times_{};
+
+    std::mutex sample_mutex_;
+    std::FILE* sample_file_ = nullptr;
+    std::function<void (std::function<void ()>)> post_sample_;
+    std::int64_t sample_second_ = 0;
+    unsigned samples_this_second_ = 0;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef WHEEL_TIMER_ENGINE_HPP
+#define WHEEL_TIMER_ENGINE_HPP
+
+#include "timing_wheel.hpp"
+
+#include <boost/asio.hpp>
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+class wheel_timer;
+
+// A TimerEngine whose timers all live in one timing_wheel, driven by a
+// single steady_timer that ticks while any timer is pending. Timers are
+// rounded up to whole ticks. Safe to use from several threads.
+class wheel_timer_engine
+{
+public:
+    using timer_type = wheel_timer;
+    using callback = std::function<void (const boost::system::error_code&)>;
+
+private:
+    // the wheel calls it without arguments when the timer expires
+    struct wheel_callback
+    {
+        callback function;
+
+        void operator()() { function(boost::system::error_code()); }
+        explicit operator bool() const { return static_cast<bool>(function); }
+    };
+
+public:
+    using handle = timing_wheel<wheel_callback>::handle;
+
+    explicit wheel_timer_engine(
+        boost::asio::io_context& io_context,
+        std::chrono::milliseconds resolution = std::chrono::milliseconds(10))
+        : io_context_(io_context)
+        , tick_timer_(io_context)
+        , resolution_(resolution)
+    {}
+
+    wheel_timer create_timer();
+
+    // The callback gets operation_aborted if the timer is cancelled
+    template <typename Duration>
+    handle schedule(Duration delay, callback&& callback)
+    {
+        const auto ticks = (std::chrono::duration_cast<std::chrono::nanoseconds>(delay) + resolution_ - std::chrono::nanoseconds(1)) / resolution_;
+
+        std::lock_guard lock(mutex_);
+        // the wheel is up to a tick behind the clock while ticking, one more
+        // keeps the timer from firing early
+        const auto h = wheel_.schedule((ticks > 0 ? ticks : 0) + (ticking_ ? 1 : 0), wheel_callback{ std::move(callback) });
+        if (!ticking_) {
+            ticking_ = true;
+            last_tick_ = std::chrono::steady_clock::now();
+            arm();
+        }
+        return h;
+    }
+
+    void cancel(handle h)
+    {
+        wheel_callback callback;
+        {
+            std::lock_guard lock(mutex_);
+            callback = wheel_.cancel(h);
+        }
+        if (callback)
+            callback.function(boost::asio::error::operation_aborted);
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard lock(mutex_);
+        return wheel_.size();
+    }
+
+    boost::asio::io_context& context() { return io_context_; }
+
+private:
+    void arm()
+    {
+        tick_timer_.expires_at(last_tick_ + resolution_);
+        tick_timer_.async_wait([this] (const boost::system::error_code& ec) {
+            if (ec)
+                return;
+            on_tick();
+        });
+    }
+
+    void on_tick()
+    {
+        std::lock_guard lock(mutex_);
+        // catch up on ticks missed while the thread was busy
+        const auto now = std::chrono::steady_clock::now();
+        const auto ticks = (now - last_tick_) / resolution_;
+        last_tick_ += ticks * resolution_;
+        wheel_.advance(ticks);
+
+        if (wheel_.empty()) {
+            ticking_ = false;
+        } else {
+            arm();
+        }
+    }
+
+    boost::asio::io_context& io_context_;
+    boost::asio::steady_timer tick_timer_;
+    const std::chrono::nanoseconds resolution_;
+    std::chrono::steady_clock::time_point last_tick_;
+    bool ticking_ = false;
+
+    mutable std::mutex mutex_;
+    timing_wheel<wheel_callback> wheel_;
+};
+
+// The engine's timer_type, used like a steady_timer: expires_after(),
+// async_wait() and cancel(). Handlers are invoked through their associated
+// executor, with operation_aborted when cancelled.
+class wheel_timer
+{
+public:
+    explicit wheel_timer(wheel_timer_engine& engine)
+        : engine_(&engine)
+    {}
+
+    wheel_timer(const wheel_timer&) = delete;
+    wheel_timer& operator=(const wheel_timer&) = delete;
+
+    ~wheel_timer()
+    {
+        cancel();
+    }
+
+    // Cancels a pending wait, like steady_timer
+    template <typename Duration>
+    void expires_after(Duration delay)
+    {
+        cancel();
+        delay_ = std::chrono::duration_cast<std::chrono::nanoseconds>(delay);
+    }
+
+    template <typename Handler>
+    void async_wait(Handler&& handler)
+    {
+        auto executor = boost::asio::get_associated_executor(handler, engine_->context().get_executor());
+        handle_ = engine_->schedule(
+            delay_,
+            [executor, handler = std::forward<Handler>(handler)] (const boost::system::error_code& ec) mutable {
+                boost::asio::post(executor, std::bind(std::move(handler), ec));
+            }
+        );
+    }
+
+    void cancel()
+    {
+        engine_->cancel(handle_);
+    }
+
+private:
+    wheel_timer_engine* engine_;
+    std::chrono::nanoseconds delay_{0};
+    wheel_timer_engine::handle handle_;
+};
+
+inline wheel_timer wheel_timer_engine::create_timer()
+{
+    return wheel_timer(*this);
+}
+
+#endif